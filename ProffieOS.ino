@@ -367,6 +367,8 @@ uint64_t loop_cycles = 0;
 CommandParser* parsers = NULL;
 MonitorHelper monitor_helper;
 
+#include "common/cpu_governor.h"
+
 #include "common/vec3.h"
 #include "common/quat.h"
 #include "common/ref.h"
@@ -906,6 +908,27 @@ public:
       return true;
     }
 #endif
+#if defined(ENABLE_SD_BLOCK_CACHE) && !defined(DISABLE_DIAGNOSTIC_COMMANDS)
+    if (!strcmp(cmd, "sdcache")) {
+      if (e && !strcmp(e, "clear")) sd_block_cache.Clear();
+      uint32_t hits = sd_block_cache.hits();
+      uint32_t reads = hits + sd_block_cache.misses();
+      STDOUT << "SD block cache: " << sd_block_cache.used_blocks() << "/" << SD_BLOCK_CACHE_BLOCKS
+             << " blocks used, " << sd_block_cache.pinned_blocks() << "/"
+             << SD_BLOCK_CACHE_PINNED_BLOCKS << " pinned\n";
+      STDOUT << "Hits: " << hits << " / " << reads;
+      if (reads) STDOUT << " (" << (hits * 100.0f / reads) << "%)";
+      STDOUT << "\n";
+      sd_block_cache.ResetStats();
+#if defined(ENABLE_SD_PREFETCH) && defined(ENABLE_AUDIO)
+      STDOUT << "Prefetched: " << sd_prefetcher.ready_files() << " files ready, "
+             << sd_prefetcher.hits() << " / " << (sd_prefetcher.hits() + sd_prefetcher.misses())
+             << " opens\n";
+      sd_prefetcher.ResetStats();
+#endif
+      return true;
+    }
+#endif
 
 #endif  // ENABLE_SD
 
@@ -1172,6 +1195,13 @@ public:
       interrupts();
       return true;
     }
+#ifdef ENABLE_PROFILING
+    if (!strcmp(cmd, "flame")) {
+      // Folded stacks, feed to flamegraph.pl or speedscope.
+      DumpProfileFlame();
+      return true;
+    }
+#endif
 #endif
 
     if (!strcmp(cmd, "version")) {
@@ -1607,6 +1637,11 @@ void mtp_yield() {
 }
 void mtp_lock_storage(bool lock) {
   AudioStreamWork::LockSD(lock);
+  // Files may be changed over MTP.
+  if (lock) {
+    SDBlockCacheClear();
+    SDNameCacheClear();
+  }
 }
 
 #include "mtp/mtpd.h"
@@ -1630,6 +1665,7 @@ void loop() {
 #ifdef MTP_RX_ENDPOINT
   mtpd.loop();
 #endif
+  TRACE_SCOPE(LOOP, LOOP, 0);
   Looper::DoLoop();
 }
 
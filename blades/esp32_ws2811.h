@@ -175,6 +175,7 @@ public:
   }
 
   IRAM_ATTR size_t rmt_read(rmt_item32_t *dest, size_t wanted_num) override {
+    SCOPED_PROFILE_FRAME("pixel_dma");
     ScopedCycleCounter cc(pixel_dma_interrupt_cycles);
     dest_ = dest;
     dest_end_ = dest + wanted_num;
@@ -485,15 +485,20 @@ private:
   }
   
   static void dma_refill_callback2(void* context, uint32_t events) {
+    SCOPED_PROFILE_FRAME("pixel_dma");
     ScopedCycleCounter cc(pixel_dma_interrupt_cycles);
+    TRACE_SCOPE(BLADE, PIXEL_REFILL, 2);
     ((WS2811EngineSTM32L4*)context)->DoRefill2();
   }
   static void dma_refill_callback1(void* context, uint32_t events) {
+    SCOPED_PROFILE_FRAME("pixel_dma");
     ScopedCycleCounter cc(pixel_dma_interrupt_cycles);
+    TRACE_SCOPE(BLADE, PIXEL_REFILL, 1);
     ((WS2811EngineSTM32L4*)context)->DoRefill1();
   }
   static void dma_done_callback_ignore(void* context, uint32_t events) {}
   static void dma_done_callback(void* context, uint32_t events) {
+    SCOPED_PROFILE_FRAME("pixel_dma");
     ScopedCycleCounter cc(pixel_dma_interrupt_cycles);
     ((WS2811EngineSTM32L4*)context)->DoDoneCB();
   }
@@ -645,6 +650,7 @@ public:
     if (!engine_) return;
     while (!IsReadyForEndFrame()) armv7m_core_yield();
     frame_num_++;
+    dither_ = cpu_governor_level() < GOVERNOR_NO_DITHERING;
 
     if (engine_) {
       done_ = false;
@@ -671,7 +677,7 @@ private:
     PROFFIEOS_ASSERT(color_buffer_size);
     Color16* pos = color_buffer_ptr;
     uint32_t* output = (uint32_t*) dest;
-    Color8 color = pos->dither(frame_num_, pos - color_buffer);
+    Color8 color = dither_ ? pos->dither(frame_num_, pos - color_buffer) : pos->truncate();
 #if 0    
     for (int i = Color8::inline_num_bytes(BYTEORDER) - 1; i >= 0; i--) {
       uint32_t tmp = color.inline_getByte(BYTEORDER, i) * 0x8040201U;
@@ -720,6 +726,7 @@ private:
   WS2811Engine* engine_;
   int8_t pin_;
   uint8_t frame_num_ = 0;
+  bool dither_ = true;
   uint16_t num_leds_;
   int frequency_;
   uint32_t reset_us_;
@@ -264,6 +264,11 @@ protected:
       if (current_blade) {
 	continue;
       }
+      if (cpu_governor_level() >= GOVERNOR_LIMIT_BLADE_FPS &&
+	  micros() - last_frame_micros_ < GOVERNOR_BLADE_FRAME_MICROS) {
+	continue;
+      }
+      last_frame_micros_ = micros();
       current_blade = this;
       if (power_off_requested_) {
 	PowerOff();
@@ -305,6 +310,15 @@ protected:
     STATE_MACHINE_END();
   }
 
+  uint32_t MaxIdleMillis() override {
+    if (run_) return 0;
+#ifdef BLADE_ID_SCAN_MILLIS
+    return BLADE_ID_SCAN_MILLIS;
+#else
+    return 0xffffffffUL;
+#endif
+  }
+
 #ifdef ENABLE_DEBUG
   void LoopDebug() override {
     STDERR << "stuck somewhere after: " << state_machine_.next_state_ << "\n";
@@ -324,6 +338,7 @@ private:
   bool power_off_requested_ = false;
   uint32_t poweroff_delay_ms_;
   uint32_t poweroff_delay_start_ = 0;
+  uint32_t last_frame_micros_ = 0;
   LoopCounter loop_counter_;
   StateMachineState state_machine_;
   PowerPinInterface* power_;
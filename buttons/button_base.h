@@ -27,6 +27,11 @@
 #define BUTTON_HELD_LONG_TIMEOUT 2000
 #endif
 
+// How often buttons are polled when the board is idle.
+#ifndef BUTTON_IDLE_POLL_MILLIS
+#define BUTTON_IDLE_POLL_MILLIS 50
+#endif
+
 
 // Simple button handler. Keeps track of clicks and lengths of pushes.
 class ButtonBase : public Looper,
@@ -121,6 +126,12 @@ protected:
     STATE_MACHINE_END();
   }
 
+  uint32_t MaxIdleMillis() override {
+    // Pressed, debouncing, or waiting for a double click.
+    if (saved_event_ || (current_modifiers & button_) || Read()) return 0;
+    return BUTTON_IDLE_POLL_MILLIS;
+  }
+
   bool Parse(const char* cmd, const char* arg) override {
 #ifndef DISABLE_DIAGNOSTIC_COMMANDS    
     if (!strcmp(cmd, name_)) {
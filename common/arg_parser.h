@@ -23,30 +23,57 @@ bool FirstWord(const char *str, const char *word) {
   return false;
 }
 
+// Style strings are split into words once, and the start of each word is
+// kept in a table, so looking up an argument doesn't mean scanning the
+// string from the beginning every time. Strings with more words than
+// fit in the table still work, they just scan past the last known word.
+#ifndef ARG_PARSER_MAX_ARGS
+#define ARG_PARSER_MAX_ARGS 64
+#endif
+
 class ArgParser : public ArgParserInterface {
 public:
-  ArgParser(const char* data) : str_(data) {}
+  ArgParser(const char* data) { Reset(data); }
 
   const char* GetArg(int arg_num,
 		     const char* name,
 		     const char* default_value) override {
-    const char* ret = str_;
-    int arg = 0;
-    while (true) {
-      while (*ret == ' ' || *ret == '\t') ret++;
-      if (!*ret) return default_value;
-      if (++arg == arg_num) {
-	if (*ret == '~') return default_value;
-	return ret;
+    if (arg_num < 1) return default_value;
+    const char* ret;
+    int word = first_word_ + arg_num - 1;
+    if (word < num_words_) {
+      ret = data_ + offsets_[word];
+    } else {
+      if (num_words_ < ARG_PARSER_MAX_ARGS) return default_value;
+      // Past the end of the table.
+      ret = data_ + offsets_[num_words_ - 1];
+      for (int w = num_words_ - 1; w < word; w++) {
+	ret = SkipSpace(SkipWord(ret));
+	if (!*ret) return default_value;
       }
-      while (*ret && *ret != ' ' && *ret != '\t') ret++;
     }
+    if (*ret == '~') return default_value;
+    return ret;
   }
   void Shift(int words) override {
-    while (words-- > 0) str_ = SkipWord(str_);
+    if (words > 0) first_word_ += words;
   }
 protected:
-  const char* str_;
+  void Reset(const char* data) {
+    data_ = data;
+    first_word_ = 0;
+    num_words_ = 0;
+    for (const char* p = SkipSpace(data); *p; p = SkipSpace(SkipWord(p))) {
+      if (num_words_ == ARG_PARSER_MAX_ARGS) break;
+      offsets_[num_words_++] = p - data;
+    }
+  }
+
+private:
+  const char* data_;
+  int first_word_;
+  int num_words_;
+  uint16_t offsets_[ARG_PARSER_MAX_ARGS];
 };
 
 class ArgParserPrinter : public ArgParser {
@@ -75,7 +102,7 @@ public:
     }
     start_current_arg = current_arg;
     offset = 0;
-    str_ = data_; // reset ArgParser
+    Reset(data_);
     return current_arg <= max_arg;
   }
   
@@ -121,14 +148,64 @@ private:
   bool found = false;
   int current_arg = 1;
   char* output_;
-  const char* str_;
 };
 
+// Like GetArgParser, but records the values of all arguments up to
+// |num_args| while the style is constructed, so the style only needs to
+// be constructed once. Values are copied, since default values may live
+// on the stack of the style that asked for them.
+class GetArgsParser : public ArgParser {
+public:
+  GetArgsParser(const char* data, int num_args) : ArgParser(data), num_args_(num_args) {
+    if (num_args > 0) values_ = (char**)calloc(num_args, sizeof(char*));
+  }
+  ~GetArgsParser() {
+    if (!values_) return;
+    for (int i = 0; i < num_args_; i++) free(values_[i]);
+    free(values_);
+  }
+
+  const char* GetArg(int arg_num,
+		     const char* name,
+		     const char* default_value) override {
+    const char* ret = ArgParser::GetArg(arg_num, name, default_value);
+    int arg = arg_num + offset_;
+    if (values_ && ret && arg >= 0 && arg < num_args_) {
+      const char* tmp = SkipWord(ret);
+      free(values_[arg]);
+      values_[arg] = (char*)malloc(tmp - ret + 1);
+      if (values_[arg]) {
+	memcpy(values_[arg], ret, tmp - ret);
+	values_[arg][tmp - ret] = 0;
+      }
+    }
+    return ret;
+  }
+  void Shift(int words) override {
+    ArgParser::Shift(words);
+    offset_ += words;
+  }
+
+  // Returns nullptr if the style did not use argument |arg|.
+  const char* value(int arg) const {
+    if (!values_ || arg < 0 || arg >= num_args_) return nullptr;
+    return values_[arg];
+  }
+
+private:
+  int offset_ = 0;
+  int num_args_;
+  char** values_ = nullptr;
+};
+
+// Records which arguments are used, and the highest one.
 class GetMaxArgParser : public ArgParser {
 public:
   GetMaxArgParser(const char* data) : ArgParser(data) {}
   const char* GetArg(int arg_num, const char* name, const char* default_value) override {
-    max_ = std::max<int>(max_, arg_num + offset_);
+    int arg = arg_num + offset_;
+    max_ = std::max<int>(max_, arg);
+    if (arg >= 0 && arg < 64) used_ |= 1ULL << arg;
     return ArgParser::GetArg(arg_num, name, default_value);
   }
   void Shift(int words) override {
@@ -138,9 +215,12 @@ public:
   int max_arg() {
     return max_;
   }
+  // Only arguments 0-63 are recorded.
+  uint64_t used() const { return used_; }
 private:
   int offset_ = 0;
   int max_ = 0;
+  uint64_t used_ = 0;
 };
 
 class DefaultArgumentParserWrapper : public ArgParserInterface {
@@ -77,6 +77,10 @@ protected:
     STATE_MACHINE_END();
   }
 
+  // The voltage filter takes the time between samples into account,
+  // so sampling less often when idle is fine.
+  uint32_t MaxIdleMillis() override { return 1000; }
+
   bool IsLow() {
 #if VERSION_MAJOR >= 4
     if (USBD_Connected()) return false;
@@ -32,7 +32,7 @@ public:
   }
   void pop(size_t elements) { last_ += elements; }
 
-  void clear() { first_ = 0; last_=0; }
+  void clear() { first_.set(0); last_.set(0); }
   size_t pos() { return last_.get(); }
 
 private:
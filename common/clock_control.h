@@ -5,7 +5,17 @@
 
 #include "looper.h"
 
-class ClockControl : public Looper {
+// Longest single sleep, even if no looper needs to run sooner.
+#ifndef CLOCK_CONTROL_MAX_SLEEP_MILLIS
+#define CLOCK_CONTROL_MAX_SLEEP_MILLIS 100
+#endif
+
+// How long without activity before we start sleeping.
+#ifndef CLOCK_CONTROL_IDLE_TIMEOUT_MILLIS
+#define CLOCK_CONTROL_IDLE_TIMEOUT_MILLIS 30000
+#endif
+
+class ClockControl : public Looper, CommandParser {
 public:
   const char* name() override { return "ClockControl"; }
   void Loop() override {
@@ -25,9 +35,18 @@ public:
     // These two variables must be read in order.
     uint32_t last_activity = last_activity_;
     uint32_t now = millis();
-    if (now - last_activity > 30000) {
+    if (now - last_activity > CLOCK_CONTROL_IDLE_TIMEOUT_MILLIS) {
+      // Sleep until the first looper needs to run again.
+      uint32_t sleep_ms = std::min<uint32_t>(Looper::IdleMillis(),
+                                             CLOCK_CONTROL_MAX_SLEEP_MILLIS);
+#ifdef COMMON_I2CBUS_H
+      // Motion and other things might still be going on.
+      if (i2cbus.used()) sleep_ms = std::min<uint32_t>(sleep_ms, 5);
+#endif
+      if (!sleep_ms) return;
       uint32_t pclk1 = stm32l4_system_pclk1();
       uint32_t pclk2 = stm32l4_system_pclk2();
+      uint32_t start = micros();
 #if 0 // #ifdef PROFFIEBOARD_VERSION
       // This saves power, but also casuses freezing.
       // TODO: FIgure out why and re-enable.
@@ -35,21 +54,53 @@ public:
 #else
       stm32l4_system_sysclk_configure(16000000, 8000000, 8000000);
 #endif
-#ifdef COMMON_I2CBUS_H
-      // Motion and other things might still be going on.
-      if (i2cbus.used())
-        delay(5);
-      else
-#endif
-        delay(50);
+      delay(sleep_ms);
       stm32l4_system_sysclk_configure(_SYSTEM_CORE_CLOCK_, pclk1, pclk2);
+      // Wake latency is how much later than requested we got back
+      // to full speed.
+      uint32_t slept = micros() - start;
+      uint32_t latency = slept > sleep_ms * 1000 ? slept - sleep_ms * 1000 : 0;
+      sleeps_++;
+      slept_micros_ += slept;
+      wake_latency_sum_ += latency;
+      wake_latency_max_ = std::max(wake_latency_max_, latency);
     }
   }
 
   void AvoidSleep() { last_activity_ = millis(); }
-    
+
+  bool Parse(const char* cmd, const char* arg) override {
+#ifndef DISABLE_DIAGNOSTIC_COMMANDS
+    if (!strcmp(cmd, "idle")) {
+      // We never sleep while serial is connected, so these stats are
+      // mostly useful right after plugging in.
+      // Standby current ~= sleep% * current@16MHz + (100 - sleep%) * current@80MHz
+      uint32_t total = millis() - stats_start_;
+      STDOUT << "sleeps: " << sleeps_
+             << " sleep%: " << (total ? slept_micros_ / 10.0f / total : 0.0f)
+             << " avg sleep ms: " << (sleeps_ ? slept_micros_ / 1000.0f / sleeps_ : 0.0f)
+             << " wake latency avg us: " << (sleeps_ ? wake_latency_sum_ / (float)sleeps_ : 0.0f)
+             << " max us: " << wake_latency_max_
+             << " next wakeup ms: " << Looper::IdleMillis()
+             << "\n";
+      sleeps_ = 0;
+      slept_micros_ = 0;
+      wake_latency_sum_ = 0;
+      wake_latency_max_ = 0;
+      stats_start_ = millis();
+      return true;
+    }
+#endif
+    return false;
+  }
+
   private:
     volatile uint32_t last_activity_;
+    uint32_t sleeps_ = 0;
+    uint64_t slept_micros_ = 0;
+    uint64_t wake_latency_sum_ = 0;
+    uint32_t wake_latency_max_ = 0;
+    uint32_t stats_start_ = 0;
 };
 
 ClockControl clock_control;
@@ -248,6 +248,11 @@ class Color16 {
     return dither(color16_dither_matrix[x & 3][y & 3]);
   }
 
+  // Like dither(0), but without the saturating add.
+  Color8 truncate() const {
+    return Color8(r >> 8, g >> 8, b >> 8);
+  }
+
   uint16_t getShort(int byteorder, int byte) {
     switch (byteorder >> (byte * 4) & 0x7) {
       default: return r;
@@ -2,8 +2,30 @@
 #define COMMON_COMMAND_PARSER_H
 
 #include "linked_list.h"
+#include "strfun.h"
 
 // Command parsing linked list base class.
+//
+// Which parser handled a command is remembered, so the next time the
+// same command comes in, that parser is asked first instead of asking
+// every parser in turn. Editors that talk over WebUSB or Bluetooth send
+// hundreds of commands, so this adds up. If the remembered parser says
+// no, the other parsers are asked as usual. Everything is forgotten
+// whenever a parser is added or removed.
+// Only the first parser in the list that has taken a command is
+// remembered; a later parser never replaces an earlier one. Parsers
+// earlier in the list than the remembered one are skipped while it
+// keeps saying yes though, so if two parsers take the same command
+// name, the earlier one must not turn down arguments that the later
+// one takes. Today "blade" (one parser per blade) and "booster"
+// (ProffieOS.ino and common/booster.h) are the only commands taken by
+// more than one parser in the same build, and those parsers all take
+// the same arguments.
+// Set COMMAND_PARSER_CACHE_SIZE to 0 to always ask every parser.
+#ifndef COMMAND_PARSER_CACHE_SIZE
+#define COMMAND_PARSER_CACHE_SIZE 32  // must be a power of two
+#endif
+
 class CommandParser;
 extern CommandParser* parsers;
 
@@ -11,12 +33,14 @@ class CommandParser {
 public:
   void Link() {
     CHECK_LL(CommandParser, parsers, next_parser_);
+    ClearCache();
     next_parser_ = parsers;
     parsers = this;
     CHECK_LL(CommandParser, parsers, next_parser_);
   }
   void Unlink() {
     CHECK_LL(CommandParser, parsers, next_parser_);
+    ClearCache();
     for (CommandParser** i = &parsers; *i; i = &(*i)->next_parser_) {
       if (*i == this) {
         *i = next_parser_;
@@ -32,15 +56,54 @@ public:
   ~CommandParser() { Unlink(); }
   static bool DoParse(const char* cmd, const char* arg) {
     CHECK_LL(CommandParser, parsers, next_parser_);
+#if COMMAND_PARSER_CACHE_SIZE > 0
+    uint32_t hash = HashWord(cmd);
+    CacheEntry& entry = cache()[hash & (COMMAND_PARSER_CACHE_SIZE - 1)];
+    CommandParser* cached = entry.hash == hash ? entry.parser : nullptr;
+    if (cached && cached->Parse(cmd, arg)) return true;
+#endif
+#if COMMAND_PARSER_CACHE_SIZE > 0
+    bool before_cached = true;
+#endif
     for (CommandParser *p = parsers; p; p = p->next_parser_) {
+#if COMMAND_PARSER_CACHE_SIZE > 0
+      if (p == cached) {
+        before_cached = false;
+        continue;
+      }
+      if (p->Parse(cmd, arg)) {
+        // Don't let a later parser take over from an earlier one.
+        if (before_cached) {
+          entry.hash = hash;
+          entry.parser = p;
+        }
+        return true;
+      }
+#else
       if (p->Parse(cmd, arg))
         return true;
+#endif
     }
     return false;
   }
 protected:
   virtual bool Parse(const char* cmd, const char* arg) = 0;
 private:
+#if COMMAND_PARSER_CACHE_SIZE > 0
+  struct CacheEntry {
+    uint32_t hash;
+    CommandParser* parser;
+  };
+  static CacheEntry* cache() {
+    static CacheEntry entries[COMMAND_PARSER_CACHE_SIZE];
+    return entries;
+  }
+  static void ClearCache() {
+    for (int i = 0; i < COMMAND_PARSER_CACHE_SIZE; i++) cache()[i].parser = nullptr;
+  }
+#else
+  static void ClearCache() {}
+#endif
   CommandParser* next_parser_;
 };
 
@@ -0,0 +1,175 @@
+#ifndef COMMON_CPU_GOVERNOR_H
+#define COMMON_CPU_GOVERNOR_H
+
+// When the CPU is saturated, everything slows down at the same time,
+// and audio underflows are the most noticeable result. The governor
+// watches interrupt load, loop rate and audio underflows and sheds
+// optional work in a fixed order to protect audio. Each level
+// includes all the levels before it.
+enum CpuGovernorLevel {
+  GOVERNOR_NORMAL = 0,
+  GOVERNOR_LIMIT_BLADE_FPS = 1,
+  GOVERNOR_SKIP_DISPLAY_FRAMES = 2,
+  GOVERNOR_SLOW_SMOOTHSWING = 3,
+  GOVERNOR_NO_DITHERING = 4,
+  GOVERNOR_MAX_LEVEL = 4,
+};
+
+#ifdef ENABLE_CPU_GOVERNOR
+
+#include "looper.h"
+#include "command_parser.h"
+
+// How often load is evaluated.
+#ifndef GOVERNOR_PERIOD_MS
+#define GOVERNOR_PERIOD_MS 250
+#endif
+
+// Percent of all cycles spent in audio, wav and pixel interrupts.
+#ifndef GOVERNOR_HIGH_INTERRUPT_LOAD
+#define GOVERNOR_HIGH_INTERRUPT_LOAD 60
+#endif
+#ifndef GOVERNOR_LOW_INTERRUPT_LOAD
+#define GOVERNOR_LOW_INTERRUPT_LOAD 40
+#endif
+
+// Below this, the main loop is considered starved.
+#ifndef GOVERNOR_MIN_LOOPS_PER_SECOND
+#define GOVERNOR_MIN_LOOPS_PER_SECOND 200
+#endif
+
+// How long things must look good before going down one level.
+#ifndef GOVERNOR_RECOVER_MS
+#define GOVERNOR_RECOVER_MS 2000
+#endif
+
+// Blade frame rate limit used at GOVERNOR_LIMIT_BLADE_FPS and above.
+#ifndef GOVERNOR_BLADE_FRAME_MICROS
+#define GOVERNOR_BLADE_FRAME_MICROS (1000000 / 60)
+#endif
+
+class CpuGovernor : Looper, CommandParser {
+public:
+  CpuGovernor() : Looper(), CommandParser() {}
+  const char* name() override { return "CpuGovernor"; }
+
+  CpuGovernorLevel level() const { return (CpuGovernorLevel)level_; }
+
+  // Called from the audio interrupt.
+  void NoteAudioUnderflow() { underflows_++; }
+
+protected:
+  void Setup() override {
+    // Load measurement needs the cycle counter.
+#ifdef TEENSYDUINO
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+#ifdef ARDUINO_ARCH_STM32L4
+    CoreDebug->DEMCR |= 1 << 24;  // DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    last_cycles_ = ScopedCycleCounter::getRawCycles();
+    last_interrupt_cycles_ = InterruptCycles();
+    last_check_ = last_good_ = millis();
+  }
+
+  void Loop() override {
+    uint32_t now = millis();
+    if (now - last_check_ < GOVERNOR_PERIOD_MS) return;
+    last_check_ = now;
+
+    uint32_t cycles = ScopedCycleCounter::getRawCycles();
+    uint32_t elapsed = cycles - last_cycles_;
+    last_cycles_ = cycles;
+    uint64_t interrupt_cycles = InterruptCycles();
+    // The "top" command resets the counters.
+    if (interrupt_cycles < last_interrupt_cycles_) last_interrupt_cycles_ = 0;
+    uint32_t busy = interrupt_cycles - last_interrupt_cycles_;
+    last_interrupt_cycles_ = interrupt_cycles;
+    load_ = elapsed ? busy * 100.0f / elapsed : 0.0f;
+
+    uint32_t underflows = underflows_;
+    bool underflowed = underflows != last_underflows_;
+    last_underflows_ = underflows;
+
+    float loops = global_loop_counter.LoopsPerSecond();
+    bool starved = underflowed ||
+      load_ > GOVERNOR_HIGH_INTERRUPT_LOAD ||
+      (loops > 0.0 && loops < GOVERNOR_MIN_LOOPS_PER_SECOND);
+    bool relaxed = !underflowed &&
+      load_ < GOVERNOR_LOW_INTERRUPT_LOAD &&
+      (loops == 0.0 || loops > GOVERNOR_MIN_LOOPS_PER_SECOND * 2);
+
+    if (!automatic_) {
+      // Level set by the "governor" command.
+    } else if (starved) {
+      if (level_ < GOVERNOR_MAX_LEVEL) level_++;
+      last_good_ = now;
+    } else if (!relaxed) {
+      last_good_ = now;
+    } else if (now - last_good_ > GOVERNOR_RECOVER_MS) {
+      if (level_ > GOVERNOR_NORMAL) level_--;
+      last_good_ = now;
+    }
+
+    if (monitor.ShouldPrint(Monitoring::MonitorGovernor)) {
+      STDOUT << "governor level: " << level_
+             << " interrupt load: " << load_
+             << "% loops/s: " << loops
+             << " underflows: " << underflows
+             << (automatic_ ? "" : " (fixed)") << "\n";
+    }
+  }
+
+  bool Parse(const char* cmd, const char* arg) override {
+#ifndef DISABLE_DIAGNOSTIC_COMMANDS
+    if (!strcmp(cmd, "governor")) {
+      if (arg && !strcmp(arg, "auto")) {
+        automatic_ = true;
+      } else if (arg && *arg) {
+        automatic_ = false;
+        level_ = std::min<int>(atoi(arg), GOVERNOR_MAX_LEVEL);
+      }
+      STDOUT << "governor level: " << level_
+             << (automatic_ ? " auto" : " fixed")
+             << " interrupt load: " << load_ << "%\n";
+      return true;
+    }
+#endif
+    return false;
+  }
+
+private:
+  static uint64_t InterruptCycles() {
+    noInterrupts();
+    uint64_t ret = audio_dma_interrupt_cycles + wav_interrupt_cycles +
+      pixel_dma_interrupt_cycles;
+    interrupts();
+    return ret;
+  }
+
+  volatile int level_ = GOVERNOR_NORMAL;
+  bool automatic_ = true;
+  float load_ = 0.0;
+  volatile uint32_t underflows_ = 0;
+  uint32_t last_underflows_ = 0;
+  uint32_t last_check_ = 0;
+  uint32_t last_good_ = 0;
+  uint32_t last_cycles_ = 0;
+  uint64_t last_interrupt_cycles_ = 0;
+};
+
+CpuGovernor cpu_governor;
+
+inline CpuGovernorLevel cpu_governor_level() { return cpu_governor.level(); }
+inline void cpu_governor_note_audio_underflow() { cpu_governor.NoteAudioUnderflow(); }
+
+#else  // ENABLE_CPU_GOVERNOR
+
+inline CpuGovernorLevel cpu_governor_level() { return GOVERNOR_NORMAL; }
+inline void cpu_governor_note_audio_underflow() {}
+
+#endif  // ENABLE_CPU_GOVERNOR
+
+#endif
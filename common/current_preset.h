@@ -412,6 +412,9 @@ public:
     fs.Close();
     out.Write("end\n");
     out.Close(iteration_);
+    if (monitor.IsMonitoring(Monitoring::MonitorSD)) {
+      STDOUT << "Longest SD stall while saving: " << out.max_stall_micros() << " us\n";
+    }
     preset_num = position;
 #endif
   }
@@ -106,6 +106,7 @@ public:
     type_ = TYPE_SD;
     sd_file_ = LSFS::Open(filename);
     if (sd_file_) {
+      StartCaching(filename);
       return true;
     } else {
       Close();
@@ -131,6 +132,7 @@ public:
     type_ = TYPE_SD;
     sd_file_ = LSFS::OpenFast(filename);
     if (sd_file_) {
+      StartCaching(filename);
       return true;
     } else {
       Close();
@@ -141,6 +143,7 @@ public:
   bool Create(const char* filename) {
     Close();
 #ifdef ENABLE_SD
+    SDBlockCacheInvalidate(filename);
     new (&sd_file_) File;
     sd_file_ = LSFS::OpenForWrite(filename);
     if (sd_file_) {
@@ -153,6 +156,7 @@ public:
   bool OpenRW(const char* filename) {
     Close();
 #ifdef ENABLE_SD
+    SDBlockCacheInvalidate(filename);
     new (&sd_file_) File;
     sd_file_ = LSFS::OpenRW(filename);
     if (sd_file_) {
@@ -178,6 +182,10 @@ public:
     return false;
   };
   void Close() {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    SetLooping(false);
+    cache_file_ = 0;
+#endif
     switch (type_) {
       IF_SD(case TYPE_SD: sd_file_.close(); sd_file_.~File(); break;)
       IF_SF(case TYPE_SF: sf_file_.close(); sf_file_.~SerialFlashFile(); break;)
@@ -187,6 +195,9 @@ public:
     mem_file_ = MemFile();
   }
   int Read(uint8_t* dest, int bytes) {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    if (cache_file_) return CachedRead(dest, bytes);
+#endif
     RUN_ALL(read(dest, bytes))
     return 0;
   }
@@ -205,21 +216,44 @@ public:
   int Write(uint8_t c) { return Write(&c, 1); }
   int Write(const char *str) { return Write((uint8_t*)str, strlen(str)); }
   void Seek(uint32_t n) {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    if (cache_file_) {
+      cache_pos_ = std::min(n, cache_size_);
+      return;
+    }
+#endif
     RUN_ALL_VOID(seek(n))
   }
   uint32_t Available() {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    if (cache_file_) return cache_size_ - cache_pos_;
+#endif
     RUN_ALL(available());
     return 0;
   }
   uint32_t Tell() {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    if (cache_file_) return cache_pos_;
+#endif
     RUN_ALL(position());
     return 0;
   }
   uint32_t FileSize() {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    if (cache_file_) return cache_size_;
+#endif
     RUN_ALL(size());
     return 0;
   }
   int Peek() {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    if (cache_file_) {
+      uint8_t tmp;
+      if (!CachedRead(&tmp, 1)) return -1;
+      cache_pos_--;
+      return tmp;
+    }
+#endif
     switch (type_) {
       IF_SD(case TYPE_SD: return sd_file_.peek(););
 #ifdef ENABLE_SERIALFLASH
@@ -260,6 +294,54 @@ public:
   void Skip(int n) { Seek(Tell() + n); }
   void Rewind() { Seek(0); }
 
+  // Call right after seeking back to the start of a loop. The first
+  // blocks from here on are kept in the SD block cache until the file
+  // is closed or stops looping, see sd_block_cache.h.
+  void SetLooping(bool looping) {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    if (!cache_file_) return;
+    if (cache_pinned_) sd_block_cache.Unpin(cache_file_);
+    cache_pinned_ = looping;
+    if (!looping) return;
+    loop_block_ = cache_pos_ / SDBlockCache::BLOCK_SIZE;
+    sd_block_cache.Pin(cache_file_, loop_block_, SD_BLOCK_CACHE_LOOP_BLOCKS);
+#endif
+  }
+
+  // Lets the first |blocks| blocks go through the SD block cache even if
+  // the file is too large for it, for files that are read ahead of time.
+  void CacheHead(uint32_t blocks) {
+#ifdef ENABLE_SD_BLOCK_CACHE
+    cache_head_blocks_ = blocks;
+#endif
+  }
+
+  // Moves an open file from |other| to this reader without closing and
+  // re-opening it. |other| is left closed.
+  void Take(FileReader* other) {
+    Close();
+    switch (other->type_) {
+      IF_SD(case TYPE_SD: new (&sd_file_) File(other->sd_file_); other->sd_file_.~File(); break;)
+      IF_SF(case TYPE_SF: new (&sf_file_) SerialFlashFile(other->sf_file_); other->sf_file_.~SerialFlashFile(); break;)
+      IF_MEM(case TYPE_MEM: mem_file_ = other->mem_file_; break;)
+    }
+    type_ = other->type_;
+#ifdef ENABLE_SD_BLOCK_CACHE
+    cache_file_ = other->cache_file_;
+    cache_size_ = other->cache_size_;
+    cache_pos_ = other->cache_pos_;
+    cache_file_pos_ = other->cache_file_pos_;
+    cache_all_ = other->cache_all_;
+    cache_head_blocks_ = other->cache_head_blocks_;
+    cache_pinned_ = other->cache_pinned_;
+    loop_block_ = other->loop_block_;
+    other->cache_file_ = 0;
+    other->cache_pinned_ = false;
+#endif
+    other->type_ = TYPE_MEM;
+    new (&other->mem_file_) MemFile();
+  }
+
   void skipwhite() {
     while (true) {
       switch (Peek()) {
@@ -434,6 +516,79 @@ public:
     write_key_value(key, new_value);
   }
 private:
+#ifdef ENABLE_SD_BLOCK_CACHE
+  // Files opened for reading are read one block at a time. Blocks of
+  // small files, the first blocks at the loop point of looping files and
+  // the head set by CacheHead() go through sd_block_cache, the rest is
+  // read directly.
+  // cache_pos_ is the position seen by the caller, cache_file_pos_ is
+  // where sd_file_ actually is.
+  void StartCaching(const char* filename) {
+    cache_size_ = sd_file_.size();
+    cache_all_ = cache_size_ <= SD_BLOCK_CACHE_MAX_FILE_SIZE;
+    cache_head_blocks_ = 0;
+    cache_pinned_ = false;
+    cache_file_ = SDBlockCache::FileId(filename);
+    cache_pos_ = 0;
+    cache_file_pos_ = 0;
+  }
+
+  int CachedRead(uint8_t* dest, int bytes) {
+    int done = 0;
+    while (bytes > 0 && cache_pos_ < cache_size_) {
+      uint32_t block = cache_pos_ / SDBlockCache::BLOCK_SIZE;
+      uint32_t offset = cache_pos_ % SDBlockCache::BLOCK_SIZE;
+      bool loop_head = cache_pinned_ && block - loop_block_ < SD_BLOCK_CACHE_LOOP_BLOCKS;
+      if (!cache_all_ && !loop_head && block >= cache_head_blocks_) {
+        if (cache_file_pos_ != cache_pos_) sd_file_.seek(cache_pos_);
+        int n = sd_file_.read(dest, std::min<int>(bytes, SDBlockCache::BLOCK_SIZE - offset));
+        if (n <= 0) {
+          cache_file_pos_ = 0xFFFFFFFF;
+          break;
+        }
+        cache_file_pos_ = cache_pos_ + n;
+        dest += n;
+        bytes -= n;
+        done += n;
+        cache_pos_ += n;
+        continue;
+      }
+      SDBlockCache::Block* b = sd_block_cache.Find(cache_file_, cache_size_, block);
+      if (!b) {
+        b = sd_block_cache.Allocate(cache_file_, cache_size_, block, loop_head);
+        uint32_t start = block * SDBlockCache::BLOCK_SIZE;
+        if (cache_file_pos_ != start) sd_file_.seek(start);
+        int n = sd_file_.read(b->data, SDBlockCache::BLOCK_SIZE);
+        if (n <= 0) {
+          sd_block_cache.Drop(b);
+          cache_file_pos_ = 0xFFFFFFFF;
+          break;
+        }
+        cache_file_pos_ = start + n;
+        b->size = n;
+      }
+      if (offset >= b->size) break;
+      int n = std::min<int>(bytes, b->size - offset);
+      memcpy(dest, b->data + offset, n);
+      dest += n;
+      bytes -= n;
+      done += n;
+      cache_pos_ += n;
+    }
+    return done;
+  }
+
+  uint32_t cache_file_ = 0;  // 0 = not cached
+  uint32_t cache_size_;
+  uint32_t cache_pos_;
+  uint32_t cache_file_pos_;
+  bool cache_all_;
+  uint32_t cache_head_blocks_;
+  bool cache_pinned_ = false;
+  uint32_t loop_block_;
+#else
+  void StartCaching(const char* filename) {}
+#endif
   enum {
 #ifdef ENABLE_SD
     TYPE_SD,
@@ -563,18 +718,55 @@ public:
 #define MAX_CONFIG_FILE_SIZE (256  * 1024)
 #endif
 
+// Saves are collected in RAM and written one whole 512-byte sector at a
+// time. Define PROFFIEOS_UNBUFFERED_WRITES to write directly instead.
+#if !defined(PROFFIEOS_BUFFER_WRITES) && !defined(PROFFIEOS_UNBUFFERED_WRITES)
+#define PROFFIEOS_BUFFER_WRITES
+#endif
+
+// Writes config and preset files. The file is preallocated to
+// MAX_CONFIG_FILE_SIZE the first time, so later saves overwrite the
+// same sectors instead of allocating new ones. The header with the
+// length and checksum is written last; see FileValidator.
+//
+// Saving usually happens with the SD card locked, which stops the
+// audio streams from reading. With PROFFIEOS_BUFFER_WRITES, the audio
+// streams are allowed to refill between sectors, and max_stall_micros()
+// is the longest time they had to wait.
 class BufferedFileWriter {
 private:
   FileReader f;
   CheckSummer checksum;
+  uint32_t stall_start_;
+  uint32_t max_stall_micros_ = 0;
 #ifdef PROFFIEOS_BUFFER_WRITES
   uint32_t position = 0;
   uint8_t buffer[512];
 #endif  
 
+  void YieldSD() {
+    uint32_t now = micros();
+    max_stall_micros_ = std::max<uint32_t>(max_stall_micros_, now - stall_start_);
+#ifdef YIELD_SD
+    YIELD_SD();
+#endif
+    stall_start_ = micros();
+  }
+
+#ifdef PROFFIEOS_BUFFER_WRITES
+  void WriteSector() {
+    int ret = f.Write(buffer, NELEM(buffer));
+    if (ret != NELEM(buffer)) {
+      STDERR << "FILE WRITE FAILED: " << ret << "\n";
+    }
+    YieldSD();
+  }
+#endif
+
 public:
 
   BufferedFileWriter(const char* path) {
+    stall_start_ = micros();
     f.OpenRW(path);
     if (!f.IsOpen()) {
       STDOUT << "OpenRW fail: " << path << "\n";
@@ -588,6 +780,7 @@ public:
       memset(buffer, 0, sizeof(buffer));
       for (int i = (MAX_CONFIG_FILE_SIZE - f.FileSize() + 511) / 512; i > 0; i--) {
 	f.Write(buffer, NELEM(buffer));
+	YieldSD();
       }
     }
     f.Seek(512);
@@ -598,10 +791,8 @@ public:
     uint32_t pos_in_buffer = position & (NELEM(buffer)-1);
     if (pos_in_buffer) {
       memset(buffer + pos_in_buffer, 0, NELEM(buffer) - pos_in_buffer);
-      int ret = f.Write(buffer, NELEM(buffer));
-      if (ret != NELEM(buffer)) {
-	STDERR << "FILE WRITE FAILED: " << ret << "\n";
-      }
+      WriteSector();
+      position += NELEM(buffer) - pos_in_buffer;
     }
 #endif
   }
@@ -615,13 +806,18 @@ public:
     uint32_t cksum = checksum.checksum_;
     Flush();
     f.Seek(0);
-    // position = 0;
+#ifdef PROFFIEOS_BUFFER_WRITES
+    position = 0;
+#endif
     Write32(0xFF1E5AFE); Write32(cksum); Write32(iteration); Write32(length);
     Write32(0xFF1E5AFE); Write32(cksum); Write32(iteration); Write32(length);
     Write(install_time);
     Flush();
     f.Close();
+    YieldSD();
   }
+
+  uint32_t max_stall_micros() const { return max_stall_micros_; }
   
   int Write(const uint8_t* dest, int bytes) {
     checksum.Write(dest, bytes);
@@ -629,15 +825,13 @@ public:
     while (bytes) {
       uint32_t pos_in_buffer = position & (NELEM(buffer)-1);
       uint32_t to_copy = std::min<uint32_t>(bytes, NELEM(buffer) - pos_in_buffer);
-      memcpy(buffer + pos_in_buffer, dest, bytes);
+      memcpy(buffer + pos_in_buffer, dest, to_copy);
 
       position += to_copy;
       bytes -= to_copy;
-      dest -= to_copy;
+      dest += to_copy;
 
-      if ((pos_in_buffer + to_copy) == NELEM(buffer)) {
-	f.Write(buffer, NELEM(buffer));
-      }
+      if ((pos_in_buffer + to_copy) == NELEM(buffer)) WriteSector();
     }
 #else
     f.Write(dest, bytes);
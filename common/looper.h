@@ -9,8 +9,10 @@ Looper* hf_loopers = NULL;
 LoopCounter global_loop_counter;
 LoopCounter hf_loop_counter;
 
-#ifdef ENABLE_DEBUG
+// Also used to figure out what was running when audio underflows.
 Looper* volatile current_looper = NULL;
+
+#ifdef ENABLE_DEBUG
 Looper* volatile last_looper = NULL;
 uint32_t last_looper_count = 0;
 #endif
@@ -51,7 +53,7 @@ public:
   ~Looper() { Unlink(); }
 
 #ifdef ENABLE_DEBUG
-#define  CALL_LOOP(X) do { Looper* tmp = (X); current_looper = tmp; tmp->Loop(); current_looper = nullptr; } while(0)
+#define  CALL_LOOP(X) do { Looper* tmp = (X); Looper* prev = current_looper; current_looper = tmp; tmp->Loop(); current_looper = prev; } while(0)
   virtual void LoopDebug() {};
   static void CheckFrozen() {
     Looper* current = current_looper;
@@ -71,7 +73,7 @@ public:
     }
   }
 #else
-#define  CALL_LOOP(X) (X)->Loop()
+#define  CALL_LOOP(X) do { Looper* tmp = (X); Looper* prev = current_looper; current_looper = tmp; tmp->Loop(); current_looper = prev; } while(0)
   static void CheckFrozen() {}
 #endif
 
@@ -79,6 +81,7 @@ public:
     ScopedCycleCounter cc(loop_cycles);
     CHECK_LL(Looper, loopers, next_looper_);
     for (Looper *l = loopers; l; l = l->next_looper_) {
+      SCOPED_PROFILE_FRAME(l->name());
       ScopedCycleCounter cc2(l->cycles_);
       CALL_LOOP(l);
     }
@@ -86,11 +89,14 @@ public:
     hf_loop_counter.Update();
   }
   static void DoHFLoop() {
+    SCOPED_PROFILE_FRAME("hf");
     ScopedCycleCounter cc(loop_cycles);
     CHECK_LL(Looper, loopers, next_looper_);
     for (Looper *l = hf_loopers; l; l = l->next_looper_) {
-      // TODO: We're currently double-counting these cycles, since
-      // DoHfLoop() is likely to be called from inside of DoLoop()
+      // DoHFLoop() is usually called from inside of DoLoop(), but
+      // ScopedCycleCounter subtracts nested counters from the enclosing
+      // one, so these cycles are not counted against the caller.
+      SCOPED_PROFILE_FRAME(l->name());
       ScopedCycleCounter cc2(l->cycles_);
       CALL_LOOP(l);
     }
@@ -111,6 +117,15 @@ public:
     }
     loop_cycles = 0;
   }
+  // Shortest MaxIdleMillis() of all loopers.
+  static uint32_t IdleMillis() {
+    uint32_t ret = 0xffffffffUL;
+    for (Looper *l = loopers; l; l = l->next_looper_) {
+      ret = std::min<uint32_t>(ret, l->MaxIdleMillis());
+      if (!ret) break;
+    }
+    return ret;
+  }
   static uint64_t CountCycles() {
     uint64_t cycles = loop_cycles;
     for (Looper *l = loopers; l; l = l->next_looper_)
@@ -118,10 +133,21 @@ public:
     return cycles;
   }
 
+  static const char* current_name() {
+    Looper* current = current_looper;
+    return current ? current->name() : "none";
+  }
+
 protected:
   virtual const char* name() = 0;
   virtual void Loop() = 0;
   virtual void Setup() {}
+  // When the board is idle, ClockControl sleeps until the first
+  // looper needs to run again. Zero means "don't sleep". The default
+  // matches the old fixed 50ms idle delay, so loopers that poll hardware
+  // (motion, displays) are never starved; loopers that know they have
+  // nothing to do can override this to allow longer sleeps.
+  virtual uint32_t MaxIdleMillis() { return 50; }
 private:
   uint64_t cycles_ = 0;
   Looper* next_looper_;
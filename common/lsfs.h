@@ -63,6 +63,9 @@ struct PathHelper {
 };
 
 
+#include "sd_block_cache.h"
+#include "sd_name_cache.h"
+
 #if defined(PROFFIE_TEST)
 
 #include <sys/stat.h>
@@ -132,24 +135,31 @@ public:
   static bool Begin() { return true; }
   static bool End() { return true; }
   static bool Exists(const char* path) {
+    if (SDNameCacheMissing(path)) return false;
     struct stat s;
     return stat(path, &s) == 0;
   }
   static bool Remove(const char* path) {
+    SDBlockCacheInvalidate(path);
+    SDNameCacheForget(path);
     return unlink(path) == 0;
   }
   static File Open(const char* path) {
+    if (SDNameCacheMissing(path)) return File();
     return fopen(path, "r");
   }
   static File OpenRW(const char* path) {
+    SDNameCacheForget(path);
     File ret = fopen(path, "r+");
     if (ret) return ret;
     return OpenForWrite(path);
   }
   static File OpenFast(const char* path) {
+    if (SDNameCacheMissing(path)) return File();
     return fopen(path, "r");
   }
   static File OpenForWrite(const char* path) {
+    SDNameCacheForget(path);
     return fopen(path, "wct");
   }
   class Iterator {
@@ -206,19 +216,24 @@ public:
     return true;
   }
   static bool Exists(const char* path) {
+    if (SDNameCacheMissing(path)) return false;
     return SD.exists(path);
   }
   static bool Remove(const char* path) {
+    SDBlockCacheInvalidate(path);
+    SDNameCacheForget(path);
     return SD.remove(path);
   }
   static File Open(const char* path) {
-    if (!SD.exists(path)) return File();
+    if (!Exists(path)) return File();
     return SD.open(path);
   }
   static File OpenRW(const char* path) {
+    SDNameCacheForget(path);
     return SD.open(path, FILE_WRITE);
   }
   static File OpenFast(const char* path) {
+    if (SDNameCacheMissing(path)) return File();
     // At some point, I put this check in here to make sure that the file
     // exists before we try to open it, as opening directories and other
     // weird files can cause open() to hang. However, this check takes
@@ -228,6 +243,7 @@ public:
     return SD.open(path);
   }
   static File OpenForWrite(const char* path) {
+    SDNameCacheForget(path);
     File f =  SD.open(path, FILE_WRITE);
     if (!f) {
       PathHelper tmp(path);
@@ -336,22 +352,29 @@ public:
   }
   static void End() {
     if (!mounted_) return;
+    SDBlockCacheClear();
+    SDNameCacheClear();
     DOSFS.end();
     mounted_ = false;
   }
   static bool Exists(const char* path) {
     if (!mounted_) return false;
+    if (SDNameCacheMissing(path)) return false;
     return DOSFS.exists(path);
   }
   static bool Remove(const char* path) {
+    SDBlockCacheInvalidate(path);
+    SDNameCacheForget(path);
     if (!mounted_) return false;
     return DOSFS.remove(path);
   }
   static File Open(const char* path) {
     if (!mounted_) return File();
+    if (SDNameCacheMissing(path)) return File();
     return DOSFS.open(path, "r");
   }
   static File OpenRW(const char* path) {
+    SDNameCacheForget(path);
     if (!mounted_) return File();
     File f = DOSFS.open(path, "r+");
     if (!f) f = OpenForWrite(path);
@@ -359,6 +382,7 @@ public:
   }
   static File OpenFast(const char* path) {
     if (!mounted_) return File();
+    if (SDNameCacheMissing(path)) return File();
     return DOSFS.open(path, "r");
   }
   static void mkdir(PathHelper& p) {
@@ -370,6 +394,7 @@ public:
     DOSFS.mkdir(p);
   }
   static File OpenForWrite(const char* path) {
+    SDNameCacheForget(path);
     if (!mounted_) return File();
     File f = DOSFS.open(path, "w");
     if (!f) {
@@ -457,28 +482,35 @@ public:
     return true;
   }
   static bool End() {
+    SDBlockCacheClear();
+    SDNameCacheClear();
     SDCLASS.end();
     return true;
   }
   static bool Exists(const char* path) {
+    if (SDNameCacheMissing(path)) return false;
     return SDCLASS.exists(path);
   }
   static bool Remove(const char* path) {
+    SDBlockCacheInvalidate(path);
+    SDNameCacheForget(path);
     return SDCLASS.remove(path);
   }
   static File Open(const char* path) {
-    if (!SDCLASS.exists(path)) return File();
+    if (!Exists(path)) return File();
     File f = SDCLASS.open(path);
     f.setBufferSize(512);
     return f;
   }
   static File OpenRW(const char* path) {
+    SDNameCacheForget(path);
     File f = SDCLASS.open(path, FILE_WRITE);
     f.setBufferSize(512);
     return f;
     
   }
   static File OpenFast(const char* path) {
+    if (SDNameCacheMissing(path)) return File();
     // At some point, I put this check in here to make sure that the file
     // exists before we try to open it, as opening directories and other
     // weird files can cause open() to hang. However, this check takes
@@ -490,6 +522,7 @@ public:
     return f;
   }
   static File OpenForWrite(const char* path) {
+    SDNameCacheForget(path);
     File f =  SDCLASS.open(path, FILE_WRITE);
     if (!f) {
       PathHelper tmp(path);
@@ -550,19 +583,24 @@ public:
     return true;
   }
   static bool Exists(const char* path) {
+    if (SDNameCacheMissing(path)) return false;
     return SD.exists(path);
   }
   static bool Remove(const char* path) {
+    SDBlockCacheInvalidate(path);
+    SDNameCacheForget(path);
     return SD.remove(path);
   }
   static File Open(const char* path) {
-    if (!SD.exists(path)) return File();
+    if (!Exists(path)) return File();
     return SD.open(path);
   }
   static File OpenRW(const char* path) {
+    SDNameCacheForget(path);
     return SD.open(path, FILE_WRITE);
   }
   static File OpenFast(const char* path) {
+    if (SDNameCacheMissing(path)) return File();
     // At some point, I put this check in here to make sure that the file
     // exists before we try to open it, as opening directories and other
     // weird files can cause open() to hang. However, this check takes
@@ -572,6 +610,7 @@ public:
     return SD.open(path);
   }
   static File OpenForWrite(const char* path) {
+    SDNameCacheForget(path);
     File f =  SD.open(path, FILE_WRITE);
     if (!f) {
       PathHelper tmp(path);
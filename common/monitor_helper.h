@@ -4,6 +4,43 @@
 #include "looper.h"
 #include "command_parser.h"
 
+#ifdef ENABLE_TRACING
+#if defined(TEENSYDUINO)
+#define TRACE_CYCLES_PER_SECOND F_CPU
+#elif defined(ARDUINO_ARCH_STM32L4)
+#define TRACE_CYCLES_PER_SECOND SystemCoreClock
+#elif defined(ESP32)
+#define TRACE_CYCLES_PER_SECOND (getCpuFrequencyMhz() * 1000000)
+#else
+#define TRACE_CYCLES_PER_SECOND 1000000
+#endif
+
+const char* TraceEventName(uint16_t event) {
+  switch (event) {
+    case TRACE_EVENT_STRING: return "string";
+    case TRACE_EVENT_LOOP: return "loop";
+    case TRACE_EVENT_AUDIO_ISR: return "audio_isr";
+    case TRACE_EVENT_WAV_FILL: return "wav_fill";
+    case TRACE_EVENT_PIXEL_REFILL: return "pixel_refill";
+    case TRACE_EVENT_SD_READ: return "sd_read";
+  }
+  return "unknown";
+}
+
+// Timestamps come from the DWT cycle counter, which is not
+// running by default.
+void EnableTraceTimestamps() {
+#ifdef TEENSYDUINO
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+#ifdef ARDUINO_ARCH_STM32L4
+  CoreDebug->DEMCR |= 1 << 24;  // DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+#endif
+
 // Debug printout helper class
 class MonitorHelper : Looper, CommandParser {
 public:
@@ -12,6 +49,9 @@ public:
   
 protected:
   void Loop() { monitor.Loop(); }
+#ifdef ENABLE_TRACING
+  void Setup() override { EnableTraceTimestamps(); }
+#endif
   bool Parse(const char *cmd, const char* arg) override {
 #ifndef DISABLE_DIAGNOSTIC_COMMANDS
     if (!strcmp(cmd, "monitor") || !strcmp(cmd, "mon")) {
@@ -63,14 +103,92 @@ protected:
         monitor.Toggle(Monitoring::MonitorVariation);
         return true;
       }
+      if (!strcmp(arg, "governor")) {
+        monitor.Toggle(Monitoring::MonitorGovernor);
+        return true;
+      }
+      if (!strcmp(arg, "sd")) {
+        monitor.Toggle(Monitoring::MonitorSD);
+        return true;
+      }
     }
 #endif
 #ifdef ENABLE_TRACING
     if (!strcmp(cmd, "dumptrace")) {
       for (size_t i = 0; i < NELEM(trace); i++) {
-	STDOUT << trace[(trace_pos + i) & (NELEM(trace) - 1)].location
-	       << "(" << trace[(trace_pos + i) & (NELEM(trace) - 1)].arg
-	       << ")\n";
+	volatile TraceEntry& e = trace[(trace_pos + i) & (NELEM(trace) - 1)];
+	if (e.seq != (uint16_t)(trace_pos + i - NELEM(trace))) continue;
+	STDOUT << e.timestamp << " ";
+	if (e.event == TRACE_EVENT_STRING) {
+	  STDOUT << e.location;
+	} else {
+	  STDOUT << TraceEventName(e.event & ~TRACE_EVENT_END)
+		 << ((e.event & TRACE_EVENT_END) ? " end" : "");
+	}
+	STDOUT << "(" << e.arg << ")\n";
+      }
+      return true;
+    }
+    if (!strcmp(cmd, "tracebin")) {
+      // Machine-readable dump for common/trace_decoder.py
+      // One hex line per entry: seq timestamp event arg location
+      // followed by the strings for all locations in the dump.
+      uint32_t end = trace_pos;
+      STDOUT << "TRACE " << TRACE_CYCLES_PER_SECOND << " " << end << "\n";
+      char tmp[48];
+      for (size_t i = 0; i < NELEM(trace); i++) {
+	volatile TraceEntry& e = trace[(end + i) & (NELEM(trace) - 1)];
+	uint16_t seq = e.seq;
+	snprintf(tmp, sizeof(tmp), "E %04x %08lx %04x %08lx %08lx\n",
+		 seq,
+		 (unsigned long)e.timestamp,
+		 e.event,
+		 (unsigned long)e.arg,
+		 (unsigned long)(size_t)e.location);
+	// Skip entries that were overwritten while we were printing.
+	if (seq != (uint16_t)(end + i - NELEM(trace)) || e.seq != seq) continue;
+	STDOUT.print(tmp);
+      }
+      // Locations are string literals, so they stay valid even if
+      // the entry has been overwritten since.
+      for (size_t i = 0; i < NELEM(trace); i++) {
+	const char* location = trace[i].location;
+	if (!location) continue;
+	bool seen = false;
+	for (size_t j = 0; j < i; j++) seen |= trace[j].location == location;
+	if (seen) continue;
+	snprintf(tmp, sizeof(tmp), "S %08lx ", (unsigned long)(size_t)location);
+	STDOUT << tmp << location << "\n";
+      }
+      STDOUT << "END\n";
+      return true;
+    }
+    if (!strcmp(cmd, "trace")) {
+      static const struct {
+	const char* name;
+	uint32_t category;
+      } categories[] = {
+	{ "blade", TRACE_CATEGORY_BLADE },
+	{ "motion", TRACE_CATEGORY_MOTION },
+	{ "ir", TRACE_CATEGORY_IR },
+	{ "prop", TRACE_CATEGORY_PROP },
+	{ "i2c", TRACE_CATEGORY_I2C },
+	{ "rgb565", TRACE_CATEGORY_RGB565 },
+	{ "audio", TRACE_CATEGORY_AUDIO },
+	{ "sd", TRACE_CATEGORY_SD },
+	{ "loop", TRACE_CATEGORY_LOOP },
+      };
+      for (size_t i = 0; i < NELEM(categories); i++) {
+	if (arg && !strcmp(arg, categories[i].name)) {
+	  trace_enabled_categories ^= categories[i].category;
+	}
+      }
+      EnableTraceTimestamps();
+      for (size_t i = 0; i < NELEM(categories); i++) {
+	if (!(categories[i].category & (TRACING_CATEGORIES))) continue;
+	STDOUT << categories[i].name << " "
+	       << ((trace_enabled_categories & categories[i].category) ? "on" : "off")
+	       << "\n";
       }
       return true;
     }
@@ -17,6 +17,8 @@ public:
     MonitorSerial = 512,
     MonitorFusion = 1024,
     MonitorVariation = 2048,
+    MonitorGovernor = 4096,
+    MonitorSD = 8192,
   };
 
   bool ShouldPrint(MonitorBit bit) {
@@ -78,10 +80,27 @@ extern Monitoring monitor;
 #define TRACE_CATEGORY_PROP 0x8
 #define TRACE_CATEGORY_I2C 0x10
 #define TRACE_CATEGORY_RGB565 0x20
+#define TRACE_CATEGORY_AUDIO 0x40
+#define TRACE_CATEGORY_SD 0x80
+#define TRACE_CATEGORY_LOOP 0x100
 
 #define TRACE_EXPAND_AGAIN(CAT) (CAT)
 #define TRACE_CATEGORY(CAT) TRACE_EXPAND_AGAIN(TRACE_CATEGORY_##CAT)
 
+// Binary trace events, these are used for high-rate events where
+// we want timestamps and small overhead. Events with the
+// TRACE_EVENT_END bit set mark the end of a scope.
+// Keep in sync with common/trace_decoder.py
+enum TraceEventId : uint16_t {
+  TRACE_EVENT_STRING = 0,  // location is set
+  TRACE_EVENT_LOOP = 1,
+  TRACE_EVENT_AUDIO_ISR = 2,
+  TRACE_EVENT_WAV_FILL = 3,
+  TRACE_EVENT_PIXEL_REFILL = 4,
+  TRACE_EVENT_SD_READ = 5,
+  TRACE_EVENT_END = 0x8000,
+};
+
 #ifdef ENABLE_TRACING
 #if (ENABLE_TRACING - 0) == 0
 #define TRACING_CATEGORIES -1
@@ -90,8 +109,13 @@ extern Monitoring monitor;
 #endif
 
 struct TraceEntry {
+  uint32_t timestamp;
   const char* location;
-  int arg;
+  int32_t arg;
+  // Low 16 bits of the position this entry was written at, written last
+  // so that a reader can tell finished entries from stale or torn ones.
+  uint16_t seq;
+  uint16_t event;
 };
 
 // Must be power of 2
@@ -101,26 +125,75 @@ struct TraceEntry {
 
 // TODO: Move this somewhere more global
 volatile TraceEntry trace[PO_TRACE_LENGTH];
-volatile int trace_pos;
+volatile uint32_t trace_pos;
+// Categories can be turned on and off with the "trace" command,
+// but only categories in TRACING_CATEGORIES are compiled in.
+volatile uint32_t trace_enabled_categories = TRACING_CATEGORIES;
+
+inline uint32_t TraceTimestamp() {
+#if defined(TEENSYDUINO)
+  return ARM_DWT_CYCCNT;
+#elif defined(ARDUINO_ARCH_STM32L4)
+  return DWT->CYCCNT;
+#elif defined(ESP32)
+  return cpu_hal_get_cycle_count();
+#else
+  return micros();
+#endif
+}
+
+// Lock-free, safe to call from interrupts.
+void DoTraceEvent(uint16_t event, const char* location, int32_t arg) {
+  uint32_t pos = __atomic_fetch_add(&trace_pos, 1, __ATOMIC_RELAXED);
+  volatile TraceEntry& e = trace[pos & (PO_TRACE_LENGTH - 1)];
+  e.seq = ~pos;
+  e.timestamp = TraceTimestamp();
+  e.location = location;
+  e.arg = arg;
+  e.event = event;
+  __atomic_signal_fence(__ATOMIC_RELEASE);
+  e.seq = pos;
+}
 
 void DoTrace(const char* str, int arg = 0) {
-  noInterrupts();
-  trace[trace_pos & (PO_TRACE_LENGTH - 1)].arg = arg;
-  trace[trace_pos & (PO_TRACE_LENGTH - 1)].location = str;
-  trace_pos++;
-  trace[trace_pos & (PO_TRACE_LENGTH - 1)].location = "-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-";
-  trace[trace_pos & (PO_TRACE_LENGTH - 1)].arg = 0;
-  interrupts();
+  DoTraceEvent(TRACE_EVENT_STRING, str, arg);
 }
 
+class ScopedTraceEvent {
+public:
+  ScopedTraceEvent(uint32_t category, uint16_t event, int32_t arg)
+    : enabled_(trace_enabled_categories & category), event_(event) {
+    if (enabled_) DoTraceEvent(event_, nullptr, arg);
+  }
+  ~ScopedTraceEvent() {
+    if (enabled_) DoTraceEvent(event_ | TRACE_EVENT_END, nullptr, 0);
+  }
+private:
+  bool enabled_;
+  uint16_t event_;
+};
+
+#define TRACE_ENABLED(CAT) \
+  ((TRACE_CATEGORY(CAT) & (TRACING_CATEGORIES)) && \
+   (TRACE_CATEGORY(CAT) & trace_enabled_categories))
+
 #define TRACE(CAT, X) do {				\
-  if (TRACE_CATEGORY(CAT) & (TRACING_CATEGORIES))       \
+  if (TRACE_ENABLED(CAT))				\
     DoTrace(__FILE__ ":" TOSTRING(__LINE__) ": " X);	\
 } while(0)
 #define TRACE2(CAT, X, ARG) do {			\
-  if (TRACE_CATEGORY(CAT) & (TRACING_CATEGORIES))       \
+  if (TRACE_ENABLED(CAT))				\
     DoTrace(__FILE__ ":" TOSTRING(__LINE__) ": " X, ARG);	\
 } while(0)
+#define TRACE_EVENT(CAT, EVENT, ARG) do {		\
+  if (TRACE_ENABLED(CAT))				\
+    DoTraceEvent(TRACE_EVENT_##EVENT, nullptr, ARG);	\
+} while(0)
+#define TRACE_SCOPE_CONCAT2(A, B) A##B
+#define TRACE_SCOPE_CONCAT(A, B) TRACE_SCOPE_CONCAT2(A, B)
+#define TRACE_SCOPE(CAT, EVENT, ARG)					\
+  ScopedTraceEvent TRACE_SCOPE_CONCAT(trace_scope_, __LINE__)(		\
+    TRACE_CATEGORY(CAT) & (TRACING_CATEGORIES), TRACE_EVENT_##EVENT, ARG)
 #else
 #define TRACING_CATEGORIES 0
 #define TRACE(CAT, X) do {				\
@@ -131,6 +204,8 @@ void DoTrace(const char* str, int arg = 0) {
   if (TRACE_CATEGORY(CAT) & (TRACING_CATEGORIES))       \
     do { } while(0);					\
 } while(0)
+#define TRACE_EVENT(CAT, EVENT, ARG) do { } while(0)
+#define TRACE_SCOPE(CAT, EVENT, ARG) do { } while(0)
 #endif // ENABLE_TRACING
 
 
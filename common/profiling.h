@@ -5,6 +5,190 @@
 
 #ifdef ENABLE_PROFILING
 
+// Hierarchical profiler.
+//
+// Every profiled scope is a node in a call tree, keyed by (parent, name).
+// Interrupts and the main loop have separate roots, so time spent in
+// an interrupt handler does not show up as part of whatever loop code
+// it interrupted. On ESP32, the audio fill task runs on the other core
+// at the same time as the main loop, so core 0 has its own "task" and
+// "task_irq" roots. Each node accumulates "self" cycles, which is the time
+// spent in the scope minus the time spent in child scopes, and for loop
+// scopes, minus the time spent in profiled interrupt scopes.
+//
+// The "flame" command prints the tree in the folded stack format
+// used by flamegraph.pl, speedscope and similar tools, one line per
+// node: "loop;Looper;function cycles".
+
+// Must be less than 255.
+#ifndef PROFILE_MAX_NODES
+#define PROFILE_MAX_NODES 64
+#endif
+
+// The interrupt context for each core is the loop context + 1.
+enum ProfileContext {
+  PROFILE_CONTEXT_LOOP = 0,
+  PROFILE_CONTEXT_IRQ = 1,
+#ifdef ESP32
+  // Core 0, where the audio fill task runs. (See audio_stream_work.h)
+  PROFILE_CONTEXT_TASK = 2,
+  PROFILE_CONTEXT_TASK_IRQ = 3,
+  PROFILE_CONTEXTS = 4,
+#else
+  PROFILE_CONTEXTS = 2,
+#endif
+};
+
+inline ProfileContext GetProfileContext() {
+#if defined(__arm__)
+  uint32_t ipsr;
+  __asm__ volatile("mrs %0, ipsr" : "=r" (ipsr));
+  return (ipsr & 0x1ff) ? PROFILE_CONTEXT_IRQ : PROFILE_CONTEXT_LOOP;
+#elif defined(ESP32)
+  int base = xPortGetCoreID() == 0 ? PROFILE_CONTEXT_TASK : PROFILE_CONTEXT_LOOP;
+  return (ProfileContext)(base + (xPortInIsrContext() ? 1 : 0));
+#else
+  return PROFILE_CONTEXT_LOOP;
+#endif
+}
+
+#ifdef ESP32
+// noInterrupts() only covers the current core.
+portMUX_TYPE profile_mux_ = portMUX_INITIALIZER_UNLOCKED;
+#define PROFILE_LOCK() portENTER_CRITICAL(&profile_mux_)
+#define PROFILE_UNLOCK() portEXIT_CRITICAL(&profile_mux_)
+#else
+#define PROFILE_LOCK() noInterrupts()
+#define PROFILE_UNLOCK() interrupts()
+#endif
+
+struct ProfileNode {
+  const char* name;
+  uint8_t parent;
+  uint32_t calls;
+  uint64_t cycles;
+};
+
+// The first nodes are the roots for each ProfileContext.
+ProfileNode profile_nodes_[PROFILE_MAX_NODES] = {
+  { "loop", 0xff, 0, 0 },
+  { "irq", 0xff, 0, 0 },
+#ifdef ESP32
+  { "task", 0xff, 0, 0 },
+  { "task_irq", 0xff, 0, 0 },
+#endif
+};
+volatile uint8_t profile_num_nodes_ = PROFILE_CONTEXTS;
+// Total (not self) cycles spent in top-level interrupt scopes, for each
+// core, used to remove interrupt time from loop scopes.
+volatile uint32_t profile_irq_cycles_[PROFILE_CONTEXTS / 2];
+uint32_t profile_dropped_ = 0;
+
+uint8_t FindProfileNode(uint8_t parent, const char* name) {
+  uint8_t n = profile_num_nodes_;
+  for (uint8_t i = PROFILE_CONTEXTS; i < n; i++) {
+    if (profile_nodes_[i].parent == parent &&
+        profile_nodes_[i].name == name) {
+      return i;
+    }
+  }
+  PROFILE_LOCK();
+  // An interrupt may have added nodes while we were looking.
+  for (uint8_t i = n; i < profile_num_nodes_; i++) {
+    if (profile_nodes_[i].parent == parent &&
+        profile_nodes_[i].name == name) {
+      PROFILE_UNLOCK();
+      return i;
+    }
+  }
+  if (profile_num_nodes_ >= PROFILE_MAX_NODES) {
+    profile_dropped_++;
+    PROFILE_UNLOCK();
+    return parent;
+  }
+  uint8_t ret = profile_num_nodes_;
+  profile_nodes_[ret].name = name;
+  profile_nodes_[ret].parent = parent;
+  profile_nodes_[ret].calls = 0;
+  profile_nodes_[ret].cycles = 0;
+  profile_num_nodes_ = ret + 1;
+  PROFILE_UNLOCK();
+  return ret;
+}
+
+class ScopedProfileFrame;
+ScopedProfileFrame* profile_top_[PROFILE_CONTEXTS];
+
+class ScopedProfileFrame {
+public:
+  explicit ScopedProfileFrame(const char* name) {
+    context_ = GetProfileContext();
+    parent_ = profile_top_[context_];
+    node_ = FindProfileNode(parent_ ? parent_->node_ : context_, name);
+    profile_top_[context_] = this;
+    irq_start_ = profile_irq_cycles_[context_ / 2];
+    start_ = ScopedCycleCounter::getRawCycles();
+  }
+
+  ~ScopedProfileFrame() {
+    uint32_t elapsed = ScopedCycleCounter::getRawCycles() - start_;
+    bool irq = context_ & 1;
+    if (!irq) {
+      elapsed -= profile_irq_cycles_[context_ / 2] - irq_start_;
+    }
+    profile_nodes_[node_].cycles += elapsed - child_cycles_;
+    profile_nodes_[node_].calls++;
+    profile_top_[context_] = parent_;
+    if (parent_) {
+      parent_->child_cycles_ += elapsed;
+    } else if (irq) {
+      profile_irq_cycles_[context_ / 2] += elapsed;
+    }
+  }
+
+private:
+  ScopedProfileFrame* parent_;
+  uint32_t start_;
+  uint32_t irq_start_;
+  uint32_t child_cycles_ = 0;
+  uint8_t node_;
+  ProfileContext context_;
+};
+
+void PrintProfileName(const char* name) {
+  for (int i = 0; i < 256; i++) {
+    if (!name[i]) break;
+    // ';' is the frame separator in the folded format.
+    STDOUT.print(name[i] == ';' ? ':' : name[i]);
+  }
+}
+
+void PrintProfilePath(uint8_t node) {
+  if (profile_nodes_[node].parent != 0xff) {
+    PrintProfilePath(profile_nodes_[node].parent);
+    STDOUT.print(';');
+  }
+  PrintProfileName(profile_nodes_[node].name);
+}
+
+// Prints folded stacks and resets the counters.
+void DumpProfileFlame() {
+  for (uint8_t i = 0; i < profile_num_nodes_; i++) {
+    PROFILE_LOCK();
+    uint64_t cycles = profile_nodes_[i].cycles;
+    profile_nodes_[i].cycles = 0;
+    profile_nodes_[i].calls = 0;
+    PROFILE_UNLOCK();
+    if (!cycles) continue;
+    PrintProfilePath(i);
+    STDOUT << " " << (uint32_t)cycles << "\n";
+  }
+  if (profile_dropped_) {
+    STDOUT << "# " << profile_dropped_ << " scopes dropped, increase PROFILE_MAX_NODES\n";
+    profile_dropped_ = 0;
+  }
+}
+
 class ProfileLocation;
 ProfileLocation* profile_locations_ = nullptr;
 struct ProfileLocation {
@@ -14,10 +198,7 @@ ProfileLocation(const char* location, const char *func) : location_(location), f
   }
   void Dump(uint64_t total) {
     STDOUT << (cycles_ * 100.0 / total) << " @ "<< location_ << ":";
-    for (int i = 0; i < 256; i++) {
-      if (!func_[i]) break;
-      STDOUT.print(func_[i]);
-    }
+    PrintProfileName(func_);
     STDOUT.println("");
     cycles_ = 0;
   }
@@ -37,11 +218,20 @@ uint64_t CountProfileCycles() {
 }
 #define SCOPED_PROFILER() \
   static ProfileLocation trace_location_(__FILE__ ":" TOSTRING(__LINE__), __PRETTY_FUNCTION__); \
+  ScopedProfileFrame profile_frame_(trace_location_.func_);		\
   ScopedCycleCounter cycle_counter_(trace_location_.cycles_)
 
+#define PROFILE_CONCAT2(A, B) A##B
+#define PROFILE_CONCAT(A, B) PROFILE_CONCAT2(A, B)
+// Adds a named node to the call tree without flat accounting,
+// used for loopers and interrupt handlers.
+#define SCOPED_PROFILE_FRAME(NAME) \
+  ScopedProfileFrame PROFILE_CONCAT(profile_frame_, __LINE__)(NAME)
+
 #else
 
 #define SCOPED_PROFILER() do { } while(0)
+#define SCOPED_PROFILE_FRAME(NAME) do { } while(0)
 #define DumpProfileLocations(X) do { } while(0)
 #define CountProfileCycles() 0
 
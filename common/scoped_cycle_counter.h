@@ -3,13 +3,25 @@
 
 class ScopedCycleCounter {
 public:
+  // Cycle counter, including cycles counted by other ScopedCycleCounters.
+  static inline uint32_t getRawCycles() {
+#if defined(TEENSYDUINO)
+    return ARM_DWT_CYCCNT;
+#elif defined(ARDUINO_ARCH_STM32L4)
+    return DWT->CYCCNT;
+#elif defined(ESP32)
+    return cpu_hal_get_cycle_count();
+#else
+    return 0;
+#endif
+  }
   static inline uint32_t getCycles() {
 #if defined(TEENSYDUINO)
     return ARM_DWT_CYCCNT - counted_cycles_;
 #elif defined(ARDUINO_ARCH_STM32L4)
     return DWT->CYCCNT - counted_cycles_;
 #elif defined(ESP32)
-    return cpu_hal_get_cycle_count();
+    return cpu_hal_get_cycle_count() - counted_cycles_;
 #else    
     return 0;
 #endif    
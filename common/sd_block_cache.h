@@ -0,0 +1,181 @@
+#ifndef COMMON_SD_BLOCK_CACHE_H
+#define COMMON_SD_BLOCK_CACHE_H
+
+// Shared cache for SD card blocks.
+//
+// FileReader keeps the most recently read 512-byte blocks of small files
+// that are opened for reading here, so short sounds, animations and blade
+// data that are played over and over are not read from the SD card
+// every time. Blocks are identified by a hash of the file name, the file
+// size and the block number. Files that are opened for writing or
+// removed are dropped from the cache, and the whole cache is dropped
+// when the SD card is unmounted, since it may be modified over USB.
+//
+// Blocks are replaced in least recently used order. Files larger than
+// SD_BLOCK_CACHE_MAX_FILE_SIZE bypass the cache: streaming through them
+// would only evict the small files, and would never hit since the cache
+// can't hold them.
+//
+// Looping files (hums, idle animations) are usually too large for that,
+// so instead the first SD_BLOCK_CACHE_LOOP_BLOCKS blocks at the loop
+// point of each looping file are pinned, whatever the file size. That
+// way the SD card doesn't have to seek back and read them every time
+// the loop starts over. Pinned blocks have their own budget of
+// SD_BLOCK_CACHE_PINNED_BLOCKS blocks on top of SD_BLOCK_CACHE_BLOCKS,
+// and are unpinned when the file stops looping or is closed.
+//
+// The cache is only used from the same places that read the SD card,
+// which are already serialized by LOCK_SD(), so it needs no locking
+// of its own.
+
+#if defined(ENABLE_SD_BLOCK_CACHE) && !defined(ENABLE_SD)
+#undef ENABLE_SD_BLOCK_CACHE
+#endif
+
+#ifdef ENABLE_SD_BLOCK_CACHE
+
+// Each block uses a little more than 512 bytes of RAM.
+#ifndef SD_BLOCK_CACHE_BLOCKS
+#define SD_BLOCK_CACHE_BLOCKS 16
+#endif
+
+#ifndef SD_BLOCK_CACHE_MAX_FILE_SIZE
+#define SD_BLOCK_CACHE_MAX_FILE_SIZE (SD_BLOCK_CACHE_BLOCKS * 512 / 2)
+#endif
+
+// Room for the loop points of a hum, two smoothswing loops and an
+// idle animation.
+#ifndef SD_BLOCK_CACHE_PINNED_BLOCKS
+#define SD_BLOCK_CACHE_PINNED_BLOCKS 8
+#endif
+
+#ifndef SD_BLOCK_CACHE_LOOP_BLOCKS
+#define SD_BLOCK_CACHE_LOOP_BLOCKS 2
+#endif
+
+class SDBlockCache {
+public:
+  static const int BLOCK_SIZE = 512;
+  static const int MAX_PINNED_BLOCKS = SD_BLOCK_CACHE_PINNED_BLOCKS;
+
+  struct Block {
+    uint32_t file;  // 0 = unused
+    uint32_t file_size;
+    uint32_t block;
+    uint32_t last_used;
+    uint16_t size;  // less than BLOCK_SIZE at the end of the file
+    bool pinned;
+    uint8_t data[BLOCK_SIZE];
+  };
+
+  static uint32_t FileId(const char* path) {
+    uint32_t h = 2166136261u;
+    for (; *path; path++) h = (h ^ (uint8_t)*path) * 16777619u;
+    return h ? h : 1;
+  }
+
+  Block* Find(uint32_t file, uint32_t file_size, uint32_t block) {
+    for (Block& b : blocks_) {
+      if (b.file == file && b.block == block && b.file_size == file_size) {
+        b.last_used = ++clock_;
+        hits_++;
+        return &b;
+      }
+    }
+    misses_++;
+    return nullptr;
+  }
+
+  // Returns an unused or least recently used block, the caller fills in
+  // data and size, or calls Drop() if the read fails. Pinned blocks are
+  // never replaced, and since at most MAX_PINNED_BLOCKS are pinned,
+  // there are always SD_BLOCK_CACHE_BLOCKS others to pick from.
+  Block* Allocate(uint32_t file, uint32_t file_size, uint32_t block, bool pinned) {
+    Block* ret = nullptr;
+    for (Block& b : blocks_) {
+      if (b.pinned) continue;
+      if (!b.file) {
+        ret = &b;
+        break;
+      }
+      if (!ret || (int32_t)(b.last_used - ret->last_used) < 0) ret = &b;
+    }
+    ret->file = file;
+    ret->file_size = file_size;
+    ret->block = block;
+    ret->last_used = ++clock_;
+    ret->size = 0;
+    if (pinned && pinned_blocks_ < MAX_PINNED_BLOCKS) {
+      ret->pinned = true;
+      pinned_blocks_++;
+    }
+    return ret;
+  }
+
+  void Drop(Block* b) {
+    Unpin(b);
+    b->file = 0;
+  }
+
+  // Pins the blocks of |file| in [first, first + count) that are
+  // already cached, as far as the budget allows.
+  void Pin(uint32_t file, uint32_t first, uint32_t count) {
+    for (Block& b : blocks_) {
+      if (b.file != file || b.pinned || b.block - first >= count) continue;
+      if (pinned_blocks_ >= MAX_PINNED_BLOCKS) return;
+      b.pinned = true;
+      pinned_blocks_++;
+    }
+  }
+
+  // Unpinned blocks stay in the cache until they are replaced.
+  void Unpin(uint32_t file) {
+    for (Block& b : blocks_) if (b.file == file) Unpin(&b);
+  }
+
+  void Invalidate(uint32_t file) {
+    for (Block& b : blocks_) if (b.file == file) Drop(&b);
+  }
+
+  void Clear() {
+    for (Block& b : blocks_) Drop(&b);
+  }
+
+  void ResetStats() { hits_ = misses_ = 0; }
+  uint32_t hits() const { return hits_; }
+  uint32_t misses() const { return misses_; }
+  int pinned_blocks() const { return pinned_blocks_; }
+  int used_blocks() const {
+    int ret = 0;
+    for (const Block& b : blocks_) if (b.file) ret++;
+    return ret;
+  }
+
+private:
+  void Unpin(Block* b) {
+    if (b->pinned) pinned_blocks_--;
+    b->pinned = false;
+  }
+
+  Block blocks_[SD_BLOCK_CACHE_BLOCKS + SD_BLOCK_CACHE_PINNED_BLOCKS] = {};
+  uint32_t clock_ = 0;
+  uint32_t hits_ = 0;
+  uint32_t misses_ = 0;
+  int pinned_blocks_ = 0;
+};
+
+SDBlockCache sd_block_cache;
+
+inline void SDBlockCacheInvalidate(const char* path) {
+  sd_block_cache.Invalidate(SDBlockCache::FileId(path));
+}
+inline void SDBlockCacheClear() { sd_block_cache.Clear(); }
+
+#else  // ENABLE_SD_BLOCK_CACHE
+
+inline void SDBlockCacheInvalidate(const char* path) {}
+inline void SDBlockCacheClear() {}
+
+#endif  // ENABLE_SD_BLOCK_CACHE
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef COMMON_SD_NAME_CACHE_H
+#define COMMON_SD_NAME_CACHE_H
+
+// Cache of file names on the SD card.
+//
+// Looking up a file on the SD card means reading and searching every
+// directory in the path, which is slow, and it has to be done for every
+// Exists() and Open() call. When a font is scanned, every file and
+// directory that is seen is added here, and directories that were listed
+// completely are remembered by name. After that, LSFS::Exists() and
+// LSFS::Open() can fail right away for files that are missing from a
+// scanned directory, without touching the SD card.
+//
+// Only hashes of the file paths are stored, with case folded since FAT
+// is case insensitive, so the cache can only say that a file is missing,
+// never that it exists. A hash collision can make a missing file look
+// like it might exist, in which case the SD card is asked as usual. The
+// complete directories are stored by name, so a file is never reported
+// as missing from a directory that was not scanned.
+//
+// Anything that creates or removes files forgets what it knew about
+// the parent directories, and the whole cache is dropped when the SD card
+// is unmounted.
+
+#if defined(ENABLE_SD_NAME_CACHE) && !defined(ENABLE_SD)
+#undef ENABLE_SD_NAME_CACHE
+#endif
+
+#ifdef ENABLE_SD_NAME_CACHE
+
+// Must be a power of two, each entry uses 4 bytes of RAM.
+#ifndef SD_NAME_CACHE_ENTRIES
+#define SD_NAME_CACHE_ENTRIES 512
+#endif
+
+// Space for the names of completely scanned directories.
+// Directories that don't fit are just not known to be complete.
+#ifndef SD_NAME_CACHE_DIRECTORY_BYTES
+#define SD_NAME_CACHE_DIRECTORY_BYTES 512
+#endif
+
+class SDNameCache {
+public:
+  enum Result { UNKNOWN, MISSING };
+
+  // Leading, trailing and double slashes are ignored.
+  static uint32_t PathId(const char* path, const char* end = nullptr) {
+    uint32_t h = 2166136261u;
+    bool slash = true;
+    for (; *path && path != end; path++) {
+      char c = *path;
+      if (c == '/') {
+        slash = true;
+        continue;
+      }
+      if (slash) {
+        if (h != 2166136261u) h = (h ^ '/') * 16777619u;
+        slash = false;
+      }
+      if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+      h = (h ^ (uint8_t)c) * 16777619u;
+    }
+    return h == EMPTY || h == REMOVED ? 2 : h;
+  }
+
+  // Same normalization as PathId(), but keeps the characters.
+  // Returns false if |path| does not fit in |size| bytes.
+  static bool NormalizePath(const char* path, const char* end, char* out, size_t size) {
+    size_t n = 0;
+    bool slash = false;
+    for (; *path && path != end; path++) {
+      char c = *path;
+      if (c == '/') {
+        slash = n > 0;
+        continue;
+      }
+      if (n + 2 >= size) return false;
+      if (slash) {
+        out[n++] = '/';
+        slash = false;
+      }
+      if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+      out[n++] = c;
+    }
+    out[n] = 0;
+    return true;
+  }
+
+  void Add(const char* path) {
+    Insert(PathId(path));
+  }
+
+  // All entries in |path| have been added.
+  void AddDirectory(const char* path) {
+    Insert(PathId(path));
+    if (full_) return;
+    char name[PATH_BUFFER_SIZE];
+    if (!NormalizePath(path, nullptr, name, sizeof(name))) return;
+    if (FindDirectory(name)) return;
+    size_t len = strlen(name) + 1;
+    if (directory_bytes_ + len > sizeof(directories_)) return;
+    memcpy(directories_ + directory_bytes_, name, len);
+    directory_bytes_ += len;
+  }
+
+  Result Lookup(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char dir[PATH_BUFFER_SIZE];
+    if (!NormalizePath(path, slash ? slash : path, dir, sizeof(dir))) return UNKNOWN;
+    if (!FindDirectory(dir)) return UNKNOWN;
+    if (Find(PathId(path))) return UNKNOWN;
+    return MISSING;
+  }
+
+  // Called when |path| is created or removed. The parent directories
+  // can no longer be trusted to be complete.
+  void Forget(const char* path) {
+    uint32_t* e = Find(PathId(path));
+    if (e) *e = REMOVED;
+    char name[PATH_BUFFER_SIZE];
+    if (!NormalizePath(path, nullptr, name, sizeof(name))) {
+      directory_bytes_ = 0;
+      return;
+    }
+    size_t pos = 0;
+    while (pos < directory_bytes_) {
+      const char* dir = directories_ + pos;
+      size_t len = strlen(dir);
+      if (!len || (!strncmp(name, dir, len) && (name[len] == '/' || !name[len]))) {
+        memmove(directories_ + pos, directories_ + pos + len + 1,
+                directory_bytes_ - pos - len - 1);
+        directory_bytes_ -= len + 1;
+      } else {
+        pos += len + 1;
+      }
+    }
+  }
+
+  void Clear() {
+    for (uint32_t& e : entries_) e = EMPTY;
+    used_ = 0;
+    full_ = false;
+    directory_bytes_ = 0;
+  }
+
+  int used_entries() const { return used_; }
+
+private:
+  static const uint32_t EMPTY = 0;
+  static const uint32_t REMOVED = 1;
+  static const int MASK = SD_NAME_CACHE_ENTRIES - 1;
+  static const size_t PATH_BUFFER_SIZE = sizeof(PathHelper::path_);
+
+  uint32_t* Find(uint32_t id) {
+    for (int i = 0; i < SD_NAME_CACHE_ENTRIES; i++) {
+      uint32_t& e = entries_[(id + i) & MASK];
+      if (e == EMPTY) return nullptr;
+      if (e == id) return &e;
+    }
+    return nullptr;
+  }
+
+  bool FindDirectory(const char* name) {
+    for (size_t pos = 0; pos < directory_bytes_; pos += strlen(directories_ + pos) + 1) {
+      if (!strcmp(directories_ + pos, name)) return true;
+    }
+    return false;
+  }
+
+  void Insert(uint32_t id) {
+    if (Find(id)) return;
+    // Keep a quarter of the table empty so lookups stay short.
+    if (used_ >= SD_NAME_CACHE_ENTRIES * 3 / 4) {
+      // Files that don't fit are not in the cache, so no directory
+      // can be known to be complete anymore.
+      full_ = true;
+      directory_bytes_ = 0;
+      return;
+    }
+    uint32_t* e;
+    for (int i = 0; ; i++) {
+      e = entries_ + ((id + i) & MASK);
+      if (*e == EMPTY || *e == REMOVED) break;
+    }
+    if (*e == EMPTY) used_++;
+    *e = id;
+  }
+
+  uint32_t entries_[SD_NAME_CACHE_ENTRIES] = {};
+  int used_ = 0;
+  bool full_ = false;
+  // Names of complete directories, each followed by a zero.
+  char directories_[SD_NAME_CACHE_DIRECTORY_BYTES];
+  size_t directory_bytes_ = 0;
+};
+
+SDNameCache sd_name_cache;
+
+// Returns true if |path| is known to be missing.
+inline bool SDNameCacheMissing(const char* path) {
+  return sd_name_cache.Lookup(path) == SDNameCache::MISSING;
+}
+inline void SDNameCacheAdd(const char* path) { sd_name_cache.Add(path); }
+inline void SDNameCacheAddDirectory(const char* path) { sd_name_cache.AddDirectory(path); }
+inline void SDNameCacheForget(const char* path) { sd_name_cache.Forget(path); }
+inline void SDNameCacheClear() { sd_name_cache.Clear(); }
+
+#else  // ENABLE_SD_NAME_CACHE
+
+inline bool SDNameCacheMissing(const char* path) { return false; }
+inline void SDNameCacheAdd(const char* path) {}
+inline void SDNameCacheAddDirectory(const char* path) {}
+inline void SDNameCacheForget(const char* path) {}
+inline void SDNameCacheClear() {}
+
+#endif  // ENABLE_SD_NAME_CACHE
+
+#endif
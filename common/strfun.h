@@ -67,6 +67,15 @@ int CountWords(const char* str) {
   return words;
 }
 
+// Hash of the first word in |str|, used to avoid string compares
+// when looking up names.
+uint32_t HashWord(const char* str) {
+  str = SkipSpace(str);
+  uint32_t h = 2166136261u;
+  while (*str && *str != ' ' && *str != '\t') h = (h ^ (uint8_t)*str++) * 16777619u;
+  return h;
+}
+
 float parsefloat(const char* s) {
   float ret = 0.0;
   float sign = 1.0;
@@ -12,12 +12,19 @@
 #include <memory.h>
 
 #include <iostream>
+#include <chrono>
+#include <string>
 
 
 // cruft
 #define NUM_BLADES 3
 #define PROFFIE_TEST
 #define ENABLE_SD
+#define ENABLE_SD_BLOCK_CACHE
+#define SD_BLOCK_CACHE_BLOCKS 8
+#define ENABLE_SD_NAME_CACHE
+#define SD_NAME_CACHE_ENTRIES 16
+#define SD_NAME_CACHE_DIRECTORY_BYTES 32
 #define GYRO_MEASUREMENTS_PER_SECOND 1600
 #define ACCEL_MEASUREMENTS_PER_SECOND 1600
 #define HEX 16
@@ -648,6 +655,26 @@ void config_file_tests() {
   f.WriteToRootDir("testconfig");
 }
 
+void buffered_file_writer_tests() {
+  // Long enough to span several sectors, and not a multiple of 512.
+  std::string data;
+  for (int i = 0; i < 300; i++) data += "key" + std::to_string(i) + "=value\n";
+  for (int i = 0; i < 2; i++) {
+    BufferedFileWriter out("testwriter.ini");
+    out.Write(data.c_str());
+    out.Close(17 + i);
+  }
+  FileValidator v(nullptr, "testwriter", ConfigFileExt::CONFIG_INI);
+  CHECK(v.validHeader());
+  CHECK_EQ(v.iteration(), 18);
+  CHECK_EQ(v.header.length, data.size());
+  CHECK(v.validateChecksum());
+  for (size_t i = 0; i < data.size(); i++) CHECK_EQ(v.f.Read(), data[i]);
+  CHECK_EQ(v.f.FileSize(), MAX_CONFIG_FILE_SIZE);
+  v.f.Close();
+  LSFS::Remove("testwriter.ini");
+}
+
 #include "command_parser.h"
 CommandParser* parsers = NULL;
 
@@ -727,6 +754,197 @@ void command_parser_test() {
   CHECK_EQ(x, false);
 }
 
+class CountingParser : public CommandParser {
+public:
+  CountingParser(const char* name) : name_(name) {}
+  bool Parse(const char* cmd, const char* arg) override {
+    calls++;
+    return enabled && !strcmp(cmd, name_);
+  }
+  const char* name_;
+  bool enabled = true;
+  int calls = 0;
+};
+
+void command_parser_cache_test() {
+  CountingParser beta("beta");
+  CountingParser alpha("alpha");
+  // alpha is asked first, since it was linked last.
+  CHECK_EQ(CommandParser::DoParse("beta", nullptr), true);
+  CHECK_EQ(alpha.calls, 1);
+  CHECK_EQ(beta.calls, 1);
+
+  // Now beta is remembered.
+  CHECK_EQ(CommandParser::DoParse("beta", "x"), true);
+  CHECK_EQ(alpha.calls, 1);
+  CHECK_EQ(beta.calls, 2);
+
+  // If beta says no, everybody else is asked, but beta only once.
+  beta.enabled = false;
+  CHECK_EQ(CommandParser::DoParse("beta", nullptr), false);
+  CHECK_EQ(alpha.calls, 2);
+  CHECK_EQ(beta.calls, 3);
+
+  {
+    CountingParser beta2("beta");
+    CHECK_EQ(CommandParser::DoParse("beta", nullptr), true);
+    CHECK_EQ(beta2.calls, 1);
+  }
+  // beta2 is gone, and must not be remembered.
+  CHECK_EQ(CommandParser::DoParse("beta", nullptr), false);
+  beta.enabled = true;
+  CHECK_EQ(CommandParser::DoParse("beta", nullptr), true);
+
+  {
+    // gamma comes first in the list, since it was linked last, so it
+    // takes over once it says yes.
+    CountingParser gamma("beta");
+    CHECK_EQ(CommandParser::DoParse("beta", nullptr), true);
+    CHECK_EQ(gamma.calls, 1);
+    int beta_calls = beta.calls;
+    CHECK_EQ(CommandParser::DoParse("beta", nullptr), true);
+    CHECK_EQ(gamma.calls, 2);
+    CHECK_EQ(beta.calls, beta_calls);
+
+    // When gamma says no, beta handles the command, but gamma is
+    // still asked first next time.
+    gamma.enabled = false;
+    CHECK_EQ(CommandParser::DoParse("beta", nullptr), true);
+    CHECK_EQ(beta.calls, beta_calls + 1);
+    gamma.enabled = true;
+    CHECK_EQ(CommandParser::DoParse("beta", nullptr), true);
+    CHECK_EQ(gamma.calls, 4);
+    CHECK_EQ(beta.calls, beta_calls + 1);
+  }
+  CHECK_EQ(CommandParser::DoParse("lines", nullptr), true);
+}
+
+// Command names of the parsers in ProffieOS, in the order they
+// end up in the parser list.
+const char* const bench_parser_commands[] = {
+  "l left list_current_tracks r right get_gesture set_gesture",
+  "pow",
+  "aux",
+  "get_ble_config send",
+  "blink",
+  "booster cache cat closefile del df dir dmamap dumpfusor dumpwav dumpwavplayer "
+  "effects flame format high i2cstate low ls make_default_console malloc openfile "
+  "portstates readalot reset rm sdcache sdtest selftest shutdown sleep stm32info "
+  "tof ton top twiddle twiddle2 version whatispowered",
+  "beep blast buffered ccmode cd change_preset clash delete_preset drag "
+  "duplicate_preset error_in_blade_array error_in_font_directory "
+  "font_directory_not_found force get_blade_dimming get_blade_length "
+  "get_clash_threshold get_max_blade_length get_on get_preset get_track "
+  "get_volume id lb lblock list_fonts list_presets list_tracks lock lockup "
+  "low_battery melt mkdir move_preset mute n next off on p play play_track "
+  "prev pwd rotate scanid sd_card_not_found set_blade_dimming set_blade_length "
+  "set_clash_threshold set_font set_name set_preset set_track set_volume "
+  "show_current_preset stab stop_track toggle_mute unmute var variation volumes",
+  "displaystate testframe",
+  "displaycontrollerstate",
+  "describe_named_style list_named_styles",
+  "blade",
+  "blade",
+  "idle",
+  "booster",
+  "batt battery battery_voltage bstate",
+  "governor",
+  "dumptrace mon monitor trace tracebin",
+  "underflows",
+  "amp whatison",
+  "say talkie talkie12 talkie15 talkie_slow",
+  "dacbuf filterdata",
+};
+
+class BenchParser : public CommandParser {
+public:
+  BenchParser(const char* commands) {
+    for (const char* p = SkipSpace(commands); *p; p = SkipSpace(SkipWord(p))) {
+      commands_.push_back(std::string(p, SkipWord(p) - p));
+    }
+  }
+  // Same thing as the strcmp chains in the real parsers.
+  bool Parse(const char* cmd, const char* arg) override {
+    for (const std::string& c : commands_) {
+      if (!strcmp(cmd, c.c_str())) return true;
+    }
+    return false;
+  }
+  std::vector<std::string> commands_;
+};
+
+// Usage: tests bench [session]
+// Replays a serial session, one command per line, through a set of
+// parsers that handle the same commands as the ones in ProffieOS, with
+// and without remembering which parser handles what. Without a session
+// file, a made up editor session is used.
+void command_parser_benchmark(const char* filename) {
+  std::vector<std::pair<std::string, std::string>> session;
+  if (filename) {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+      printf("Failed to open %s\n", filename);
+      exit(1);
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+      line[strcspn(line, "\r\n")] = 0;
+      const char* cmd = SkipSpace(line);
+      if (!*cmd) continue;
+      const char* end = SkipWord(cmd);
+      session.push_back(std::make_pair(std::string(cmd, end - cmd), std::string(SkipSpace(end))));
+    }
+    fclose(f);
+  } else {
+    const char* const editor[] = {
+      "get_preset", "get_volume", "get_on", "list_presets", "show_current_preset",
+      "get_blade_length 1", "get_max_blade_length 1", "get_blade_dimming",
+      "get_clash_threshold", "list_fonts", "list_tracks", "variation",
+      "describe_named_style standard", "list_named_styles",
+    };
+    for (int p = 0; p < 20; p++) {
+      for (const char* c : editor) {
+	const char* end = SkipWord(c);
+	session.push_back(std::make_pair(std::string(c, end - c), std::string(SkipSpace(end))));
+      }
+      session.push_back(std::make_pair("set_preset", std::to_string(p)));
+      session.push_back(std::make_pair("set_font", "font" + std::to_string(p)));
+      session.push_back(std::make_pair("set_volume", "1500"));
+    }
+  }
+
+  std::vector<BenchParser*> bench_parsers;
+  for (int i = NELEM(bench_parser_commands) - 1; i >= 0; i--) {
+    bench_parsers.push_back(new BenchParser(bench_parser_commands[i]));
+  }
+  const int rounds = 200;
+  int handled = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (const auto& c : session) {
+      // Ask every parser in turn, like DoParse() without the cache.
+      for (auto i = bench_parsers.rbegin(); i != bench_parsers.rend(); ++i) {
+	if ((*i)->Parse(c.first.c_str(), c.second.c_str())) {
+	  handled++;
+	  break;
+	}
+      }
+    }
+  }
+  std::chrono::duration<double, std::micro> uncached = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (const auto& c : session) {
+      CommandParser::DoParse(c.first.c_str(), c.second.c_str());
+    }
+  }
+  std::chrono::duration<double, std::micro> cached = std::chrono::steady_clock::now() - start;
+  printf("%d commands, %d handled\n", (int)session.size(), handled / rounds);
+  printf("asking every parser:   %8.3f us per command\n", uncached.count() / rounds / session.size());
+  printf("remembering parsers:   %8.3f us per command\n", cached.count() / rounds / session.size());
+  for (BenchParser* p : bench_parsers) delete p;
+}
+
 #include "cyclint.h"
 
 void test_cyclint() {
@@ -743,9 +961,222 @@ void test_cyclint() {
   }
 }
 
-int main() {
+void write_test_file(const char* filename, int size, int seed) {
+  FILE* f = fopen(filename, "wct");
+  CHECK(f);
+  for (int i = 0; i < size; i++) fputc((i * 7 + seed) & 0xff, f);
+  fclose(f);
+}
+
+void check_test_file(FileReader* f, int pos, int bytes, int seed) {
+  uint8_t tmp[2048];
+  f->Seek(pos);
+  int expected = std::min<int>(bytes, f->FileSize() - pos);
+  CHECK_EQ(f->Read(tmp, bytes), expected);
+  CHECK_EQ(f->Tell(), pos + expected);
+  for (int i = 0; i < expected; i++) {
+    CHECK_EQ(tmp[i], (uint8_t)(((pos + i) * 7 + seed) & 0xff));
+  }
+}
+
+void check_whole_test_file(FileReader* f, int size, int seed) {
+  for (int pos = 0; pos < size; pos += 1000) check_test_file(f, pos, 1000, seed);
+}
+
+void test_sd_block_cache() {
+  sd_block_cache.Clear();
+  write_test_file("cachetest.bin", 1300, 1);
+  FileReader f;
+  CHECK(f.Open("cachetest.bin"));
+  CHECK_EQ(f.FileSize(), 1300);
+
+  // Unaligned reads, crossing block boundaries and the end of the file.
+  sd_block_cache.ResetStats();
+  check_test_file(&f, 0, 100, 1);
+  check_test_file(&f, 500, 20, 1);
+  check_test_file(&f, 1000, 1000, 1);
+  CHECK_EQ(sd_block_cache.misses(), 3);
+  CHECK_EQ(f.Peek(), -1);
+  CHECK_EQ(f.Tell(), 1300);
+  f.Seek(1299);
+  CHECK_EQ(f.Peek(), (1299 * 7 + 1) & 0xff);
+  CHECK_EQ(f.Available(), 1);
+
+  // Reading it all again comes from the cache.
+  sd_block_cache.ResetStats();
+  check_test_file(&f, 0, 1300, 1);
+  CHECK_EQ(sd_block_cache.misses(), 0);
+  CHECK_EQ(sd_block_cache.hits(), 3);
+  f.Close();
+
+  // Rewriting the file drops it from the cache.
+  FileReader w;
+  CHECK(w.Create("cachetest.bin"));
+  for (int i = 0; i < 1300; i++) w.Write((i * 7 + 2) & 0xff);
+  w.Close();
+  CHECK(f.Open("cachetest.bin"));
+  check_test_file(&f, 0, 1300, 2);
+  f.Close();
+  CHECK(LSFS::Remove("cachetest.bin"));
+  CHECK_EQ(sd_block_cache.used_blocks(), 0);
+
+  // Large files bypass the cache, so a small file stays cached
+  // while they stream through.
+  write_test_file("cacheloop.bin", 1000, 3);
+  write_test_file("cachestream.bin", 8000, 4);
+  FileReader small, stream;
+  CHECK(small.Open("cacheloop.bin"));
+  check_test_file(&small, 0, 1000, 3);
+  CHECK_EQ(sd_block_cache.used_blocks(), 2);
+  CHECK(stream.Open("cachestream.bin"));
+  sd_block_cache.ResetStats();
+  for (int pos = 0; pos < 8000; pos += 512) check_test_file(&stream, pos, 512, 4);
+  check_test_file(&stream, 100, 2000, 4);
+  CHECK_EQ(sd_block_cache.hits() + sd_block_cache.misses(), 0);
+  CHECK_EQ(sd_block_cache.used_blocks(), 2);
+  check_test_file(&small, 0, 1000, 3);
+  CHECK_EQ(sd_block_cache.misses(), 0);
+  small.Close();
+
+  // The start of a loop is pinned, even in a large file.
+  FileReader loop;
+  CHECK(loop.Open("cachestream.bin"));
+  check_whole_test_file(&loop, 8000, 4);
+  loop.Rewind();
+  loop.SetLooping(true);
+  CHECK_EQ(sd_block_cache.pinned_blocks(), 0);
+  check_whole_test_file(&loop, 8000, 4);
+  CHECK_EQ(sd_block_cache.pinned_blocks(), SD_BLOCK_CACHE_LOOP_BLOCKS);
+  // Other files don't push it out.
+  for (int i = 0; i < 20; i++) {
+    char name[32];
+    sprintf(name, "cachesmall%d.bin", i);
+    write_test_file(name, 500, i);
+    CHECK(small.Open(name));
+    check_test_file(&small, 0, 500, i);
+    small.Close();
+    LSFS::Remove(name);
+  }
+  sd_block_cache.ResetStats();
+  loop.Rewind();
+  check_whole_test_file(&loop, 8000, 4);
+  // Block 1 is used by two of the reads.
+  CHECK_EQ(sd_block_cache.hits(), 3);
+  CHECK_EQ(sd_block_cache.misses(), 0);
+
+  // A loop that starts in the middle of the file, the blocks that
+  // are already cached are pinned right away.
+  loop.Seek(3000);
+  loop.SetLooping(true);
+  check_test_file(&loop, 3000, 1500, 4);
+  CHECK_EQ(sd_block_cache.pinned_blocks(), SD_BLOCK_CACHE_LOOP_BLOCKS);
+  loop.Seek(3000);
+  loop.SetLooping(true);
+  CHECK_EQ(sd_block_cache.pinned_blocks(), SD_BLOCK_CACHE_LOOP_BLOCKS);
+  loop.Close();
+  CHECK_EQ(sd_block_cache.pinned_blocks(), 0);
+  stream.Close();
+
+  // A file that was read ahead keeps its first blocks in the cache
+  // when it is handed over.
+  sd_block_cache.Clear();
+  FileReader ahead, player;
+  CHECK(ahead.Open("cachestream.bin"));
+  ahead.CacheHead(2);
+  check_test_file(&ahead, 0, 1024, 4);
+  CHECK_EQ(sd_block_cache.used_blocks(), 2);
+  player.Take(&ahead);
+  player.Rewind();
+  sd_block_cache.ResetStats();
+  check_test_file(&player, 0, 1024, 4);
+  CHECK_EQ(sd_block_cache.hits(), 2);
+  CHECK_EQ(sd_block_cache.misses(), 0);
+  check_test_file(&player, 1024, 2000, 4);
+  CHECK_EQ(sd_block_cache.used_blocks(), 2);
+  player.Close();
+
+  // An open file can be handed over to another reader.
+  FileReader first, second;
+  CHECK(first.Open("cacheloop.bin"));
+  check_test_file(&first, 0, 600, 3);
+  second.Take(&first);
+  CHECK(!first.IsOpen());
+  CHECK(second.IsOpen());
+  CHECK_EQ(second.Tell(), 600);
+  check_test_file(&second, 0, 1000, 3);
+  second.Close();
+  LSFS::Remove("cacheloop.bin");
+  LSFS::Remove("cachestream.bin");
+}
+
+void test_sd_name_cache() {
+  mkdir("namecache", 0777);
+  write_test_file("namecache/a.wav", 10, 1);
+  write_test_file("namecache/b.wav", 10, 1);
+  sd_name_cache.Add("namecache/a.wav");
+  sd_name_cache.Add("namecache/b.wav");
+  sd_name_cache.AddDirectory("namecache");
+  // The cache only knows what is missing, files that were seen are
+  // still looked up on the SD card.
+  CHECK_EQ(sd_name_cache.Lookup("NameCache//A.WAV"), SDNameCache::UNKNOWN);
+  CHECK_EQ(sd_name_cache.Lookup("namecache/c.wav"), SDNameCache::MISSING);
+  CHECK_EQ(sd_name_cache.Lookup("/NAMECACHE/c.wav"), SDNameCache::MISSING);
+  CHECK_EQ(sd_name_cache.Lookup("other/a.wav"), SDNameCache::UNKNOWN);
+  CHECK_EQ(sd_name_cache.Lookup("namecache2/c.wav"), SDNameCache::UNKNOWN);
+  CHECK_EQ(sd_name_cache.Lookup("namecache"), SDNameCache::UNKNOWN);
+
+  // Files that are not in the cache are missing, without asking the filesystem.
+  write_test_file("namecache/c.wav", 10, 1);
+  CHECK(!LSFS::Exists("namecache/c.wav"));
+  CHECK(!LSFS::Open("namecache/c.wav"));
+  CHECK(LSFS::Exists("namecache/a.wav"));
+
+  // Creating or removing files makes the directory unknown again.
+  LSFS::Remove("namecache/b.wav");
+  CHECK(!LSFS::Exists("namecache/b.wav"));
+  CHECK(LSFS::Exists("namecache/c.wav"));
+  CHECK_EQ(sd_name_cache.Lookup("namecache/c.wav"), SDNameCache::UNKNOWN);
+  sd_name_cache.AddDirectory("namecache");
+  FileReader f;
+  CHECK(f.Create("namecache/d.wav"));
+  f.Close();
+  CHECK(LSFS::Exists("namecache/d.wav"));
+
+  // Directories are not complete if they don't all fit.
+  sd_name_cache.Clear();
+  char name[32];
+  for (int i = 0; i < 20; i++) {
+    sprintf(name, "namecache/%d.wav", i);
+    sd_name_cache.Add(name);
+  }
+  sd_name_cache.AddDirectory("namecache");
+  CHECK_EQ(sd_name_cache.Lookup("namecache/c.wav"), SDNameCache::UNKNOWN);
+  CHECK_EQ(sd_name_cache.used_entries(), 12);
+  sd_name_cache.Clear();
+
+  // Or if their names don't fit.
+  sd_name_cache.AddDirectory("namecache");
+  sd_name_cache.AddDirectory("a_directory_with_a_long_name");
+  CHECK_EQ(sd_name_cache.Lookup("namecache/c.wav"), SDNameCache::MISSING);
+  CHECK_EQ(sd_name_cache.Lookup("a_directory_with_a_long_name/c.wav"), SDNameCache::UNKNOWN);
+  sd_name_cache.Clear();
+
+  LSFS::Remove("namecache/a.wav");
+  LSFS::Remove("namecache/c.wav");
+  LSFS::Remove("namecache/d.wav");
+  rmdir("namecache");
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && !strcmp(argv[1], "bench")) {
+    command_parser_benchmark(argc > 2 ? argv[2] : nullptr);
+    return 0;
+  }
   test_cyclint();
+  test_sd_block_cache();
+  test_sd_name_cache();
   command_parser_test();
+  command_parser_cache_test();
   
   extras = false;
   test_current_preset();
@@ -754,6 +1185,7 @@ int main() {
   test_current_preset();
 
   config_file_tests();
+  buffered_file_writer_tests();
   fuse_tests();
   test_rotate();
   byteorder_tests();
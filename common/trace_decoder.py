@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+
+# Pulls the binary trace buffer from a board running with ENABLE_TRACING
+# and renders it as a timeline.
+#
+# Usage:
+#   trace_decoder.py /dev/ttyACM0            # fetch over USB serial
+#   trace_decoder.py saved_output.txt        # decode saved "tracebin" output
+#   trace_decoder.py --json out.json PORT    # also write chrome://tracing json
+#
+# Fetching over serial requires pyserial.
+
+import json
+import os
+import sys
+
+# Keep in sync with TraceEventId in common/monitoring.h
+EVENT_NAMES = {
+    0: "string",
+    1: "loop",
+    2: "audio_isr",
+    3: "wav_fill",
+    4: "pixel_refill",
+    5: "sd_read",
+}
+EVENT_END = 0x8000
+
+class Entry:
+    def __init__(self, seq, timestamp, event, arg, location):
+        self.seq = seq
+        self.timestamp = timestamp
+        self.event = event
+        self.arg = arg
+        self.location = location
+
+    def is_end(self):
+        return (self.event & EVENT_END) != 0
+
+    def name(self, strings):
+        if self.event == 0:
+            return strings.get(self.location, "0x%08x" % self.location)
+        return EVENT_NAMES.get(self.event & ~EVENT_END, "event%d" % (self.event & ~EVENT_END))
+
+class Trace:
+    def __init__(self, lines):
+        self.cycles_per_second = 1000000
+        self.entries = []
+        self.strings = {}
+        for line in lines:
+            line = line.strip()
+            if line.startswith("TRACE "):
+                parts = line.split()
+                self.cycles_per_second = int(parts[1])
+            elif line.startswith("E "):
+                parts = line.split()
+                self.entries.append(Entry(int(parts[1], 16),
+                                          int(parts[2], 16),
+                                          int(parts[3], 16),
+                                          int(parts[4], 16),
+                                          int(parts[5], 16)))
+            elif line.startswith("S "):
+                parts = line.split(" ", 2)
+                self.strings[int(parts[1], 16)] = parts[2] if len(parts) > 2 else ""
+        self.unwrap_timestamps()
+
+    # The cycle counter is 32 bits and wraps every few seconds,
+    # convert to a monotonic time in microseconds.
+    def unwrap_timestamps(self):
+        base = 0
+        last = None
+        for e in self.entries:
+            if last is not None and e.timestamp < last:
+                base += 1 << 32
+            last = e.timestamp
+            e.time_us = (base + e.timestamp) * 1000000.0 / self.cycles_per_second
+        if self.entries:
+            start = self.entries[0].time_us
+            for e in self.entries:
+                e.time_us -= start
+
+    # Returns a list of (name, begin_us, duration_us, arg)
+    def spans(self):
+        open_spans = {}
+        ret = []
+        for e in self.entries:
+            if e.event == 0:
+                continue
+            key = e.event & ~EVENT_END
+            if e.is_end():
+                begin = open_spans.pop(key, None)
+                if begin:
+                    ret.append((e.name(self.strings), begin.time_us,
+                                e.time_us - begin.time_us, begin.arg))
+            else:
+                open_spans[key] = e
+        return ret
+
+    def chrome_json(self):
+        events = []
+        for name, begin, duration, arg in self.spans():
+            events.append({"name": name, "ph": "X", "ts": begin, "dur": duration,
+                           "pid": 0, "tid": name, "args": {"arg": arg}})
+        for e in self.entries:
+            if e.event == 0:
+                events.append({"name": e.name(self.strings), "ph": "i", "ts": e.time_us,
+                               "pid": 0, "tid": "trace", "s": "t",
+                               "args": {"arg": e.arg}})
+        return json.dumps({"traceEvents": events}, indent=1)
+
+    def print_timeline(self, width=100):
+        spans = self.spans()
+        if not self.entries:
+            print("No trace entries.")
+            return
+        end = max(e.time_us for e in self.entries)
+        scale = width / max(end, 1.0)
+        names = sorted(set(s[0] for s in spans))
+        print("Timeline: %.1f us, %d entries" % (end, len(self.entries)))
+        for name in names:
+            row = [" "] * (width + 1)
+            total = 0.0
+            count = 0
+            longest = 0.0
+            for n, begin, duration, arg in spans:
+                if n != name:
+                    continue
+                count += 1
+                total += duration
+                longest = max(longest, duration)
+                for x in range(int(begin * scale), int((begin + duration) * scale) + 1):
+                    row[min(x, width)] = "#"
+            print("%-13s|%s| n=%d avg=%.1fus max=%.1fus" %
+                  (name, "".join(row), count, total / count, longest))
+        for e in self.entries:
+            if e.event == 0:
+                print("%10.1f us  %s (%d)" % (e.time_us, e.name(self.strings), e.arg))
+
+def fetch_serial(port):
+    import serial
+    s = serial.Serial(port, 115200, timeout=2)
+    s.write(b"tracebin\n")
+    lines = []
+    while True:
+        line = s.readline().decode("utf-8", "replace")
+        if not line:
+            print("%s: timeout waiting for trace" % port)
+            break
+        if line.strip() == "END":
+            break
+        lines.append(line)
+    s.close()
+    return lines
+
+def main(args):
+    json_file = None
+    if len(args) >= 2 and args[0] == "--json":
+        json_file = args[1]
+        args = args[2:]
+    if len(args) != 1:
+        print("Usage: %s [--json out.json] PORT_OR_FILE" % sys.argv[0])
+        return 1
+    if os.path.isfile(args[0]):
+        with open(args[0]) as f:
+            lines = f.readlines()
+    else:
+        lines = fetch_serial(args[0])
+    trace = Trace(lines)
+    trace.print_timeline()
+    if json_file:
+        with open(json_file, "w") as f:
+            f.write(trace.chrome_json())
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -40,6 +40,7 @@ should contain one of:
   file=boot128x80.pqf   # Tells the current layer to start playing boot128x80.pqf
   restart               # start file from beginning
   time=1000             # Play this file 1000ms, then stop
+  opacity=50            # Draw this layer at 50% opacity (transparent files only)
   A=battery             # Variable assignment
 
 Note that if "restart" is not present, and you specify the same filename as what
@@ -97,6 +98,7 @@ public:
   virtual const void LC_restart() = 0;
   virtual void LC_play(const char* filename) = 0;
   virtual void LC_set_time(uint32_t millis) = 0;
+  virtual void LC_set_opacity(int percent) = 0;
 };
 
 class LayeredScreenControl {
@@ -110,10 +112,12 @@ class SizedLayeredScreenControl : public LayeredScreenControl {};
 
 class BufferedFileReader : public AudioStreamWork {
 protected:
-  void SEEK(uint32_t pos) {
+  // |loop| is true when going back to the start of a loop.
+  void SEEK(uint32_t pos, bool loop = false) {
     TRACE2(RGB565, "SEEK", pos);
     stream_locked_.set(true);
     do_seek_ = true;
+    loop_seek_ = loop;
     seek_pos_ = pos;
     input_buffer_.clear();
     stream_locked_.set(false);
@@ -156,13 +160,19 @@ protected:
     if (do_seek_) {
       TRACE2(RGB565, "FillBuffer, seek to ", seek_pos_);
       file_.Seek(seek_pos_);
+      // Keep the loop point in the SD block cache.
+      if (loop_seek_) file_.SetLooping(true);
       do_seek_ = false;
 //      TRACE(RGB565, "FillBuffer6");
       return true;
     }
     uint32_t toread = input_buffer_.continuous_space();
     uint32_t max_read = 512 - (file_.Tell() % 512);  // Read to end of block
-    uint32_t bytes_read = file_.Read(input_buffer_.space(), std::min(toread, max_read));
+    uint32_t bytes_read;
+    {
+      TRACE_SCOPE(SD, SD_READ, std::min(toread, max_read));
+      bytes_read = file_.Read(input_buffer_.space(), std::min(toread, max_read));
+    }
     input_buffer_.push(bytes_read);
     TRACE2(RGB565, "FillBuffer7", input_buffer_.size());
     return true;
@@ -190,6 +200,7 @@ protected:
   POAtomic<bool> stream_locked_;
   volatile uint32_t file_size_ = 0xFFFFFFFFU;
   volatile bool do_seek_;  // atomic?
+  volatile bool loop_seek_ = false;
   uint32_t seek_pos_ = 0;
   POLYHOLE;
   CircularBuffer<uint8_t, 1024> input_buffer_;
@@ -288,6 +299,8 @@ public:
 	} else {
 	  layer_->LC_set_time(atoi(value));
 	}
+      } else if (!strcmp(key, "opacity")) {
+	layer_->LC_set_opacity(atoi(value));
       } else if (!strcmp(key, "A") ||
 		 !strcmp(key, "B") ||
 		 !strcmp(key, "C") ||
@@ -62,6 +62,35 @@ public:
     }
   }
 
+  // Damage tracking.
+  // Compares the frame buffer with |previous| (what the display is
+  // currently showing), and returns the columns [x1, x2) and pages
+  // (groups of 8 rows) [page1, page2] that need to be sent. Returns
+  // false if nothing changed. |previous| is updated to match.
+  bool UpdateDamage(col_t* previous, int* x1, int* x2, int* page1, int* page2) {
+    col_t changed = 0;
+    int first = WIDTH, last = -1;
+    for (int x = 0; x < WIDTH; x++) {
+      col_t diff = frame_buffer_[x] ^ previous[x];
+      if (!diff) continue;
+      if (first == WIDTH) first = x;
+      last = x;
+      changed |= diff;
+      previous[x] = frame_buffer_[x];
+    }
+    if (last < 0) return false;
+    *x1 = first;
+    *x2 = last + 1;
+    *page1 = 0;
+    while (!(changed & (col_t)0xff)) {
+      changed >>= 8;
+      ++*page1;
+    }
+    *page2 = *page1;
+    while (changed >>= 8) ++*page2;
+    return true;
+  }
+
   void TransposeSquareInPlace(col_t* A) {
     int j, k; 
     col_t m, t; 
@@ -175,7 +204,7 @@ public:
 
   // x1 < x2, y1 < y2
   void ClearRect(int x1, int x2, int y1, int y2) {
-    col_t tmp = ~(((col_t)-1) >> (HEIGHT - (y2 - y1))) << y1;
+    col_t tmp = ~((((col_t)-1) >> (HEIGHT - (y2 - y1))) << y1);
     for (int x = x1 ; x < x2; x++) frame_buffer_[x] &= tmp;
   }
 
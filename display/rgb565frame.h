@@ -10,6 +10,7 @@ template<size_t WIDTH>
 class OutputBuffer {
 public:
   int rownum;
+  uint32_t frame_start;  // micros(), for pipeline statistics
   POAtomic<bool> done;
   POLYHOLE;
   PQOI::PqoiOutputChunk<WIDTH> chunk;
@@ -84,14 +85,29 @@ public:
     state_machine_.stop();
     play_ = false;
     next_header_ = 0;
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+    buffer_valid_ = false;
+#endif
   }
 
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+  // Keeps a copy of the last decoded frame, needed for delta frames.
+  void set_frame_buffer(uint16_t* buffer) { frame_buffer_ = buffer; }
+#endif
+
   void run() {
     TRACE(RGB565, "layer::run()");
     STATE_MACHINE_BEGIN();
     TRACE(RGB565, "layer::run::begin");
 
     if (frame_position_in_file_ && micros_ < next_frame_micros_) {
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+      if (buffer_valid_) {
+	PVLOG_VERBOSE << "Repeat last frame from buffer.\n";
+	replay_ = true;
+	goto frame_ready;
+      }
+#endif
       SEEK(frame_position_in_file_);
       PVLOG_VERBOSE << "Repeat last frame.\n";
       goto frame_found;
@@ -147,17 +163,33 @@ public:
       } else if (header_.magic == fourcc("GOTO")) {
 	TRACE(RGB565, "layer::run::GOTO");
 	if (checklabel(header_.data1)) {
-	  SEEK(header_.data2);
+	  SEEK(header_.data2, header_.data2 < TELL());
 	  next_header_ = header_.data2;
 	}
 	goto read_header;
       } else if (header_.magic == fourcc("PQOI")) {
 	TRACE(RGB565, "layer::run::PQOI");
 	transparent_ = false;
+	delta_ = false;
+	width_ = header_.data1;
+	height_ = header_.data2;
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+      } else if (header_.magic == fourcc("PQOD")) {
+	TRACE(RGB565, "layer::run::PQOD");
+	if (!frame_buffer_) {
+	  STDERR << "Delta frames are only supported on the base layer, giving up...\n";
+	  stop();
+	  return;
+	}
+	transparent_ = false;
+	delta_ = true;
+	has_deltas_ = true;
 	width_ = header_.data1;
 	height_ = header_.data2;
+#endif
       } else if (header_.magic == fourcc("PQOA")) {
 	transparent_ = true;
+	delta_ = false;
 	if (layer_ == 0) {
 	  STDERR << "Transparent image on base layer, giving up...\n";
 	  stop();
@@ -193,6 +225,15 @@ public:
     top_margin_ = (HEIGHT - height_) / 2;
     left_margin_ = (WIDTH - width_) / 2;
 
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+    if (delta_ && !buffer_valid_) {
+      // The frame before this one was not decoded, wait for the next key frame.
+      PVLOG_VERBOSE << "Skipping delta frame.\n";
+      if (micros_per_frame_) next_frame_micros_ += micros_per_frame_;
+      goto skip_frame;
+    }
+#endif
+
     TRACE(RGB565, "layer::run::MPF");
     if (micros_per_frame_ == 0 || ATEOF()) goto frame_found;
     TRACE(RGB565, "layer::run::MPF2");
@@ -203,10 +244,21 @@ public:
     } else {
       next_frame_micros_ += micros_per_frame_;
       if (next_frame_micros_ > micros_) goto frame_found;
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+      if (has_deltas_) {
+	// Skipping would break the chain of delta frames, show this one late instead.
+	next_frame_micros_ = micros_;
+	goto frame_found;
+      }
+#endif
     }
     TRACE(RGB565, "layer::run::FF");
     
     // Skip frame
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+  skip_frame:
+    buffer_valid_ = false;
+#endif
     SEEK(TELL() + header_.length - 8);
     goto read_header;
 
@@ -214,6 +266,12 @@ public:
     TRACE(RGB565, "layer::run::frame found");
 
     frame_position_in_file_ = TELL();
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+    // frame_buffer_ is about to be overwritten.
+    buffer_valid_ = false;
+    delta_row_ = -1;
+  frame_ready:
+#endif
     frame_selected_ = true;
 
     STATE_MACHINE_END();
@@ -231,10 +289,15 @@ public:
 	play_ = true;
 	first_frame_ = true;
 	next_header_ = 0;
+	// Don't repeat a frame from the previous file.
+	frame_position_in_file_ = 0;
 	start_time_millis_ = millis();
       }
       if (!play_) return true;
       frame_selected_ = false;
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+      replay_ = false;
+#endif
       TRACE(RGB565, "SelectFrame::reset");
       state_machine_.reset_state_machine();
       pqoi.reset();
@@ -264,11 +327,56 @@ public:
       ///memset(output_buffer->chunk.pixels.begin(), 0, WIDTH*2);
       return true;
     }
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+    if (frame_buffer_) return FillWithFrameBuffer(output_buffer);
+#endif
     if (!input_buffer_.size()) scheduleFillBuffer();
     output_buffer->fill(&pqoi, &input_buffer_, left_margin_, width_);
     return output_buffer->chunk.full(left_margin_, width_);
   }
 
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+  // Like Fill(), but also handles delta frames and repeated frames,
+  // and saves each row in frame_buffer_.
+  bool FillWithFrameBuffer(OutputBuffer<WIDTH>* output_buffer) {
+    int y = output_buffer->rownum - top_margin_;
+    uint16_t* row = output_buffer->chunk.begin() + left_margin_;
+    uint16_t* saved = frame_buffer_ + y * width_;
+    if (replay_) {
+      memcpy(row, saved, width_ * 2);
+      output_buffer->chunk.end_ = row + width_;
+      return true;
+    }
+    if (!delta_) {
+      if (!input_buffer_.size()) scheduleFillBuffer();
+      output_buffer->fill(&pqoi, &input_buffer_, left_margin_, width_);
+      if (!output_buffer->chunk.full(left_margin_, width_)) return false;
+    } else {
+      if (delta_row_ != y) {
+	delta_row_ = y;
+	mask_bytes_read_ = (y % PQOI::DELTA_TILE_SIZE) ? PQOI::DeltaMaskBytes(width_) : 0;
+      }
+      while (mask_bytes_read_ < PQOI::DeltaMaskBytes(width_)) {
+	if (!input_buffer_.size()) {
+	  scheduleFillBuffer();
+	  return false;
+	}
+	tile_mask_[mask_bytes_read_++] = *input_buffer_.data();
+	input_buffer_.pop(1);
+      }
+      int changed = PQOI::DeltaChangedPixels(tile_mask_, width_);
+      if (!input_buffer_.size()) scheduleFillBuffer();
+      output_buffer->fill(&pqoi, &input_buffer_, left_margin_, changed);
+      if (!output_buffer->chunk.full(left_margin_, changed)) return false;
+      PQOI::DeltaExpandRow(row, saved, tile_mask_, width_);
+      output_buffer->chunk.end_ = row + width_;
+    }
+    memcpy(saved, row, width_ * 2);
+    if (y == height_ - 1) buffer_valid_ = true;
+    return true;
+  }
+#endif
+
 
   // Returns true when done.
   bool Apply(OutputBuffer<WIDTH>* output_buffer, uint16_t* &out) {
@@ -315,14 +423,23 @@ public:
   }
   const void LC_restart() override {
     TRACE(RGB565, "LC_restart");
-    SEEK(0);
+    SEEK(0, true);
   }
   void LC_play(const char* filename) override {
     TRACE(RGB565, "LC_play");
     delayed_open_ = true;
+    pqoi.set_opacity(32);
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+    buffer_valid_ = false;
+    has_deltas_ = false;
+#endif
     file_.PlayInternal(filename);
   }
 
+  void LC_set_opacity(int percent) override {
+    pqoi.set_opacity(clampi32(percent, 0, 100) * 32 / 100);
+  }
+
   void LC_set_time(uint32_t millis) override {
     time_ = millis;
   }
@@ -340,6 +457,7 @@ public:
 	   << " POS: " << TELL()
 	   << " EOF: " << ATEOF()
 	   << " Bufsize: " << input_buffer_.size()
+	   << " opacity: " << (int)pqoi.opacity()
 	   << " next state: " << state_machine_.next_state_ << "\n";
   }
 
@@ -351,7 +469,20 @@ public:
 
   uint8_t layer_;
   bool transparent_;
+  bool delta_ = false;
 protected:
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+  uint16_t* frame_buffer_ = nullptr;
+  // frame_buffer_ holds the last frame, in its entirety.
+  bool buffer_valid_ = false;
+  // Current frame is a repeat, and will be drawn from frame_buffer_.
+  bool replay_ = false;
+  // Current file contains delta frames, don't skip frames.
+  bool has_deltas_ = false;
+  int delta_row_ = -1;
+  int mask_bytes_read_ = 0;
+  uint8_t tile_mask_[(WIDTH / PQOI::DELTA_TILE_SIZE + 8) / 8];
+#endif
   uint32_t start_time_millis_;
   bool play_ = false;
   bool frame_selected_ = false;
@@ -401,6 +532,9 @@ public:
     for (size_t i = 0; i < LAYERS; i++) {
       layers[i].layer_ = i;
     }
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+    layers[0].set_frame_buffer(base_layer_frame_);
+#endif
   }
 
   // Calling initDisplay should disable loop() calls until display is ready.
@@ -437,9 +571,11 @@ public:
       YIELD();  // This makes sure that any pending commands are sent.
 
       // Clear Screen
+      frame_start_ = Cyclint<uint32_t>(micros());
       current_output_buffer_->chunk.init(layers[0].left_margin_);
       for (rownum_ = 0; rownum_ < HEIGHT; rownum_++) {
 	current_output_buffer_->rownum = rownum_;
+	current_output_buffer_->frame_start = frame_start_;
 	current_output_buffer_->chunk.zero();
 	
 	// After this, it will be ok to make modifications to the current output buffer.
@@ -484,6 +620,7 @@ public:
 	for (rownum_ = 0; rownum_ < HEIGHT; rownum_++) {
 	  TRACE2(RGB565, "inner loop row=", rownum_);
 	  current_output_buffer_->rownum = rownum_;
+	  current_output_buffer_->frame_start = frame_start_;
 
 	  // Base layer
 	  while (!layers[0].Fill(current_output_buffer_)) YIELD_SLICE();
@@ -523,9 +660,15 @@ public:
 	    next_frame_time_ = std::min(next_frame_time_, layers[l].next_frame_time());
 	  }
 	}
+	if (cpu_governor_level() >= GOVERNOR_SKIP_DISPLAY_FRAMES) {
+	  // Halve the frame rate, SelectFrame() skips ahead.
+	  next_frame_time_ += (uint32_t)next_frame_time_ - (uint32_t)frame_start_;
+	}
 
-	// Frame transferred. Wait for next frame.
+	// Frame rendered, the last rows may still be transferring. Wait for next frame.
 	frame_end = Cyclint<uint32_t>(micros());
+	render_micros_ += (uint32_t)frame_end - (uint32_t)frame_start_;
+	frames_rendered_++;
 	if (frame_end < next_frame_time_) {
 	  SLEEP_MICROS(next_frame_time_ - frame_end);
 	}
@@ -542,10 +685,32 @@ public:
     return layers + layer;
   }
 
+  // Rendering and sending overlap, so the frame rate is limited by
+  // whichever is slower, "max" shows what that limit is. "frame" is the
+  // time from the start of rendering to the last row being sent, and
+  // "stalled" is the time the transfer spent waiting for rows.
   void SB_Top() override {
     STDOUT.print("display fps: ");
     loop_counter_.Print();
+    noInterrupts();
+    uint32_t frames_sent = frames_sent_;
+    uint32_t frame_micros = frame_micros_;
+    uint32_t transfer_micros = transfer_micros_;
+    uint32_t stall_micros = stall_micros_;
+    frames_sent_ = frame_micros_ = transfer_micros_ = stall_micros_ = 0;
+    interrupts();
+    if (frames_rendered_ && frames_sent) {
+      uint32_t render = render_micros_ / frames_rendered_;
+      uint32_t transfer = transfer_micros / frames_sent;
+      STDOUT << " (max " << (1000000.0f / std::max<uint32_t>(1, std::max(render, transfer)))
+	     << ") frame: " << (frame_micros / frames_sent)
+	     << "us render: " << render
+	     << "us transfer: " << transfer
+	     << "us stalled: " << (stall_micros / frames_sent) << "us";
+    }
     STDOUT.println("");
+    render_micros_ = 0;
+    frames_rendered_ = 0;
   }
   
   void dumpstate() {
@@ -581,6 +746,19 @@ protected:
   
   CircularBuffer<OutputBuffer<WIDTH>, 4> output_buffers_;
   LoopCounter loop_counter_;
+
+  // Pipeline statistics, the transfer ones are updated by the display
+  // driver from the transfer interrupt.
+  uint32_t render_micros_ = 0;
+  uint32_t frames_rendered_ = 0;
+  volatile uint32_t frame_micros_ = 0;
+  volatile uint32_t transfer_micros_ = 0;
+  volatile uint32_t stall_micros_ = 0;
+  volatile uint32_t frames_sent_ = 0;
+#ifdef ENABLE_PQOI_DELTA_FRAMES
+  // Last frame of the base layer, WIDTH * HEIGHT * 2 bytes.
+  uint16_t base_layer_frame_[WIDTH * HEIGHT];
+#endif
 private:
   POLYHOLE;
   StateMachineState state_machine_;
@@ -290,6 +290,7 @@ struct StandardDisplayAdapter {
     static const int RESET = -1;            //
     static const int LIGHT = blade6Pin;     // Free2 (backlight, PWM)
     static const int DC = blade7Pin;        // Free3
+    static const bool DEDICATED_BUS = true;
     static void beginTransaction() {
       // Do nothing, this is a dedicated SPI bus.
     }
@@ -323,6 +324,7 @@ struct StandardDisplayAdapterM3 {
     static const int RESET = -1;            //
     static const int LIGHT = blade6Pin;     // Free2 (backlight, PWM)
     static const int DC = blade7Pin;        // Free3
+    static const bool DEDICATED_BUS = true;
     static void beginTransaction() {
       // Do nothing, this is a dedicated SPI bus.
     }
@@ -358,6 +360,8 @@ struct CSDisplayAdapter {
     static const int RESET = -1;            //
     static const int LIGHT = blade6Pin;     // Free2 (backlight, PWM)
     static const int DC = blade7Pin;        // Free3
+    // If nothing else uses the bus, transactions can span a whole frame.
+    static const bool DEDICATED_BUS = !SPI_SHARED;
     static void beginTransaction() {
 //    stm32l4_system_sysclk_configure(_SYSTEM_CORE_CLOCK_, _SYSTEM_CORE_CLOCK_/2, _SYSTEM_CORE_CLOCK_);
       SPISettings settings(std::min(MAX_SPI_FREQUENCY, CHIP::MAX_SPI_FREQUENCY), MSBFIRST, SPI_MODE0);
@@ -431,7 +435,6 @@ TransferDoneInterface* volatile SpiIrqHelper::o[5] = {0};
 SpiIrqHelper spi_irq_helper;
 
 // TODO: 40Mhz
-// TODO: show input/output buffer state in "top"
 
 template<int X, int Y>
 struct SizeT {
@@ -566,10 +569,26 @@ public:
 
   bool do_end_transaction = false;
 
+  // Rows are rendered into output_buffers_ while earlier rows are sent
+  // by DMA. When a transfer finishes, the interrupt starts the next one
+  // right away if that row is ready; if not, the transfer is stalled
+  // until frame_loop() finishes the row and calls startTransfer().
   void transferDone() override {
-    SA::endTransaction();
+    uint32_t now = micros();
+    bool last_row = HELPER::frame::output_buffers_.data()->rownum == HEIGHT - 1;
+    this->transfer_micros_ += now - transfer_start_;
+    if (last_row) {
+      this->frame_micros_ += now - HELPER::frame::output_buffers_.data()->frame_start;
+      this->frames_sent_++;
+    }
+    if (!SA::DEDICATED_BUS || last_row) {
+      SA::endTransaction();
+      in_transaction_ = false;
+    }
 //    TRACE(RGB565, "transferDone");
     HELPER::frame::output_buffers_.pop(1);
+    stall_start_ = now;
+    stalled_ = !last_row;
     transferring_.set(false);
     startTransfer();
   }
@@ -585,9 +604,22 @@ public:
     }
     if (HELPER::frame::output_buffers_.data()->rownum == 0) {
       PVLOG_VERBOSE << "Start new frame, " << (HELPER::frame::output_buffers_.data()->chunk.end() - HELPER::frame::output_buffers_.data()->chunk.begin()) << " bytes pixel0 = " << *HELPER::frame::output_buffers_.data()->chunk.begin() << "\n";
+      if (in_transaction_) {
+	SA::endTransaction();
+	in_transaction_ = false;
+      }
       startFrame();
+      stalled_ = false;
     }
-    SA::beginTransaction();
+    if (!in_transaction_) {
+      SA::beginTransaction();
+      in_transaction_ = true;
+    }
+    if (stalled_) {
+      this->stall_micros_ += micros() - stall_start_;
+      stalled_ = false;
+    }
+    transfer_start_ = micros();
     
     uint16_t *data = HELPER::frame::output_buffers_.data()->chunk.begin();
     bool ret = SA::spi().transfer(data,
@@ -597,6 +629,7 @@ public:
     if (!ret) {
       transferring_ = false;
       SA::endTransaction();
+      in_transaction_ = false;
       STDERR << "spi transfer failed.";
 //	TRACE(RGB565, "startTransfer7");
     }
@@ -616,6 +649,8 @@ public:
   
   void Loop() override {
     while (to_send_ < to_send_end_) {
+      // Don't mix commands with pixels from a frame that is still being sent.
+      if (transferring_.get() || in_transaction_) return;
       if (wait_time_) {
 	if (millis() - wait_start_ < wait_time_) {
 	  return;
@@ -666,6 +701,11 @@ public:
   uint32_t wait_start_;
   uint32_t wait_time_ = 0;
   POAtomic<bool> transferring_;
+  // Only touched while transferring_ is held, or from transferDone().
+  volatile bool in_transaction_ = false;
+  volatile bool stalled_ = false;
+  uint32_t stall_start_;
+  uint32_t transfer_start_;
 
   // TODO: Allow FET and non-pwm pins, probably by improving SimplePWMPin<>.
   SimplePWMPin<SA::LIGHT> backlight_;
@@ -970,11 +970,57 @@ public:
 
   static const size_t chunk_size = WIDTH * HEIGHT / 8 / 16;
   static const size_t num_chunks = WIDTH * HEIGHT / 8 / chunk_size;
+  static const int PAGES = sizeof(col_t);
 
   uint8_t chunk[chunk_size + 1];
-  void GetChunk() {
+  // Copies the next part of the damaged area to chunk, returns the
+  // number of bytes to send. In vertical address mode the display
+  // expects all the pages of the first column, then the next column.
+  size_t GetChunk() {
+    const uint8_t* fb = (const uint8_t*)Display<WIDTH, col_t>::frame_buffer_;
+    int pages = page2_ - page1_ + 1;
+    int n = std::min<int>(chunk_size, update_bytes_ - i);
     chunk[0] = 0x40;
-    memcpy(chunk + 1, i + (unsigned char *)Display<WIDTH, col_t>::frame_buffer_, chunk_size);
+    if (pages == PAGES) {
+      memcpy(chunk + 1, fb + x1_ * PAGES + i, n);
+    } else {
+      for (int j = 0; j < n; j++) {
+        int pos = i + j;
+        chunk[j + 1] = fb[(x1_ + pos / pages) * PAGES + page1_ + pos % pages];
+      }
+    }
+    return n + 1;
+  }
+
+  // Figures out what parts of the screen needs to be sent and
+  // sets up the column/page address commands.
+  // Returns false if the screen did not change.
+  bool PrepareUpdate() {
+    if (full_update_) {
+      full_update_ = false;
+      memcpy(shown_, Display<WIDTH, col_t>::frame_buffer_, sizeof(shown_));
+      x1_ = 0;
+      x2_ = WIDTH;
+      page1_ = 0;
+      page2_ = PAGES - 1;
+#ifndef OLED_FULL_FRAME_UPDATES
+    } else if (!Display<WIDTH, col_t>::UpdateDamage(shown_, &x1_, &x2_, &page1_, &page2_)) {
+      return false;
+#else
+    } else {
+      memcpy(shown_, Display<WIDTH, col_t>::frame_buffer_, sizeof(shown_));
+#endif
+    }
+    address_commands_[0] = COLUMNADDR;
+    address_commands_[1] = x1_ + (128 - WIDTH)/2;   // Column start address (0 = reset)
+    address_commands_[2] = x2_ - 1 + (128 - WIDTH)/2; // Column end address (127 = reset)
+    address_commands_[3] = PAGEADDR;
+    address_commands_[4] = page1_;  // Page start address (0 = reset)
+    address_commands_[5] = page2_;
+    update_bytes_ = (x2_ - x1_) * (page2_ - page1_ + 1);
+    bytes_sent_ += update_bytes_;
+    updates_++;
+    return true;
   }
 
   int FillFrameBuffer() {
@@ -988,7 +1034,13 @@ public:
   void SB_Top() override {
     STDOUT.print("display fps: ");
     loop_counter_.Print();
+    STDOUT << " updates: " << updates_;
+    if (updates_) {
+      STDOUT << " avg bytes/update: " << (bytes_sent_ / updates_);
+    }
     STDOUT.println("");
+    updates_ = 0;
+    bytes_sent_ = 0;
   }
 
   Screen GetScreen() override {
@@ -1077,6 +1129,7 @@ public:
       Send(DISPLAYON);                     //--turn on oled panel
 
       I2CUnlock();
+      full_update_ = true;
 
       STDOUT.println("Display initialized.");
 
@@ -1096,35 +1149,37 @@ public:
 
         // I2C
         loop_counter_.Update();
+        if (!PrepareUpdate()) {
+          // Nothing changed, leave the bus to the other devices.
+          lock_fb_ = false;
+        } else {
 #ifdef PROFFIEBOARD
-        i = -(int)NELEM(transactions);
-        while (!I2CLockAndRun()) YIELD();
-        while (lock_fb_) YIELD();
+          i = -(int)NELEM(address_commands_);
+          while (!I2CLockAndRun()) YIELD();
+          while (lock_fb_) YIELD();
 #else
-        do { YIELD(); } while (!I2CLock());
-        Send(COLUMNADDR);
-        Send((128 - WIDTH)/2);   // Column start address (0 = reset)
-        Send(WIDTH-1 + (128 - WIDTH)/2); // Column end address (127 = reset)
-
-        Send(PAGEADDR);
-        Send(0); // Page start address (0 = reset)
-        Send(sizeof(col_t) - 1);
-
-        //STDOUT.println(TWSR & 0x3, DEC);
-
-        for (i=0; i < WIDTH * HEIGHT / 8; ) {
-          // send a bunch of data in one xmission
-          Wire.beginTransmission(address_);
-          GetChunk();
-          for (size_t x=0; x <= chunk_size; x++) {
-            Wire.write(chunk[x]);
+          do { YIELD(); } while (!I2CLock());
+          for (size_t x = 0; x < NELEM(address_commands_); x++) {
+            Send(address_commands_[x]);
           }
-          Wire.endTransmission();
-          I2CUnlock(); do { YIELD(); } while (!I2CLock());
-        }
-        lock_fb_ = false;
-        I2CUnlock();
+
+          //STDOUT.println(TWSR & 0x3, DEC);
+
+          for (i=0; i < update_bytes_; ) {
+            // send a bunch of data in one xmission
+            Wire.beginTransmission(address_);
+            size_t size = GetChunk();
+            for (size_t x=0; x < size; x++) {
+              Wire.write(chunk[x]);
+            }
+            Wire.endTransmission();
+            i += size - 1;
+            I2CUnlock(); do { YIELD(); } while (!I2CLock());
+          }
+          lock_fb_ = false;
+          I2CUnlock();
 #endif
+        }
         while (millis() - frame_start_time_ < millis_to_display_) {
           if (next_millis_to_display_ == 0) {
             next_millis_to_display_ = FillFrameBuffer();
@@ -1153,25 +1208,16 @@ public:
   }
 
 #ifdef PROFFIEBOARD
-  static constexpr uint8_t transactions[] = {
-    COLUMNADDR,
-    (128 - WIDTH)/2,   // Column start address (0 = reset)
-    WIDTH-1 + (128 - WIDTH)/2, // Column end address (127 = reset)
-    PAGEADDR,
-    0,  // Page start address (0 = reset)
-    sizeof(col_t) - 1
-  };
   void RunLocked() override {
     size_t size;
     if (i < 0) {
       chunk[0] = 0;
-      chunk[1] = transactions[NELEM(transactions)+i];
+      chunk[1] = address_commands_[NELEM(address_commands_)+i];
       i++;
       size = 2;
     } else {
-      GetChunk();
-      size = chunk_size + 1;
-      i += chunk_size;
+      size = GetChunk();
+      i += size - 1;
     }
     if (!stm32l4_i2c_notify(Wire._i2c, &SSD1306Template::DataSent, this, (I2C_EVENT_ADDRESS_NACK | I2C_EVENT_DATA_NACK | I2C_EVENT_ARBITRATION_LOST | I2C_EVENT_BUS_ERROR | I2C_EVENT_OVERRUN | I2C_EVENT_RECEIVE_DONE | I2C_EVENT_TRANSMIT_DONE | I2C_EVENT_TRANSFER_DONE))) {
       goto fail;
@@ -1181,6 +1227,8 @@ public:
     }
     return;
   fail:
+    // We don't know what made it to the display.
+    full_update_ = true;
     lock_fb_ = false;
     I2CUnlock();
     return;
@@ -1189,7 +1237,7 @@ public:
   void DataSent() {
     stm32l4_i2c_notify(Wire._i2c, nullptr, 0, 0);
     I2CUnlock();
-    if (i < WIDTH * HEIGHT / 8) {
+    if (i < update_bytes_) {
       I2CLockAndRun();
     } else {
       lock_fb_ = false;
@@ -1207,12 +1255,18 @@ private:
   LoopCounter loop_counter_;
   POWER_PIN power_;
   bool on_ = false;
-};
 
-#ifdef PROFFIEBOARD
-template<int WIDTH, class col_t, class POWER_PIN>
-constexpr uint8_t SSD1306Template<WIDTH, col_t, POWER_PIN>::transactions[];
-#endif
+  // What the display is currently showing.
+  col_t shown_[WIDTH];
+  bool full_update_ = true;
+  // Area being sent.
+  int x1_, x2_, page1_, page2_;
+  int update_bytes_ = 0;
+  uint8_t address_commands_[6];
+  // Stats for SB_Top
+  uint32_t updates_ = 0;
+  uint32_t bytes_sent_ = 0;
+};
 
 using SSD1306 = SSD1306Template<128, uint32_t>;
 
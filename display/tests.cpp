@@ -166,7 +166,288 @@ void PatternTest3() {
   PatternTest2<WIDTH, uint64_t>();
 }
 
+template<int WIDTH, class col_t>
+void DamageTest() {
+  MonoFrame<WIDTH, col_t> frame;
+  col_t shown[WIDTH];
+  int x1, x2, page1, page2;
+  frame.Clear();
+  memset(shown, 0, sizeof(shown));
+  assert(!frame.UpdateDamage(shown, &x1, &x2, &page1, &page2));
+
+  frame.SetPixel(3, 9);
+  frame.SetPixel(WIDTH - 2, 1);
+  assert(frame.UpdateDamage(shown, &x1, &x2, &page1, &page2));
+  assert(x1 == 3 && x2 == WIDTH - 1);
+  assert(page1 == 0 && page2 == 1);
+  assert(!memcmp(shown, frame.frame_buffer_, sizeof(shown)));
+  assert(!frame.UpdateDamage(shown, &x1, &x2, &page1, &page2));
+
+  frame.ClearRect(0, WIDTH, 8, 16);
+  assert(frame.UpdateDamage(shown, &x1, &x2, &page1, &page2));
+  assert(x1 == 3 && x2 == 4);
+  assert(page1 == 1 && page2 == 1);
+
+  frame.SetPixel(10, sizeof(col_t) * 8 - 1);
+  assert(frame.UpdateDamage(shown, &x1, &x2, &page1, &page2));
+  assert(x1 == 10 && x2 == 11);
+  assert(page1 == (int)sizeof(col_t) - 1 && page2 == page1);
+}
+
+// Minimal environment for running RGB565Frame on the host,
+// with files served from memory.
+#define ENABLE_PQOI_DELTA_FRAMES
+#define PROFFIE_TEST
+#define TRACE(CAT, X) do { } while(0)
+#define TRACE2(CAT, X, Y) do { } while(0)
+#define PROFFIEOS_ASSERT(X) assert(X)
+#define noInterrupts() do { } while(0)
+#define interrupts() do { } while(0)
+#define POLYHOLE static_assert(true, "")
+
+#include <map>
+#include <string>
+#include <vector>
+#include "../common/state_machine.h"
+#include "../common/circular_buffer.h"
+#include "../common/cpu_governor.h"
+
+uint32_t micros_ = 0;
+uint32_t micros() { return micros_; }
+uint32_t millis() { return micros_ / 1000; }
+int random(int x) { return rand() % x; }
+int32_t clampi32(int32_t x, int32_t a, int32_t b) { return std::min(std::max(x, a), b); }
+template<class A, class B> A min(A a, B b) { return a < b ? a : b; }
+void MountSDCard() {}
+
+struct NullStream {
+  template<class T> NullStream& operator<<(const T&) { return *this; }
+  template<class T> void print(const T&) {}
+  template<class T> void println(const T&) {}
+};
+NullStream STDOUT, STDERR, PVLOG_VERBOSE;
+
+#include "../common/loop_counter.h"
+
+struct SaberBase {
+  enum LockupType { LOCKUP_NONE, LOCKUP_NORMAL, LOCKUP_DRAG, LOCKUP_MELT };
+  static bool IsOn() { return false; }
+  static LockupType Lockup() { return LOCKUP_NONE; }
+};
+
+struct VariableSource {
+  virtual int percent() = 0;
+};
+
+class LayerControl {
+public:
+  virtual void LC_setVariable(int variable, VariableSource* variable_source) = 0;
+  virtual const char* LC_get_filename() = 0;
+  virtual const void LC_restart() = 0;
+  virtual void LC_play(const char* filename) = 0;
+  virtual void LC_set_time(uint32_t millis) = 0;
+  virtual void LC_set_opacity(int percent) = 0;
+};
+
+template<int W, int H>
+class SizedLayeredScreenControl {
+public:
+  virtual LayerControl* getLayer(int layer) = 0;
+  virtual void SB_Top() = 0;
+};
+
+std::map<std::string, std::vector<uint8_t>> test_files;
+
+struct TestFile {
+  std::string name;
+  void PlayInternal(const char* filename) { name = filename; }
+  const char* GetFilename() { return name.c_str(); }
+  void do_open() {}
+  bool get_do_open() { return false; }
+  const std::vector<uint8_t>& data() { return test_files[name]; }
+};
+
+// Same interface as the one in layer_controller.h, but reads synchronously.
+class BufferedFileReader {
+public:
+  int seeks_ = 0;
+protected:
+  void SEEK(uint32_t pos, bool loop = false) {
+    seeks_++;
+    seek_pos_ = pos;
+    input_buffer_.clear();
+  }
+  uint32_t TELL() { return seek_pos_ + input_buffer_.pos(); }
+  bool ATEOF() { return TELL() == file_.data().size(); }
+  void scheduleFillBuffer() {
+    const std::vector<uint8_t>& data = file_.data();
+    size_t pos = TELL() + input_buffer_.size();
+    while (pos < data.size() && input_buffer_.continuous_space()) {
+      size_t n = std::min(input_buffer_.continuous_space(), data.size() - pos);
+      memcpy(input_buffer_.space(), data.data() + pos, n);
+      input_buffer_.push(n);
+      pos += n;
+    }
+  }
+  uint32_t seek_pos_ = 0;
+  CircularBuffer<uint8_t, 1024> input_buffer_;
+  TestFile file_;
+};
+
+#include "rgb565frame.h"
+
+// Records every rendered frame, rows are sent as soon as they are done.
+template<int WIDTH, int HEIGHT>
+class TestDisplay : public RGB565Frame<WIDTH, HEIGHT, 2> {
+public:
+  void initDisplay() override {}
+  void enableDisplay() override {}
+  void enableBacklight() override {}
+  void disableDisplay() override {}
+  void fixByteOrder() override {
+    memcpy(screen_ + this->current_output_buffer_->rownum * WIDTH,
+	   this->current_output_buffer_->chunk.begin(), WIDTH * 2);
+  }
+  void startTransfer() override { this->output_buffers_.pop(1); }
+  void swapBuffers() override {}
+
+  uint32_t frame_num() const { return this->frame_num_; }
+  uint16_t screen_[WIDTH * HEIGHT];
+};
+
+typedef PQOI::EasyPqoiEncoder::RGB565Data RGB565Data;
+
+void AddChunk(std::vector<uint8_t>* file, const char* magic, uint32_t a, uint32_t b) {
+  uint32_t header[4] = { 0, 8, a, b };
+  memcpy(header, magic, 4);
+  file->insert(file->end(), (uint8_t*)header, (uint8_t*)(header + 4));
+}
+
+// Frame |f| of a box moving over a gradient, so that only some tiles change.
+RGB565Data MakeTestFrame(int w, int h, int f, int alpha) {
+  std::vector<uint8_t> rgba;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      bool box = x >= f * 5 && x < f * 5 + 12 && y >= 10 && y < 22;
+      rgba.push_back(box ? 255 : 0);
+      rgba.push_back(x * 255 / w);
+      rgba.push_back(box ? 0 : y * 255 / h);
+      if (alpha >= 0) rgba.push_back(alpha);
+    }
+  }
+  PQOI::EasyPqoiEncoder encoder;
+  return encoder.quantize(rgba.data(), w, h, alpha >= 0 ? 4 : 3);
+}
+
+template<class T>
+T* CheckedAlloc() {
+  static T ret;
+  return &ret;
+}
+
+// Runs frame_loop() until the next frame has been rendered.
+// Returns false if the base layer stopped instead.
+template<class DISPLAY>
+bool RenderFrame(DISPLAY* display) {
+  uint32_t frame = display->frame_num();
+  for (int i = 0; display->frame_num() == frame; i++) {
+    assert(i < 100000);
+    if (!display->layers[0].is_playing()) return false;
+    display->frame_loop();
+    micros_ += 100;
+  }
+  return true;
+}
+
+// Returns which of |frames| is on the screen, or -1.
+template<class DISPLAY>
+int FindFrame(DISPLAY* display, const std::vector<RGB565Data>& frames) {
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (!memcmp(display->screen_, frames[i].pixels.data(), frames[i].pixels.size() * 2)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void DeltaFrameTest() {
+  const int W = 64, H = 40, FRAMES = 8;
+  PQOI::EasyPqoiEncoder encoder;
+  std::vector<RGB565Data> frames;
+  std::vector<uint8_t>& base = test_files["base.pqf"];
+  AddChunk(&base, "PQVF", 10, 1);
+  int deltas = 0;
+  for (int f = 0; f < FRAMES; f++) {
+    frames.push_back(MakeTestFrame(W, H, f, -1));
+    std::vector<uint8_t> image = f ? encoder.encodeDelta(frames[f], frames[f - 1]) : encoder.encode(frames[f]);
+    if (!memcmp(image.data(), "PQOD", 4)) deltas++;
+    base.insert(base.end(), image.begin(), image.end());
+  }
+  assert(deltas == FRAMES - 1);
+
+  // A transparent layer at 40 fps makes the base layer repeat each frame four times.
+  std::vector<uint8_t>& overlay = test_files["overlay.pqf"];
+  AddChunk(&overlay, "PQVF", 40, 1);
+  for (int f = 0; f < FRAMES * 4; f++) {
+    std::vector<uint8_t> image = encoder.encode(MakeTestFrame(W, H, f, 0));
+    assert(!memcmp(image.data(), "PQOA", 4));
+    overlay.insert(overlay.end(), image.begin(), image.end());
+  }
+
+  TestDisplay<W, H>* display = CheckedAlloc<TestDisplay<W, H>>();
+  display->getLayer(0)->LC_play("base.pqf");
+  display->getLayer(1)->LC_play("overlay.pqf");
+  int last = 0, shown = 0;
+  while (true) {
+    int seeks = display->layers[0].seeks_;
+    if (!RenderFrame(display)) break;
+    int f = FindFrame(display, frames);
+    if (f == -1 || f < last || f > last + 1) {
+      fprintf(stderr, "Delta frame test: wrong frame %d after %d\n", f, last);
+      exit(1);
+    }
+    if (f == last && shown) {
+      // Repeated frames come from the frame buffer, not the file.
+      assert(display->layers[0].seeks_ == seeks);
+    }
+    last = f;
+    shown++;
+  }
+  assert(last == FRAMES - 1);
+  assert(shown >= FRAMES * 3);
+
+  // A file that starts with a delta frame. The delta frame must be
+  // skipped, not applied to whatever is in the frame buffer.
+  std::vector<uint8_t>& next = test_files["next.pqf"];
+  RGB565Data next_frame = MakeTestFrame(W, H, 20, -1);
+  AddChunk(&next, "PQVF", 10, 1);
+  std::vector<uint8_t> image = encoder.encodeDelta(next_frame, MakeTestFrame(W, H, 21, -1));
+  assert(!memcmp(image.data(), "PQOD", 4));
+  next.insert(next.end(), image.begin(), image.end());
+  image = encoder.encode(next_frame);
+  next.insert(next.end(), image.begin(), image.end());
+
+  // After the base layer stopped.
+  display->getLayer(0)->LC_play("next.pqf");
+  assert(RenderFrame(display));
+  assert(!memcmp(display->screen_, next_frame.pixels.data(), W * H * 2));
+  while (RenderFrame(display));
+
+  // While the base layer is playing.
+  display->getLayer(0)->LC_play("base.pqf");
+  display->getLayer(1)->LC_play("overlay.pqf");
+  for (int i = 0; i < 6; i++) assert(RenderFrame(display));
+  assert(FindFrame(display, frames) == 1);
+  display->getLayer(0)->LC_play("next.pqf");
+  assert(RenderFrame(display));
+  assert(!memcmp(display->screen_, next_frame.pixels.data(), W * H * 2));
+}
+
 int main() {
+  DeltaFrameTest();
+  DamageTest<128, uint16_t>();
+  DamageTest<128, uint32_t>();
+  DamageTest<64, uint64_t>();
   PatternTest3<64>();
   PatternTest3<128>();
   PatternTest3<128+64>();
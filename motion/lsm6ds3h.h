@@ -288,6 +288,7 @@ public:
   }
 
   void RunLocked() override {
+    SCOPED_PROFILE_FRAME("motion");
     ScopedCycleCounter cc(motion_interrupt_cycles);
     TRACE(MOTION, "RunLocked");
     // All chunks are full
@@ -315,6 +316,7 @@ public:
   }
 
   static void DataReceived(void *context, uint32_t event) {
+    SCOPED_PROFILE_FRAME("motion");
     ScopedCycleCounter cc(motion_interrupt_cycles);
     ((LSM6DS3H*)context)->DataReceived2();
   }
@@ -11,6 +11,23 @@
 
 int main(int argc, char **argv) {
   Pqoiml pqoiml;
+  while (argc > 1) {
+    if (!strcmp(argv[1], "--delta")) {
+      pqoiml.delta_frames = true;
+    } else if (!strcmp(argv[1], "-j") && argc > 2) {
+      pqoiml.threads = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "Usage: cpqoi [--delta] [-j THREADS] FILE [SCALING COMMANDS]\n");
+    exit(1);
+  }
   std::string filename(argv[1]);
   std::string scaling_commands;
   if (argc > 2) {
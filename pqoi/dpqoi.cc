@@ -53,6 +53,7 @@ std::string format_condition(uint32_t x) {
 int main(int argc, char **argv) {
   int image_number = 0;
   Pqoiml pqoiml;
+  PQOI::EasyPqoiEncoder::RGB565Data previous;
   FILE* f = fopen(argv[1], "rb");
   if (!f) {
     perror("open file");
@@ -83,6 +84,7 @@ int main(int argc, char **argv) {
 	break;
 
       case fourcc("PQOA"): alpha = true;
+      case fourcc("PQOD"):
       case fourcc("PQOI"): {
 	std::vector<uint8_t> indata(header.length + 8);
 	memcpy(indata.data(), &header, sizeof(header));
@@ -90,7 +92,8 @@ int main(int argc, char **argv) {
 	  fprintf(stderr, "Failed to read image data.");
 	}
 	PQOI::EasyPqoiEncoder decoder;
-	PQOI::EasyPqoiEncoder::RGB565Data data = decoder.decode(indata);
+	PQOI::EasyPqoiEncoder::RGB565Data data = decoder.decode(indata, &previous);
+	previous = data;
 	int channels = alpha ? 4 : 3;
 	int total_bytes = data.w * data.h * channels;
 	std::vector<uint8_t> rgba(total_bytes);
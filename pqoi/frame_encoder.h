@@ -0,0 +1,107 @@
+#ifndef FRAME_ENCODER_H
+#define FRAME_ENCODER_H
+
+#include <unistd.h>
+#include <vector>
+
+#include "../videotoblc/thread_helper.h"
+#include "pqoi.h"
+
+// Encodes video frames on all cores.
+// Frames are collected in batches, each frame in the batch is a task,
+// and the results are stored by frame number, so the output does not
+// depend on how many threads are used, or in what order they finish.
+// Delta frames need the quantized previous frame, so the whole batch
+// is quantized first, then encoded.
+class FrameEncoder : public ThreaderBase {
+public:
+  typedef PQOI::EasyPqoiEncoder::RGB565Data RGB565Data;
+
+  explicit FrameEncoder(bool delta_frames) : delta_frames_(delta_frames) {
+    set_threads(sysconf(_SC_NPROCESSORS_ONLN));
+  }
+
+  // |pixels| is taken over, and left empty.
+  void AddFrame(std::vector<uint8_t>& pixels, int w, int h, int channels) {
+    frames_.resize(frames_.size() + 1);
+    Frame& frame = frames_.back();
+    frame.pixels.swap(pixels);
+    frame.w = w;
+    frame.h = h;
+    frame.channels = channels;
+  }
+
+  // Enough frames to keep all threads busy.
+  bool full() const { return frames_.size() >= (size_t)threads() * 4; }
+
+  // Encodes the frames added since the last Flush() and calls
+  // output(const std::vector<uint8_t>&) for each one, in order.
+  // The first frame after construction is always a key frame.
+  template<class OUTPUT>
+  void Flush(OUTPUT output) {
+    if (frames_.empty()) return;
+    step_ = QUANTIZE;
+    RunTasks();
+    step_ = ENCODE;
+    RunTasks();
+    for (const Frame& frame : frames_) output(frame.encoded);
+    previous_ = std::move(frames_.back().quantized);
+    has_previous_ = true;
+    frames_.clear();
+  }
+
+  void Worker() override {
+    while (true) {
+      mutex_.Lock();
+      size_t task = next_task_++;
+      mutex_.Unlock();
+      if (task >= frames_.size()) return;
+      DoTask(task);
+    }
+  }
+
+private:
+  struct Frame {
+    std::vector<uint8_t> pixels;
+    int w, h, channels;
+    RGB565Data quantized;
+    std::vector<uint8_t> encoded;
+  };
+
+  enum Step { QUANTIZE, ENCODE };
+
+  void RunTasks() {
+    next_task_ = 0;
+    Run();
+  }
+
+  void DoTask(size_t task) {
+    Frame& frame = frames_[task];
+    PQOI::EasyPqoiEncoder encoder;
+    if (step_ == QUANTIZE) {
+      frame.quantized = encoder.quantize(frame.pixels.data(), frame.w, frame.h, frame.channels);
+      std::vector<uint8_t>().swap(frame.pixels);
+      return;
+    }
+    const RGB565Data* previous = nullptr;
+    if (task) {
+      previous = &frames_[task - 1].quantized;
+    } else if (has_previous_) {
+      previous = &previous_;
+    }
+    if (delta_frames_ && previous) {
+      frame.encoded = encoder.encodeDelta(frame.quantized, *previous);
+    } else {
+      frame.encoded = encoder.encode(frame.quantized);
+    }
+  }
+
+  bool delta_frames_;
+  Step step_ = QUANTIZE;
+  size_t next_task_ = 0;
+  std::vector<Frame> frames_;
+  RGB565Data previous_;
+  bool has_previous_ = false;
+};
+
+#endif
@@ -26,8 +26,49 @@
 // Image files are stored with a simple header:
 // PQOIXXXXYYYY (XXXX = width, YYYY = height, both as little-endian uint32_t)
 
+// Delta frames (PQOD) only contain the 8x8 tiles that changed since the
+// previous frame. Before every 8th row there is a bitmask of changed
+// tiles for the next 8 rows (one bit per tile, least significant bit
+// first). Each row is then encoded as above, but only the pixels in
+// changed tiles are included, and ops never cross the end of a row.
+
 namespace PQOI {
 
+static const int DELTA_TILE_SIZE = 8;
+
+inline int DeltaTiles(int width) { return (width + DELTA_TILE_SIZE - 1) / DELTA_TILE_SIZE; }
+inline int DeltaMaskBytes(int width) { return (DeltaTiles(width) + 7) / 8; }
+
+// Number of pixels in the changed tiles of one row.
+inline int DeltaChangedPixels(const uint8_t* mask, int width) {
+  int ret = 0;
+  for (int t = 0; t < DeltaTiles(width); t++) {
+    if (mask[t / 8] & (1 << (t & 7))) {
+      ret += std::min<int>(DELTA_TILE_SIZE, width - t * DELTA_TILE_SIZE);
+    }
+  }
+  return ret;
+}
+
+// |row| starts with the decoded pixels of the changed tiles, packed
+// together. Spreads them out to their tile positions and fills in the
+// unchanged tiles from |previous|. Works backwards, so it can be done
+// in place.
+inline void DeltaExpandRow(uint16_t* row, const uint16_t* previous,
+			   const uint8_t* mask, int width) {
+  int src = DeltaChangedPixels(mask, width);
+  for (int t = DeltaTiles(width) - 1; t >= 0; t--) {
+    int x = t * DELTA_TILE_SIZE;
+    int w = std::min<int>(DELTA_TILE_SIZE, width - x);
+    if (mask[t / 8] & (1 << (t & 7))) {
+      src -= w;
+      memmove(row + x, row + src, w * 2);
+    } else {
+      memcpy(row + x, previous + x, w * 2);
+    }
+  }
+}
+
 class PqoiBase {
 public:
   uint16_t stash_[64];
@@ -46,6 +87,40 @@ public:
     int bd = bd_bits + ld;
     return (rd << 11) + (gd << 5) + bd;
   }
+
+  // Bulk versions of the run and copy ops.
+  // These write exactly the pixels the op covers, in as few memory
+  // operations as possible. Unaligned word access is fine on all
+  // supported CPUs, and memcpy() of a constant size compiles into
+  // plain loads and stores.
+  static uint16_t* fillRun(uint16_t* out, uint16_t pixel, int N) {
+    uint16_t* end = out + N;
+    if ((uintptr_t)out & 2) *(out++) = pixel;
+    uint32_t two = pixel * 0x10001U;
+    uint64_t four = two * 0x100000001ULL;
+    for (; out + 4 <= end; out += 4) memcpy(out, &four, 8);
+    if (out + 2 <= end) {
+      memcpy(out, &two, 4);
+      out += 2;
+    }
+    if (out < end) *(out++) = pixel;
+    return out;
+  }
+  static uint16_t* copy2(uint16_t* out) {
+    memcpy(out, out - 2, 4);
+    return out + 2;
+  }
+  static uint16_t* copy4(uint16_t* out) {
+    memcpy(out, out - 4, 8);
+    return out + 4;
+  }
+  static uint16_t* copy4x2(uint16_t* out) {
+    uint64_t tmp;
+    memcpy(&tmp, out - 4, 8);
+    memcpy(out, &tmp, 8);
+    memcpy(out + 4, &tmp, 8);
+    return out + 8;
+  }
 public:
   void reset() {
     memset(stash_, 0, sizeof(stash_));
@@ -74,61 +149,16 @@ uint16_t const PqoiBase::deltas[125] = { PQOI_DELTA3(0) };
 	  pixel_ += deltas[byte];				\
 	  break;						\
         case 125: /* copy 2 */					\
-	  out[0] = out[-2];					\
-	  out[1] = out[-1];					\
-	  out += 2;						\
+	  out = copy2(out);					\
 	  continue;						\
         case 126: /* copy 4 */					\
-	  out[0] = out[-4];					\
-	  out[1] = out[-3];					\
-	  out[2] = out[-2];					\
-	  out[3] = out[-1];					\
-	  out += 4;						\
+	  out = copy4(out);					\
 	  continue;						\
         case 127: /* copy 4x2 */				\
-	  out[0] = out[-4];					\
-	  out[1] = out[-3];					\
-	  out[2] = out[-2];					\
-	  out[3] = out[-1];					\
-	  out[4] = out[-4];					\
-	  out[5] = out[-3];					\
-	  out[6] = out[-2];					\
-	  out[7] = out[-1];					\
-	  out += 8;						\
+	  out = copy4x2(out);					\
 	  continue;						\
-	case 159: *(out++) = pixel_;				\
-	case 158: *(out++) = pixel_;				\
-	case 157: *(out++) = pixel_;				\
-	case 156: *(out++) = pixel_;				\
-	case 155: *(out++) = pixel_;				\
-	case 154: *(out++) = pixel_;				\
-	case 153: *(out++) = pixel_;				\
-	case 152: *(out++) = pixel_;				\
-	case 151: *(out++) = pixel_;				\
-	case 150: *(out++) = pixel_;				\
-	case 149: *(out++) = pixel_;				\
-	case 148: *(out++) = pixel_;				\
-	case 147: *(out++) = pixel_;				\
-	case 146: *(out++) = pixel_;				\
-	case 145: *(out++) = pixel_;				\
-	case 144: *(out++) = pixel_;				\
-	case 143: *(out++) = pixel_;				\
-	case 142: *(out++) = pixel_;				\
-	case 141: *(out++) = pixel_;				\
-	case 140: *(out++) = pixel_;				\
-	case 139: *(out++) = pixel_;				\
-	case 138: *(out++) = pixel_;				\
-	case 137: *(out++) = pixel_;				\
-	case 136: *(out++) = pixel_;				\
-	case 135: *(out++) = pixel_;				\
-	case 134: *(out++) = pixel_;				\
-	case 133: *(out++) = pixel_;				\
-	case 132: *(out++) = pixel_;				\
-	case 131: *(out++) = pixel_;				\
-	case 130: *(out++) = pixel_;				\
-	case 129: *(out++) = pixel_;				\
-	case 128: *(out++) = pixel_;				\
-	  *(out++) = pixel_;                                    \
+	case 128 ... 159:					\
+	  out = fillRun(out, pixel_, byte - 126);		\
 	  continue;						\
 	case 160 ... 191: {					\
 	  int gd_bits = byte - 160;				\
@@ -420,10 +450,15 @@ public:
   static void alphaBlend(uint16_t& out, uint16_t in, uint8_t alpha) {
     // This transform should already have been done on the alpha values.
     // alpha = ((255 - alpha) * 33) >> 8;
-    uint32_t tmp = (out * 0x10001) & 0x7E0F81F;
-    tmp = ((tmp * alpha) >> 5) & 0x7EF81F;
+    uint32_t tmp = (out * 0x10001U) & 0x7E0F81F;
+    tmp = ((tmp * alpha) >> 5) & 0x7E0F81F;
     out = tmp + (tmp >> 16) + in;
   }
+
+  // Multiply N pixels by alpha / 32.
+  static void scaleRun(uint16_t* pixels, int N, uint8_t alpha) {
+    for (int i = 0; i < N; i++) alphaBlend(pixels[i], 0, alpha);
+  }
   void Apply(const uint8_t* in, const uint8_t* input_end, uint16_t* out, uint16_t* end) {
     while (out < end) {
       uint8_t byte = *(in++);
@@ -493,8 +528,19 @@ class StreamingAlphaDecoder : public PqoiStreamingDecoder {
   uint8_t byte;
   int N, i;
   int state_ = 0;
+  // 32 = fully visible, 0 = invisible
+  uint8_t opacity_ = 32;
 #define PQOI_ALPHA_YIELD() do { state_ = __LINE__; return out; case __LINE__: break; } while(0)
 public:
+  void set_opacity(uint8_t opacity) { opacity_ = std::min<uint8_t>(opacity, 32); }
+  uint8_t opacity() const { return opacity_; }
+
+  // Alpha to use when the layer is drawn with opacity_.
+  // Rounds towards transparent so that the blended result cannot overflow.
+  uint8_t layerAlpha(uint8_t alpha) const {
+    return 32 - (((32 - alpha) * opacity_ + 31) >> 5);
+  }
+
   // Decode alpha until out >= end, or input runs out.
   uint16_t* Apply(uint16_t* out, uint16_t* end) {
     switch (state_) {
@@ -505,7 +551,7 @@ public:
 	N = (byte & 0x3F) + 1;
 	if ((byte >> 6) == 0) {
 	  // Do nothing.
-	} else if ((byte >> 6) == 3) {
+	} else if ((byte >> 6) == 3 && opacity_ == 32) {
 	  // Read directly into output space.
 	  read_until = out + N;
 	  while (true) {
@@ -514,7 +560,7 @@ public:
 	    PQOI_ALPHA_YIELD();
 	  }
 	  continue;
-	} else { // 1 or 2
+	} else { // 1, 2 or 3 with opacity
 	  // Read into temporary space and alpha-blend.
 	  read_until = tmp + N;
 	  read_pos = tmp;
@@ -523,14 +569,25 @@ public:
 	    if (read_pos >= read_until) break;
 	    PQOI_ALPHA_YIELD();
 	  }
+	  if (opacity_ < 32) AlphaDecoder::scaleRun(tmp, N, opacity_);
 	  if ((byte >> 6) == 1) {
-	    for (i = 0; i < N; i++) {
-	      while (input_done()) PQOI_ALPHA_YIELD();
-	      AlphaDecoder::alphaBlend(out[i], tmp[i], *(in++));
+	    if (opacity_ == 32) {
+	      for (i = 0; i < N; i++) {
+		while (input_done()) PQOI_ALPHA_YIELD();
+		AlphaDecoder::alphaBlend(out[i], tmp[i], *(in++));
+	      }
+	    } else {
+	      for (i = 0; i < N; i++) {
+		while (input_done()) PQOI_ALPHA_YIELD();
+		AlphaDecoder::alphaBlend(out[i], tmp[i], layerAlpha(*(in++)));
+	      }
 	    }
-	  } else { // 2
+	  } else if ((byte >> 6) == 2) {
 	    while (input_done()) PQOI_ALPHA_YIELD();
-	    uint8_t alpha = *(in++);
+	    uint8_t alpha = layerAlpha(*(in++));
+	    for (i = 0; i < N; i++) AlphaDecoder::alphaBlend(out[i], tmp[i], alpha);
+	  } else { // 3
+	    uint8_t alpha = layerAlpha(0);
 	    for (i = 0; i < N; i++) AlphaDecoder::alphaBlend(out[i], tmp[i], alpha);
 	  }
 	}
@@ -738,6 +795,47 @@ public:
       AddNumber(b, out + 12);
     }
     
+    // Encodes the tiles that differ from |previous|. Returns a regular
+    // PQOI image if that is smaller, or if a delta frame is not possible.
+    std::vector<uint8_t> encodeDelta(const RGB565Data& data, const RGB565Data& previous) {
+      std::vector<uint8_t> key = encode(data);
+      if (data.alphas.size() || previous.alphas.size() ||
+	  data.w != previous.w || data.h != previous.h) {
+	return key;
+      }
+      std::vector<uint8_t> ret(data.w * data.h * 3 + data.h * DeltaMaskBytes(data.w) + 16);
+      uint8_t* end = ret.data() + 16;
+      PqoiEncoder encoder;
+      std::vector<uint8_t> mask(DeltaMaskBytes(data.w));
+      std::vector<uint16_t> changed;
+      for (int y = 0; y < data.h; y++) {
+	if (y % DELTA_TILE_SIZE == 0) {
+	  std::fill(mask.begin(), mask.end(), 0);
+	  for (int yy = y; yy < std::min(data.h, y + DELTA_TILE_SIZE); yy++) {
+	    for (int x = 0; x < data.w; x++) {
+	      if (data.pixels[yy * data.w + x] != previous.pixels[yy * data.w + x]) {
+		int t = x / DELTA_TILE_SIZE;
+		mask[t / 8] |= 1 << (t & 7);
+	      }
+	    }
+	  }
+	  memcpy(end, mask.data(), mask.size());
+	  end += mask.size();
+	}
+	changed.clear();
+	for (int x = 0; x < data.w; x++) {
+	  int t = x / DELTA_TILE_SIZE;
+	  if (mask[t / 8] & (1 << (t & 7))) changed.push_back(data.pixels[y * data.w + x]);
+	}
+	end = encoder.encodePixels(changed.data(), changed.data() + changed.size(), end);
+      }
+      size_t size = end - ret.data();
+      if (size >= key.size()) return key;
+      ret.resize(size);
+      AddHeader("PQOD", size - 8, data.w, data.h, ret.data());
+      return ret;
+    }
+
     std::vector<uint8_t> encode(const RGB565Data& data) {
       size_t pixels = data.w * data.h;
       std::vector<uint8_t> ret(pixels * 5 + 16);
@@ -776,9 +874,34 @@ public:
     static constexpr uint32_t fourcc(char const p[5] ) {
       return onecc(p[0], 0) + onecc(p[1], 8) + onecc(p[2], 16) + onecc(p[3], 24);
     }
-    RGB565Data decode(const std::vector<uint8_t>& data) {
+    // |previous| is required for delta frames.
+    RGB565Data decode(const std::vector<uint8_t>& data, const RGB565Data* previous = nullptr) {
       RGB565Data ret;
       switch (get32(data.data())) {
+	case fourcc("PQOD"): {
+	  ret.w = get32(data.data() + 8);
+	  ret.h = get32(data.data() + 12);
+	  if (!previous || previous->w != ret.w || previous->h != ret.h || previous->alphas.size()) {
+	    fprintf(stderr, "Delta frame without a matching previous frame.\n");
+	    ret.w = ret.h = 0;
+	    break;
+	  }
+	  ret.pixels.resize(ret.w * ret.h);
+	  PqoiDecoder decoder;
+	  const uint8_t* in = data.data() + 16;
+	  const uint8_t* mask = in;
+	  for (int y = 0; y < ret.h; y++) {
+	    if (y % DELTA_TILE_SIZE == 0) {
+	      mask = in;
+	      in += DeltaMaskBytes(ret.w);
+	    }
+	    uint16_t* row = ret.pixels.data() + y * ret.w;
+	    int n = DeltaChangedPixels(mask, ret.w);
+	    in = decoder.DecodeBlock(in, data.data() + data.size(), row, row + n);
+	    DeltaExpandRow(row, previous->pixels.data() + y * ret.w, mask, ret.w);
+	  }
+	  break;
+	}
 	case fourcc("PQOI"): {
 	  ret.w = get32(data.data() + 8);
 	  ret.h = get32(data.data() + 12);
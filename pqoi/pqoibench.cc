@@ -0,0 +1,496 @@
+// Benchmarks for the PQOI code used by the color displays.
+//
+// Usage:
+//   pqoibench composite [WxH] [opacity%] base.pqf [overlay.pqf ...]
+//   pqoibench decode file.pqf ...
+//   pqoibench encode [-j threads] [WxH]
+//
+// "composite" renders frames the same way RGB565Frame does: one row at a
+// time, opaque base layer first, then the transparent layers on top.
+// "decode" measures raw decoding throughput.
+// "encode" measures how fast cpqoi can convert video frames, with one
+// thread and with all threads, and checks that the results are identical.
+// Without files, synthetic animations are generated and the benchmarks
+// run at 160x80 and 240x135.
+
+#include "pqoi.h"
+#include "frame_encoder.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+constexpr uint32_t onecc(char c, int shift) {
+  return ((uint32_t)c) << shift;
+}
+constexpr uint32_t fourcc(char const p[5] ) {
+  return onecc(p[0], 0) + onecc(p[1], 8) + onecc(p[2], 16) + onecc(p[3], 24);
+}
+
+uint32_t get32(const uint8_t* t) {
+  return t[0] + (t[1] << 8) + (t[2] << 16) + (t[3] << 24);
+}
+
+typedef std::vector<uint8_t> Image;  // PQOI or PQOA chunk, including header
+
+// Returns all the images in a .pqf file, in file order.
+std::vector<Image> LoadImages(const char* filename) {
+  std::vector<Image> ret;
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    perror(filename);
+    exit(1);
+  }
+  uint8_t header[16];
+  while (fread(header, 1, 16, f) == 16) {
+    uint32_t magic = get32(header);
+    uint32_t length = get32(header + 4);
+    if (magic == fourcc("PQOI") || magic == fourcc("PQOA")) {
+      Image image(length + 8);
+      memcpy(image.data(), header, 16);
+      if (fread(image.data() + 16, 1, length - 8, f) != length - 8) break;
+      ret.push_back(image);
+    } else {
+      fseek(f, length - 8, SEEK_CUR);
+    }
+  }
+  fclose(f);
+  if (ret.empty()) {
+    fprintf(stderr, "%s: no images found\n", filename);
+    exit(1);
+  }
+  return ret;
+}
+
+enum ImageStyle {
+  STYLE_BASE,     // gradients and stripes
+  STYLE_OVERLAY,  // transparent
+  STYLE_FLAT,     // large single color areas, like menus and meters
+  STYLE_PANEL,    // translucent box with opaque bars, like a menu over video
+};
+
+bool HasAlpha(ImageStyle style) {
+  return style == STYLE_OVERLAY || style == STYLE_PANEL;
+}
+
+// One frame of a synthetic animation, RGBA if HasAlpha(style), otherwise RGB.
+std::vector<uint8_t> MakeFrame(int w, int h, ImageStyle style, int f, int frames) {
+  std::vector<uint8_t> rgba;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      if (style == STYLE_BASE) {
+	rgba.push_back((x * 255 / w + f * 8) & 0xff);
+	rgba.push_back(y * 255 / h);
+	rgba.push_back((x + y + f) & 0x80 ? 200 : 40);
+      } else if (style == STYLE_FLAT) {
+	bool bar = y > h / 3 && y < h * 2 / 3 && x < (f + 1) * w / frames;
+	bool frame = x < 2 || y < 2 || x >= w - 2 || y >= h - 2;
+	rgba.push_back(bar ? 0 : frame ? 255 : 16);
+	rgba.push_back(bar ? 200 : frame ? 255 : 16);
+	rgba.push_back(bar ? 255 : frame ? 255 : 64);
+      } else if (style == STYLE_PANEL) {
+	bool panel = x >= w / 8 && x < w * 7 / 8 && y >= h / 8 && y < h * 7 / 8;
+	bool bar = panel && (y / 6) % 3 == 1 && x < w / 4 + (f + y) * w / 2 / frames;
+	rgba.push_back(bar ? 255 : 0);
+	rgba.push_back(bar ? 255 : 32);
+	rgba.push_back(bar ? 255 : 96);
+	rgba.push_back(bar ? 255 : panel ? 160 : 0);
+      } else {
+	// A soft-edged ball moving over a transparent background,
+	// and a solid bar at the bottom.
+	float dx = x - (w / 4 + f * w / 2 / frames);
+	float dy = y - h / 2;
+	float d = sqrtf(dx * dx + dy * dy) / (h / 3);
+	int a = d < 0.8 ? 255 : d < 1.0 ? (int)((1.0 - d) * 5 * 255) : 0;
+	if (y > h * 7 / 8) a = 255;
+	rgba.push_back(255);
+	rgba.push_back(x * 255 / w);
+	rgba.push_back(0);
+	rgba.push_back(a);
+      }
+    }
+  }
+  return rgba;
+}
+
+// Synthetic animations, used when no files are given.
+std::vector<Image> MakeImages(int w, int h, ImageStyle style, int frames,
+			      std::vector<PQOI::EasyPqoiEncoder::RGB565Data>* quantized = nullptr) {
+  PQOI::EasyPqoiEncoder encoder;
+  std::vector<Image> ret;
+  for (int f = 0; f < frames; f++) {
+    std::vector<uint8_t> rgba = MakeFrame(w, h, style, f, frames);
+    PQOI::EasyPqoiEncoder::RGB565Data data =
+      encoder.quantize(rgba.data(), w, h, HasAlpha(style) ? 4 : 3);
+    ret.push_back(encoder.encode(data));
+    if (quantized) quantized->push_back(data);
+  }
+  return ret;
+}
+
+// StreamingAlphaDecoder as it was before layer opacity was added.
+// Used as the baseline. (It uses the
+// fixed alphaBlend(), so that the output can be compared.)
+class LegacyAlphaDecoder : public PQOI::PqoiStreamingDecoder {
+  uint16_t tmp[64];
+  uint16_t *read_pos, *read_until;
+  uint8_t byte;
+  int N, i;
+  int state_ = 0;
+public:
+  // Decode alpha until out >= end, or input runs out.
+  uint16_t* Apply(uint16_t* out, uint16_t* end) {
+    switch (state_) {
+    case 0:
+      while (out < end) {
+	while (input_done()) PQOI_ALPHA_YIELD();
+	byte = *(in++);
+	N = (byte & 0x3F) + 1;
+	if ((byte >> 6) == 0) {
+	  // Do nothing.
+	} else if ((byte >> 6) == 3) {
+	  // Read directly into output space.
+	  read_until = out + N;
+	  while (true) {
+	    out = read(out, read_until);
+	    if (out >= read_until) break;
+	    PQOI_ALPHA_YIELD();
+	  }
+	  continue;
+	} else { // 1 or 2
+	  // Read into temporary space and alpha-blend.
+	  read_until = tmp + N;
+	  read_pos = tmp;
+	  while (true) {
+	    read_pos = read(read_pos, read_until);
+	    if (read_pos >= read_until) break;
+	    PQOI_ALPHA_YIELD();
+	  }
+	  if ((byte >> 6) == 1) {
+	    for (i = 0; i < N; i++) {
+	      while (input_done()) PQOI_ALPHA_YIELD();
+	      PQOI::AlphaDecoder::alphaBlend(out[i], tmp[i], *(in++));
+	    }
+	  } else { // 2
+	    while (input_done()) PQOI_ALPHA_YIELD();
+	    uint8_t alpha = *(in++);
+	    for (i = 0; i < N; i++) PQOI::AlphaDecoder::alphaBlend(out[i], tmp[i], alpha);
+	  }
+	}
+	out += N;
+      }
+    }
+    state_ = 0;
+    return out;
+  }
+};
+
+struct Layer {
+  std::vector<Image> images;
+};
+
+class Compositor {
+public:
+  Compositor(int w, int h) : W(w), H(h), screen_(w * h), base_(w * h + PQOI::PqoiOutputChunk<1>::PAD) {}
+
+  template<class ALPHA_DECODER>
+  void Render(const std::vector<Layer>& layers, int frame, uint8_t opacity) {
+    for (size_t l = 0; l < layers.size(); l++) {
+      const Image& image = layers[l].images[frame % layers[l].images.size()];
+      int w = get32(image.data() + 8);
+      int h = get32(image.data() + 12);
+      int left = (W - w) / 2;
+      int top = (H - h) / 2;
+      if (l == 0) {
+	memset(screen_.data(), 0, screen_.size() * 2);
+	PQOI::PqoiDecoder decoder;
+	decoder.DecodeBlock(image.data() + 16, image.data() + image.size(),
+			    base_.data(), base_.data() + w * h);
+	for (int y = 0; y < h; y++) {
+	  memcpy(screen_.data() + (y + top) * W + left, base_.data() + y * w, w * 2);
+	}
+      } else {
+	ALPHA_DECODER decoder;
+	SetOpacity(&decoder, opacity);
+	decoder.set_input(image.data() + 16, image.data() + image.size());
+	for (int y = 0; y < h; y++) {
+	  uint16_t* row = screen_.data() + (y + top) * W + left;
+	  decoder.Apply(row, row + w);
+	}
+      }
+    }
+  }
+
+  const std::vector<uint16_t>& screen() const { return screen_; }
+
+private:
+  static void SetOpacity(LegacyAlphaDecoder* decoder, uint8_t opacity) {}
+  static void SetOpacity(PQOI::StreamingAlphaDecoder* decoder, uint8_t opacity) {
+    decoder->set_opacity(opacity);
+  }
+
+  int W, H;
+  std::vector<uint16_t> screen_;
+  std::vector<uint16_t> base_;
+};
+
+double Now() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class ALPHA_DECODER>
+double FramesPerSecond(Compositor* compositor, const std::vector<Layer>& layers, uint8_t opacity) {
+  int frames = 0;
+  double start = Now();
+  double elapsed;
+  do {
+    for (int i = 0; i < 100; i++) {
+      compositor->Render<ALPHA_DECODER>(layers, frames++, opacity);
+    }
+    elapsed = Now() - start;
+  } while (elapsed < 0.2);
+  return frames / elapsed;
+}
+
+// Counts how many pixels of the transparent layers are in each kind of run:
+// 0 = transparent, 1 = per-pixel alpha, 2 = shared alpha, 3 = opaque.
+void CountRuns(const std::vector<Layer>& layers, size_t pixels[4]) {
+  for (size_t l = 1; l < layers.size(); l++) {
+    for (const Image& image : layers[l].images) {
+      PQOI::PqoiStreamingDecoder decoder;
+      decoder.set_input(image.data() + 16, image.data() + image.size());
+      uint16_t tmp[64];
+      while (!decoder.input_done()) {
+	uint8_t byte = *(decoder.in++);
+	int N = (byte & 0x3F) + 1;
+	pixels[byte >> 6] += N;
+	if (byte >> 6) decoder.read(tmp, tmp + N);
+	if ((byte >> 6) == 1) decoder.in += N;
+	if ((byte >> 6) == 2) decoder.in++;
+      }
+    }
+  }
+}
+
+void Composite(int w, int h, const std::vector<Layer>& layers, int opacity_percent) {
+  uint8_t opacity = opacity_percent * 32 / 100;
+  Compositor legacy(w, h), current(w, h);
+  if (opacity == 32) {
+    // Make sure the fast path gives the same result.
+    for (size_t f = 0; f < layers[0].images.size() * 2; f++) {
+      legacy.Render<LegacyAlphaDecoder>(layers, f, opacity);
+      current.Render<PQOI::StreamingAlphaDecoder>(layers, f, opacity);
+      if (legacy.screen() != current.screen()) {
+	fprintf(stderr, "Output mismatch in frame %d!\n", (int)f);
+	exit(1);
+      }
+    }
+  }
+  if (opacity < 32) {
+    // The baseline does not support opacity.
+    double after = FramesPerSecond<PQOI::StreamingAlphaDecoder>(&current, layers, opacity);
+    printf("%dx%d, %d layers, opacity %d%%: %.0f fps\n",
+	   w, h, (int)layers.size(), opacity_percent, after);
+    return;
+  }
+  // Alternate between the two and keep the best run of each,
+  // so that clock changes and other processes affect both the same way.
+  double before = 0, after = 0;
+  for (int i = 0; i < 5; i++) {
+    before = std::max(before, FramesPerSecond<LegacyAlphaDecoder>(&legacy, layers, 32));
+    after = std::max(after, FramesPerSecond<PQOI::StreamingAlphaDecoder>(&current, layers, 32));
+  }
+  size_t pixels[4] = { 0, 0, 0, 0 };
+  CountRuns(layers, pixels);
+  size_t total = pixels[0] + pixels[1] + pixels[2] + pixels[3];
+  printf("%dx%d, %d layers, %.0f%% of overlay pixels in shared alpha runs: "
+	 "before opacity %.0f fps, with opacity %.0f fps (%.2fx)\n",
+	 w, h, (int)layers.size(), pixels[2] * 100.0 / total, before, after, after / before);
+}
+
+// Decodes all the (opaque) images over and over, the same way the
+// base layer is decoded.
+void Decode(const char* name, const std::vector<Image>& images) {
+  std::vector<uint16_t> out;
+  size_t bytes = 0, pixels = 0;
+  double start = Now(), elapsed;
+  do {
+    for (const Image& image : images) {
+      if (get32(image.data()) != fourcc("PQOI")) continue;
+      size_t n = get32(image.data() + 8) * get32(image.data() + 12);
+      out.resize(n + PQOI::PqoiOutputChunk<1>::PAD);
+      PQOI::PqoiStreamingDecoder decoder;
+      decoder.set_input(image.data() + 16, image.data() + image.size());
+      decoder.read(out.data(), out.data() + n);
+      bytes += image.size() - 16;
+      pixels += n;
+    }
+    elapsed = Now() - start;
+  } while (elapsed < 1.0 && bytes);
+  if (!bytes) {
+    printf("%s: no opaque images\n", name);
+    return;
+  }
+  printf("%s: %.1f MB/s in, %.1f Mpixel/s out (%.2f bytes/pixel)\n",
+	 name, bytes / elapsed / 1e6, pixels / elapsed / 1e6, (double)bytes / pixels);
+}
+
+// Make sure the decoder returns what the encoder was given.
+void CheckDecode(const std::vector<Image>& images,
+		 const std::vector<PQOI::EasyPqoiEncoder::RGB565Data>& quantized) {
+  PQOI::EasyPqoiEncoder encoder;
+  for (size_t i = 0; i < images.size(); i++) {
+    if (!quantized[i].diff(encoder.decode(images[i]))) {
+      fprintf(stderr, "Decoded image %d does not match!\n", (int)i);
+      exit(1);
+    }
+  }
+}
+
+// Encodes the animation with delta frames, checks that it decodes
+// correctly and compares the size with key frames only.
+void DeltaSize(const char* name, const std::vector<PQOI::EasyPqoiEncoder::RGB565Data>& frames) {
+  PQOI::EasyPqoiEncoder encoder;
+  size_t key_bytes = 0, delta_bytes = 0, deltas = 0;
+  PQOI::EasyPqoiEncoder::RGB565Data previous;
+  for (size_t i = 0; i < frames.size(); i++) {
+    Image key = encoder.encode(frames[i]);
+    Image delta = i ? encoder.encodeDelta(frames[i], frames[i - 1]) : key;
+    if (get32(delta.data()) == fourcc("PQOD")) deltas++;
+    PQOI::EasyPqoiEncoder::RGB565Data decoded = encoder.decode(delta, &previous);
+    if (!frames[i].diff(decoded)) {
+      fprintf(stderr, "Delta frame %d does not match!\n", (int)i);
+      exit(1);
+    }
+    previous = decoded;
+    key_bytes += key.size();
+    delta_bytes += delta.size();
+  }
+  printf("%s: key frames only %d bytes, with %d delta frames %d bytes (%.0f%%)\n",
+	 name, (int)key_bytes, (int)deltas, (int)delta_bytes, delta_bytes * 100.0 / key_bytes);
+}
+
+int DecodeMain(int argc, char** argv) {
+  if (argc > 2) {
+    for (int arg = 2; arg < argc; arg++) Decode(argv[arg], LoadImages(argv[arg]));
+    return 0;
+  }
+  for (auto size : { std::make_pair(160, 80), std::make_pair(240, 135) }) {
+    for (ImageStyle style : { STYLE_BASE, STYLE_FLAT }) {
+      std::vector<PQOI::EasyPqoiEncoder::RGB565Data> quantized;
+      std::vector<Image> images = MakeImages(size.first, size.second, style, 16, &quantized);
+      CheckDecode(images, quantized);
+      char name[64];
+      snprintf(name, sizeof(name), "%dx%d %s", size.first, size.second,
+	       style == STYLE_BASE ? "gradients" : "flat");
+      Decode(name, images);
+      DeltaSize(name, quantized);
+    }
+  }
+  return 0;
+}
+
+// Encodes the animation with |threads| threads, the same way cpqoi
+// does, and returns the encoded frames. |*fps| is set to frames/second.
+std::vector<Image> Encode(const std::vector<std::vector<uint8_t>>& frames,
+			  int w, int h, int channels, bool delta, int threads, double* fps) {
+  std::vector<Image> ret;
+  double start = Now();
+  FrameEncoder encoder(delta);
+  encoder.set_threads(threads);
+  for (std::vector<uint8_t> pixels : frames) {
+    encoder.AddFrame(pixels, w, h, channels);
+    if (encoder.full()) encoder.Flush([&](const Image& image) { ret.push_back(image); });
+  }
+  encoder.Flush([&](const Image& image) { ret.push_back(image); });
+  *fps = frames.size() / (Now() - start);
+  return ret;
+}
+
+int EncodeMain(int argc, char** argv) {
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int w = 0, h = 0;
+  int arg = 2;
+  if (arg + 1 < argc && !strcmp(argv[arg], "-j")) {
+    threads = atoi(argv[arg + 1]);
+    arg += 2;
+  }
+  if (arg < argc && sscanf(argv[arg], "%dx%d", &w, &h) != 2) {
+    fprintf(stderr, "Bad size: %s\n", argv[arg]);
+    return 1;
+  }
+  std::vector<std::pair<int, int>> sizes;
+  if (w) {
+    sizes.push_back(std::make_pair(w, h));
+  } else {
+    sizes = { std::make_pair(160, 80), std::make_pair(240, 135) };
+  }
+  const int num_frames = 96;
+  for (auto size : sizes) {
+    for (ImageStyle style : { STYLE_BASE, STYLE_FLAT, STYLE_OVERLAY }) {
+      std::vector<std::vector<uint8_t>> frames;
+      for (int f = 0; f < num_frames; f++) {
+	frames.push_back(MakeFrame(size.first, size.second, style, f, num_frames));
+      }
+      int channels = style == STYLE_OVERLAY ? 4 : 3;
+      for (bool delta : { false, true }) {
+	if (delta && style == STYLE_OVERLAY) continue;
+	double single_fps, threaded_fps;
+	std::vector<Image> single = Encode(frames, size.first, size.second, channels, delta, 1, &single_fps);
+	std::vector<Image> threaded = Encode(frames, size.first, size.second, channels, delta, threads, &threaded_fps);
+	if (single != threaded) {
+	  fprintf(stderr, "Output with %d threads differs!\n", threads);
+	  exit(1);
+	}
+	printf("%dx%d %s%s: 1 thread %.0f frames/s, %d thread(s) %.0f frames/s (%.2fx)\n",
+	       size.first, size.second,
+	       style == STYLE_BASE ? "gradients" : style == STYLE_FLAT ? "flat" : "overlay",
+	       delta ? " delta" : "",
+	       single_fps, threads, threaded_fps, threaded_fps / single_fps);
+      }
+    }
+  }
+  return 0;
+}
+
+int CompositeMain(int argc, char** argv) {
+  int w = 0, h = 0, opacity = 100;
+  int arg = 2;
+  if (arg < argc && sscanf(argv[arg], "%dx%d", &w, &h) == 2) arg++;
+  if (arg < argc && strchr(argv[arg], '%')) opacity = atoi(argv[arg++]);
+  std::vector<Layer> layers;
+  for (; arg < argc; arg++) {
+    layers.push_back(Layer{LoadImages(argv[arg])});
+  }
+  if (layers.empty()) {
+    for (auto size : { std::make_pair(160, 80), std::make_pair(240, 135) }) {
+      layers.clear();
+      layers.push_back(Layer{MakeImages(size.first, size.second, STYLE_BASE, 16)});
+      layers.push_back(Layer{MakeImages(size.first, size.second, STYLE_OVERLAY, 16)});
+      layers.push_back(Layer{MakeImages(size.first, size.second, STYLE_OVERLAY, 16)});
+      Composite(size.first, size.second, layers, 100);
+      Composite(size.first, size.second, layers, 50);
+      layers.pop_back();
+      layers.push_back(Layer{MakeImages(size.first, size.second, STYLE_PANEL, 16)});
+      Composite(size.first, size.second, layers, 100);
+    }
+    return 0;
+  }
+  if (!w) {
+    w = get32(layers[0].images[0].data() + 8);
+    h = get32(layers[0].images[0].data() + 12);
+  }
+  Composite(w, h, layers, opacity);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && !strcmp(argv[1], "composite")) return CompositeMain(argc, argv);
+  if (argc >= 2 && !strcmp(argv[1], "decode")) return DecodeMain(argc, argv);
+  if (argc >= 2 && !strcmp(argv[1], "encode")) return EncodeMain(argc, argv);
+  fprintf(stderr, "Usage: %s composite [WxH] [opacity%%] base.pqf [overlay.pqf ...]\n", argv[0]);
+  fprintf(stderr, "       %s decode [file.pqf ...]\n", argv[0]);
+  fprintf(stderr, "       %s encode [-j threads] [WxH]\n", argv[0]);
+  return 1;
+}
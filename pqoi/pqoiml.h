@@ -9,6 +9,7 @@
 #include <math.h>
 #include "pamstream.h"
 #include "pqoi.h"
+#include "frame_encoder.h"
 
 bool near(float a, float b) { return fabs(a-b) < 0.02; }
 
@@ -207,12 +208,17 @@ public:
 	}
 	PamStream stream(file, p->scaling_commands);
 	std::vector<uint8_t> pixels;
-	while (stream.read_frame(pixels)) {
-	  PQOI::EasyPqoiEncoder pqoiencoder;
-	  PQOI::EasyPqoiEncoder::RGB565Data rgb565data = pqoiencoder.quantize(pixels.data(), stream.xsize, stream.ysize, stream.depth);
-	  std::vector<uint8_t> encoded_pqoi = pqoiencoder.encode(rgb565data);
+	// The first frame may be reached from a goto, so it is always a key frame.
+	FrameEncoder encoder(p->delta_frames);
+	if (p->threads) encoder.set_threads(p->threads);
+	auto add_chunk = [out](const std::vector<uint8_t>& encoded_pqoi) {
 	  out->AddChunk(std::string(encoded_pqoi.begin(), encoded_pqoi.end()));
+	};
+	while (stream.read_frame(pixels)) {
+	  encoder.AddFrame(pixels, stream.xsize, stream.ysize, stream.depth);
+	  if (encoder.full()) encoder.Flush(add_chunk);
 	}
+	encoder.Flush(add_chunk);
 	return;
       }
       if (!goto_label.empty()) {
@@ -268,6 +274,10 @@ public:
 
   std::string scaling_commands;
   std::vector<PqoimlLine> lines;
+  // Encode video frames as changes from the previous frame when smaller.
+  bool delta_frames = false;
+  // Encoder threads, 0 means one per CPU.
+  int threads = 0;
 
   void set_default_scaling_commands(const std::string& commands) {
     scaling_commands = commands;
@@ -220,6 +220,9 @@ public:
       for (size_t i = 0; i < NELEM(wav_players); i++) {
         wav_players[i].Stop();
       }
+      for (size_t i = 0; i < NELEM(wav_players); i++) {
+        wav_players[i].WaitForCommands();
+      }
 #endif
       SetMute(false);
     }
@@ -304,6 +307,9 @@ public:
     for (size_t i = 0; i < NELEM(wav_players); i++) {
       wav_players[i].Stop();
     }
+    for (size_t i = 0; i < NELEM(wav_players); i++) {
+      wav_players[i].WaitForCommands();
+    }
 #endif
 
     char *b = current_directory;
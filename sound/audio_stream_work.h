@@ -27,6 +27,7 @@ public:
     for (AudioStreamWork** d = &data_streams; *d; d = &(*d)->next_) {
       if (*d == this) {
         *d = next_;
+        break;
       }
     }
   }
@@ -62,6 +63,9 @@ public:
       NVIC_TRIGGER_IRQ(IRQ_WAV);
 #elif defined(ARDUINO_ARCH_STM32L4)
       armv7m_pendsv_enqueue((armv7m_pendsv_routine_t)ProcessAudioStreams, NULL, 0);
+#elif defined(PROFFIE_TEST)
+      // No interrupts in host tests, do the work right away.
+      ProcessAudioStreams();
 #else
       // TODO
 #endif    
@@ -81,6 +85,19 @@ public:
   
   static bool sd_is_locked() { return sd_locked.get(); }
 
+  // Called between steps of long operations that hold the SD lock,
+  // like saving presets, to let the audio streams refill in between.
+  static void YieldSD() {
+    if (!sd_locked.get()) return;
+    sd_locked.set(false);
+    scheduleFillBuffer();
+#ifdef ESP32
+    // The fill task runs on the other core.
+    while (fill_buffers_pending_.get()) yield();
+#endif
+    sd_locked.set(true);
+  }
+
   static void CloseAllOpenFiles() {
     for (AudioStreamWork *d = data_streams; d; d=d->next_)
       d->CloseFiles();
@@ -94,12 +111,19 @@ public:
 protected:
   virtual bool FillBuffer() = 0;
   virtual bool IsActive() { return false; }
+  // Runs requests queued up by the main loop, called before
+  // FillBuffer(), even when the SD card is locked.
+  virtual void RunCommands() {}
   virtual void CloseFiles() = 0;
   virtual size_t space_available() = 0;
 
 private:
   static void ProcessAudioStreams() {
+    SCOPED_PROFILE_FRAME("wav");
     ScopedCycleCounter cc(wav_interrupt_cycles);
+    TRACE_SCOPE(AUDIO, WAV_FILL, 0);
+    for (AudioStreamWork *d = data_streams; d; d=d->next_)
+      d->RunCommands();
     if (sd_locked.get()) {
       fill_buffers_pending_.set(false);
       return;
@@ -136,6 +160,7 @@ private:
 POAtomic<bool> AudioStreamWork::sd_locked (false);
 POAtomic<bool> AudioStreamWork::fill_buffers_pending_(false);
 #define LOCK_SD(X) AudioStreamWork::LockSD(X)
+#define YIELD_SD() AudioStreamWork::YieldSD()
 
 #ifdef ESP32
 POAtomic<bool> AudioStreamWork::task_created_ (false);
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+// How long the last SD read took, used to explain audio underflows.
+uint32_t last_sd_read_micros = 0;
+
 class ProffieOSAudioStream {
 public:
   virtual int read(int16_t* data, int elements) = 0;
@@ -10,6 +13,8 @@ public:
   virtual bool eof() const { return false; }
   // Cannot be called at the same time as read().
   virtual void StopFromReader() {}
+  // micros() when buffered streams last filled their buffer, 0 if unknown.
+  virtual uint32_t last_fill_micros() const { return 0; }
 };
 
 #endif
@@ -0,0 +1,183 @@
+// Checks the fixed-point BiquadQ31 filter used by the DAC against the
+// same filter computed with doubles, and compares it with the floating
+// point Biquad filter for accuracy and speed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#define AUDIO_RATE 44100
+#define AUDIO_BUFFER_SIZE 44
+#define FILTER_CUTOFF_FREQUENCY 150
+#define FILTER_ORDER 10
+
+#include "filter.h"
+
+typedef Filter::Bilinear<
+  Filter::BLT<
+    Filter::ConvertToHighPass<
+      Filter::ButterWorthProtoType<FILTER_ORDER>, FILTER_CUTOFF_FREQUENCY, AUDIO_RATE>>> HighPass;
+
+#define CHECK(X) do {						\
+    if (!(X)) {							\
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #X);	\
+      exit(1);							\
+    }								\
+  } while (0)
+
+// Speaker compensation: less bass, a dip and some extra treble.
+typedef Filter::Cascade<
+  Filter::LowShelf<300, -6, AUDIO_RATE>,
+  Filter::PeakingEQ<2000, -9, 200, AUDIO_RATE>,
+  Filter::HighShelf<6000, 12, AUDIO_RATE>> EQ;
+
+// The same filter, computed with doubles.
+template<class F>
+class ReferenceFilter {
+public:
+  double Run(double x) {
+    for (size_t k = 0; k < F::biquads; k++) {
+      double* s = state_[k];
+      double y = F::b0(k) * x + F::b1(k) * s[0] + F::b2(k) * s[1]
+	- F::a1(k) * s[2] - F::a2(k) * s[3];
+      s[1] = s[0];
+      s[0] = x;
+      s[3] = s[2];
+      s[2] = y;
+      x = y;
+    }
+    return x / F::gain;
+  }
+private:
+  double state_[F::biquads][4] = {};
+};
+
+// The floating point Biquad only handles the high-pass filter.
+template<class F> struct FloatFilter {
+  static const bool enabled = false;
+  void Run4(float* inout) {}
+};
+template<> struct FloatFilter<HighPass> : public Filter::Biquad<HighPass> {
+  static const bool enabled = true;
+};
+
+// Same scaling as the DAC: int16 sample units with 4 fractional bits.
+const float SCALE = 16.0f;
+
+float Sine(float freq, int i) {
+  return sinf(i * freq * 2 * M_PI / AUDIO_RATE);
+}
+
+// Returns the output level (relative to the input) for a sine wave,
+// after the filter has settled. Also checks that the fixed-point filter
+// stays close to the reference.
+template<class F = HighPass>
+float TestFrequency(float freq, float amplitude = 20000.0f) {
+  ReferenceFilter<F> reference;
+  FloatFilter<F> float_filter;
+  Filter::BiquadQ31<F> fixed_filter;
+  const int blocks = AUDIO_RATE / AUDIO_BUFFER_SIZE;  // one second
+  double peak = 0.0;
+  double fixed_error = 0.0;
+  double float_error = 0.0;
+  for (int b = 0; b < blocks; b++) {
+    double r[AUDIO_BUFFER_SIZE];
+    float f[AUDIO_BUFFER_SIZE];
+    int32_t q[AUDIO_BUFFER_SIZE];
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+      f[i] = amplitude * Sine(freq, b * AUDIO_BUFFER_SIZE + i);
+      q[i] = f[i] * SCALE;
+      r[i] = reference.Run(f[i]);
+    }
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i += 4) float_filter.Run4(f + i);
+    fixed_filter.Run(q, AUDIO_BUFFER_SIZE);
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+      fixed_error = std::max(fixed_error, fabs(q[i] / SCALE - r[i]));
+      if (float_filter.enabled) float_error = std::max(float_error, fabs(f[i] - r[i]));
+      if (b > blocks / 2) peak = std::max(peak, fabs(r[i]));
+    }
+  }
+  fprintf(stderr, "%6.0f Hz: gain = %9.6f, max error: fixed = %.3f, float = %.3f\n",
+	  freq, peak / amplitude, fixed_error, float_error);
+  // Less than one LSB of a 16-bit sample.
+  CHECK(fixed_error < 1.0);
+  return peak / amplitude;
+}
+
+void TestStep() {
+  // A full scale step is the worst case for overshoot.
+  Filter::BiquadQ31<HighPass> fixed_filter;
+  int32_t peak = 0;
+  int32_t last = 0;
+  for (int b = 0; b < 100; b++) {
+    int32_t q[AUDIO_BUFFER_SIZE];
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) q[i] = 32767 * SCALE;
+    fixed_filter.Run(q, AUDIO_BUFFER_SIZE);
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) peak = std::max(peak, abs(q[i]));
+    last = q[AUDIO_BUFFER_SIZE - 1];
+  }
+  fprintf(stderr, "step: peak = %.0f, end = %.2f\n", peak / SCALE, last / SCALE);
+  CHECK(peak < (1 << 27));
+  // DC is removed completely.
+  CHECK(abs(last) < SCALE);
+}
+
+void Benchmark() {
+  const int blocks = 20000;
+  float f[AUDIO_BUFFER_SIZE];
+  int32_t q[AUDIO_BUFFER_SIZE];
+  for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+    f[i] = 10000.0f * Sine(1000, i);
+    q[i] = f[i] * SCALE;
+  }
+  Filter::Biquad<HighPass> float_filter;
+  Filter::BiquadQ31<HighPass> fixed_filter;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int b = 0; b < blocks; b++) {
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i += 4) float_filter.Run4(f + i);
+  }
+  std::chrono::duration<double, std::nano> float_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int b = 0; b < blocks; b++) {
+    fixed_filter.Run(q, AUDIO_BUFFER_SIZE);
+  }
+  std::chrono::duration<double, std::nano> fixed_time = std::chrono::steady_clock::now() - start;
+
+  // Print something that depends on the results, so the loops stay.
+  fprintf(stderr, "float: %.2f ns/sample, fixed: %.2f ns/sample (%f %d)\n",
+	  float_time.count() / blocks / AUDIO_BUFFER_SIZE,
+	  fixed_time.count() / blocks / AUDIO_BUFFER_SIZE,
+	  f[0], q[0]);
+}
+
+int main() {
+  CHECK(TestFrequency(20) < 0.001);
+  CHECK(TestFrequency(75) < 0.01);
+  float cutoff = TestFrequency(FILTER_CUTOFF_FREQUENCY);
+  CHECK(cutoff > 0.69 && cutoff < 0.72);
+  CHECK(fabsf(TestFrequency(1000) - 1.0) < 0.01);
+  CHECK(fabsf(TestFrequency(10000) - 1.0) < 0.01);
+  TestStep();
+
+  // Keep the level low enough that the treble boost doesn't clip.
+  float db = 20 * log10f(TestFrequency<EQ>(30, 5000));
+  CHECK(db > -7.0 && db < -5.0);
+  db = 20 * log10f(TestFrequency<EQ>(2000, 5000));
+  CHECK(db > -9.5 && db < -8.5);
+  db = 20 * log10f(TestFrequency<EQ>(15000, 5000));
+  CHECK(db > 11.0 && db < 12.5);
+  // Together with the high-pass filter, as the DAC uses it.
+  typedef Filter::Cascade<HighPass, EQ> HighPassEQ;
+  CHECK(TestFrequency<HighPassEQ>(20, 5000) < 0.001);
+  db = 20 * log10f(TestFrequency<HighPassEQ>(15000, 5000));
+  CHECK(db > 11.0 && db < 12.5);
+  // Unused bands change nothing.
+  CHECK(fabsf(TestFrequency<Filter::Cascade<Filter::NoFilter, HighPass, Filter::NoFilter>>(1000) - 1.0) < 0.01);
+  Benchmark();
+}
@@ -58,19 +58,25 @@ public:
   int buffered() const {
     return buf_end_.get() - buf_start_.get();
   }
+  // Copies up to |n| buffered samples, without using them up.
+  int peek(int16_t* buf, int n) const {
+    n = std::min(n, buffered());
+    size_t start = buf_start_.get();
+    for (int i = 0; i < n; i++) buf[i] = buffer_[(start + i) & (N-1)];
+    return n;
+  }
   // Overridable
   size_t space_available() override {
     return real_space_available();
   }
+  uint32_t last_fill_micros() const override {
+    return last_fill_micros_.get();
+  }
   void SetStream(ProffieOSAudioStream* stream) {
     eof_.set(false);
     stream_.set(stream);
   }
-private:
-  size_t real_space_available() const {
-    if (eof_.get() || !stream_.get()) return 0;
-    return N - buffered();
-  }
+protected:
   bool FillBuffer() override {
     if (stream_.get()) {
       size_t space = real_space_available();
@@ -86,15 +92,22 @@ private:
 	  eof_.set(true);
         }
         buf_end_ += got;
+        last_fill_micros_.set(micros());
       }
     }
     return stream_.get() && space_available() > 0 && !eof_.get();
   }
+private:
+  size_t real_space_available() const {
+    if (eof_.get() || !stream_.get()) return 0;
+    return N - buffered();
+  }
   POAtomic<ProffieOSAudioStream*> stream_;
   // Note, these are assumed to be atomic, 8-bit processors won't work.
   POAtomic<size_t> buf_start_;
   POAtomic<size_t> buf_end_;
   POAtomic<bool> eof_;
+  POAtomic<uint32_t> last_fill_micros_;
   int16_t buffer_[N];
 };
 
@@ -11,13 +11,25 @@ size_t WhatUnit(class BufferedWavPlayer* player);
 #define AUDIO_BUFFER_SIZE_BYTES 512
 #endif
 
+// Stop() fades out in 1 / 200 second. (5ms)
+const int32_t kStopFadeSpeed = 200 * kMaxVolume / AUDIO_RATE;
+
 // Combines a WavPlayer and a BufferedAudioStream into a
 // buffered wav player. When we start a new sample, we
 // make sure to fill up the buffer before we start playing it.
 // This minimizes latency while making sure to avoid any gaps.
+//
+// Starting and stopping sounds with PlayOnce(), PlayLoop() and Stop()
+// doesn't happen right away. Instead the main loop puts a command in a
+// queue, and the commands are carried out by the interrupt that fills
+// the buffers. This way the main loop doesn't have to wait for the old
+// sound to fade out, or for the new sound to fill up the buffer.
+// PlayOnce() does wait for the header of the new file to be read though,
+// since many callers use length() right away.
 class BufferedWavPlayer : public VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES> > {
 public:
   void Play(const char* filename) {
+    WaitForCommands();
     MountSDCard();
     EnableAmplifier();
     pause_.set(true);
@@ -32,6 +44,7 @@ public:
     STDOUT << "Playing " << name << ", ";
     for (const char* dir = current_directory; dir; dir = next_current_directory(dir)) {
       PathHelper full_name(dir, name);
+      if (SDNameCacheMissing(full_name)) continue;
       LOCK_SD(true);
       bool exists = LSFS::Exists(full_name);
       LOCK_SD(false);
@@ -47,6 +60,7 @@ public:
   }
 
   void UpdateSaberBaseSoundInfo() {
+    WaitForLength();
     SaberBase::sound_length = length();
     SaberBase::sound_number = current_file_id().GetFileNum();
   }
@@ -55,19 +69,13 @@ public:
     const Effect* effect = fileid.GetEffect();
     MountSDCard();
     EnableAmplifier();
-    set_volume_now(volume_target() * effect->GetVolume() / 100);
-    STDOUT << "unit = " << WhatUnit(this) << " vol = " << volume() << ", ";
-
-    pause_.set(true);
-    clear();
-    ResetStopWhenZero();
-    wav.PlayOnce(fileid, start);
-    SetStream(&wav);
-    // Fill up the buffer, if possible.
-    while (!wav.eof() && space_available()) {
-      scheduleFillBuffer();
-    }
-    pause_.set(false);
+    Command* c = NewCommand(Command::PLAY_ONCE);
+    c->file_id = fileid;
+    c->start = start;
+    c->volume = volume_target() * effect->GetVolume() / 100;
+    STDOUT << "unit = " << WhatUnit(this) << " vol = " << (c->volume * (1.0f / kMaxVolume)) << ", ";
+    PostCommand();
+    WaitForLength();
     if (SaberBase::sound_length == 0.0 && effect->GetFollowing() != effect) {
       UpdateSaberBaseSoundInfo();
     }
@@ -75,23 +83,46 @@ public:
   void PlayOnce(Effect* effect, float start = 0.0) {
     PlayOnce(effect->RandomFile(), start);
   }
-  void PlayLoop(Effect* effect) { wav.PlayLoop(effect); }
+  void PlayLoop(Effect* effect) {
+    NewCommand(Command::PLAY_LOOP)->effect = effect;
+    PostCommand();
+  }
 
+  // Fades out and closes the file. The player is busy until the fade
+  // is done, use WaitForCommands() if you need it to be done.
   // Do not call from interrupts!
   void Stop() {
-#if 0
-    // Immediate stop is impossible for multithreaded implementations.
+    NewCommand(Command::STOP);
+    PostCommand();
+  }
+
+  // The file is opened from the interrupt, waits until we know how long
+  // it is. If the SD card is locked, the interrupt can't read the header,
+  // so length() may still be 0 or the length of the previous file.
+  // Do not call from interrupts!
+  void WaitForLength() {
+    while (!length_known() && !AudioStreamWork::sd_is_locked()) {
+      scheduleFillBuffer();
+      yield();
+    }
+  }
+
+  // Do not call from interrupts!
+  void WaitForCommands() {
+    while (!commands_done()) {
+      scheduleFillBuffer();
+      delay(1);
+    }
+  }
+
+  // Pauses the player, and copies the next |n| samples it would have
+  // played into |out|, at the current volume. Returns how many it got.
+  int TakeTail(int16_t* out, int n) {
     pause_.set(true);
-    wav.Stop();
-#else
-    int v = volume_target();
-    set_fade_time(0.005);
-    FadeAndStop();
-    while (isPlaying()) delay(1);
-    set_volume_now(v);
-#endif    
-    wav.Close();
-    clear();
+    n = peek(out, n);
+    float v = volume();
+    for (int i = 0; i < n; i++) out[i] = clamptoi16(out[i] * v);
+    return n;
   }
 
   void CloseFiles() override { wav.Close(); }
@@ -100,15 +131,24 @@ public:
     return wav.Filename();
   }
 
+  // The last sound asked for, even if it hasn't started yet.
   Effect::FileID current_file_id() const {
+    uint32_t begin = commands_begin_.get();
+    for (uint32_t i = commands_end_.get(); i != begin; i--) {
+      const Command& c = commands_[(i - 1) % NELEM(commands_)];
+      if (c.type == Command::PLAY_ONCE) return c.file_id;
+      if (c.type == Command::STOP) return Effect::FileID();
+    }
     return wav.current_file_id();
   }
   
   bool isPlaying() const {
+    if (!commands_done() || starting_.get()) return true;
     return !pause_.get() && (wav.isPlaying() || buffered());
   }
 
-  BufferedWavPlayer() : pause_(true) {
+  BufferedWavPlayer() : pause_(true), starting_(false), stopping_(false), stop_volume_(0),
+			commands_begin_(0), commands_end_(0) {
     SetStream(&wav);
   }
 
@@ -116,12 +156,25 @@ public:
   // means that it will be low priority for reading.
   size_t space_available() override {
     size_t ret = VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES>>::space_available();
-    if (pause_.get() && ret) ret = 2; // still slightly higher than FromFileStyle<>
+    if (pause_.get() && !starting_.get() && ret) ret = 2; // still slightly higher than FromFileStyle<>
     return ret;
   }
 
   int read(int16_t* dest, int to_read) override {
-    if (pause_.get()) return 0;
+    if (pause_.get()) {
+      if (starting_.get()) scheduleFillBuffer();
+      return 0;
+    }
+    if (stopping_.get()) {
+      int n = VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES> >::read(dest, to_read);
+      int32_t v = stop_volume_.get();
+      for (int i = 0; i < n; i++) {
+	v = std::max<int32_t>(0, v - kStopFadeSpeed);
+	dest[i] = (dest[i] * v) >> kVolumeShift;
+      }
+      stop_volume_.set(v);
+      return n;
+    }
     return VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES> >::read(dest, to_read);
   }
   bool eof() const override {
@@ -144,16 +197,106 @@ public:
 
   void dump() {
     STDOUT << " pause=" << pause_.get()
+	   << " starting=" << starting_.get()
+	   << " stopping=" << stopping_.get()
+	   << " commands=" << (commands_end_.get() - commands_begin_.get())
 	   << " buffered=" << buffered()
 	   << " wav.isPlaying()=" << wav.isPlaying()
 	   << "\n";
     wav.dump();
   }
+protected:
+  void RunCommands() override {
+    while (!commands_done()) {
+      Command& c = commands_[commands_begin_.get() % NELEM(commands_)];
+      switch (c.type) {
+	case Command::PLAY_ONCE:
+	  set_volume_now(c.volume);
+	  pause_.set(true);
+	  clear();
+	  ResetStopWhenZero();
+	  wav.PlayOnce(c.file_id, c.start);
+	  SetStream(&wav);
+	  // FillBuffer() un-pauses when the buffer is full.
+	  starting_.set(true);
+	  break;
+
+	case Command::PLAY_LOOP:
+	  wav.PlayLoop(c.effect);
+	  break;
+
+	case Command::STOP:
+	  // The fade is done in read(), so that it doesn't matter if
+	  // someone changes the volume in the meantime.
+	  if (!stopping_.get()) {
+	    starting_.set(false);
+	    stop_volume_.set(kMaxVolume);
+	    stopping_.set(true);
+	  }
+	  if (!pause_.get() && stop_volume_.get() && (wav.isPlaying() || buffered())) return;
+	  pause_.set(true);
+	  stopping_.set(false);
+	  // We are the reader of |wav|, so this is safe.
+	  wav.StopFromReader();
+	  wav.Close();
+	  clear();
+	  break;
+      }
+      commands_begin_ += 1;
+    }
+  }
+
+  bool FillBuffer() override {
+    bool more = VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES> >::FillBuffer();
+    if (!more && starting_.get()) {
+      starting_.set(false);
+      pause_.set(false);
+    }
+    return more;
+  }
+
 private:
+  struct Command {
+    enum Type : uint8_t { PLAY_ONCE, PLAY_LOOP, STOP };
+    Type type;
+    int volume;
+    float start;
+    Effect::FileID file_id;
+    Effect* effect;
+  };
+
+  Command* NewCommand(Command::Type type) {
+    // The interrupt is behind, let it catch up.
+    while (commands_end_.get() - commands_begin_.get() >= NELEM(commands_)) {
+      scheduleFillBuffer();
+      delay(1);
+    }
+    Command* c = commands_ + commands_end_.get() % NELEM(commands_);
+    c->type = type;
+    return c;
+  }
+  void PostCommand() {
+    commands_end_ += 1;
+    scheduleFillBuffer();
+  }
+  bool commands_done() const {
+    return commands_begin_.get() == commands_end_.get();
+  }
+  bool length_known() const {
+    return commands_done() && !(starting_.get() && wav.isPlaying() && wav.length() == 0.0);
+  }
+
   uint32_t refs_ = 0;
 
   PlayWav wav;
   POAtomic<bool> pause_;
+  POAtomic<bool> starting_;
+  POAtomic<bool> stopping_;
+  POAtomic<int32_t> stop_volume_;
+
+  Command commands_[4];
+  POAtomic<uint32_t> commands_begin_;
+  POAtomic<uint32_t> commands_end_;
 };
 
 #endif
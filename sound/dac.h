@@ -132,6 +132,80 @@ void my_stm32l4_system_saiclk_configure_22579200()
 
 #define PDB_CONFIG (PDB_SC_TRGSEL(15) | PDB_SC_PDBEN | PDB_SC_CONT | PDB_SC_PDBIE | PDB_SC_DMAEN)
 
+// Speaker EQ, run after the mixer together with the high-pass filter.
+// Each band is enabled by defining its frequency (Hz) and gain (dB), for
+// example to tame the resonance of a small speaker:
+//   #define EQ_LOW_SHELF_FREQUENCY 300
+//   #define EQ_LOW_SHELF_GAIN -6
+//   #define EQ_PEAK1_FREQUENCY 2000
+//   #define EQ_PEAK1_GAIN -9
+//   #define EQ_PEAK1_Q 200          // Q * 100, default 141
+//   #define EQ_HIGH_SHELF_FREQUENCY 6000
+//   #define EQ_HIGH_SHELF_GAIN 4
+// Up to three peaking bands are available, EQ_PEAK1 to EQ_PEAK3.
+// Boosts should be kept moderate, since the output is still clamped.
+// Not available on ESP32, see dac_esp32.h.
+#ifdef FILTER_CUTOFF_FREQUENCY
+#define DAC_HIGH_PASS Filter::Bilinear<Filter::BLT<Filter::ConvertToHighPass<Filter::ButterWorthProtoType<FILTER_ORDER>, FILTER_CUTOFF_FREQUENCY, AUDIO_RATE>>>
+#define DAC_FILTER
+#else
+#define DAC_HIGH_PASS Filter::NoFilter
+#endif
+
+#ifdef EQ_LOW_SHELF_FREQUENCY
+#define DAC_EQ_LOW_SHELF Filter::LowShelf<EQ_LOW_SHELF_FREQUENCY, EQ_LOW_SHELF_GAIN, AUDIO_RATE>
+#define DAC_FILTER
+#else
+#define DAC_EQ_LOW_SHELF Filter::NoFilter
+#endif
+
+#ifndef EQ_PEAK1_Q
+#define EQ_PEAK1_Q 141
+#endif
+#ifdef EQ_PEAK1_FREQUENCY
+#define DAC_EQ_PEAK1 Filter::PeakingEQ<EQ_PEAK1_FREQUENCY, EQ_PEAK1_GAIN, EQ_PEAK1_Q, AUDIO_RATE>
+#define DAC_FILTER
+#else
+#define DAC_EQ_PEAK1 Filter::NoFilter
+#endif
+
+#ifndef EQ_PEAK2_Q
+#define EQ_PEAK2_Q 141
+#endif
+#ifdef EQ_PEAK2_FREQUENCY
+#define DAC_EQ_PEAK2 Filter::PeakingEQ<EQ_PEAK2_FREQUENCY, EQ_PEAK2_GAIN, EQ_PEAK2_Q, AUDIO_RATE>
+#define DAC_FILTER
+#else
+#define DAC_EQ_PEAK2 Filter::NoFilter
+#endif
+
+#ifndef EQ_PEAK3_Q
+#define EQ_PEAK3_Q 141
+#endif
+#ifdef EQ_PEAK3_FREQUENCY
+#define DAC_EQ_PEAK3 Filter::PeakingEQ<EQ_PEAK3_FREQUENCY, EQ_PEAK3_GAIN, EQ_PEAK3_Q, AUDIO_RATE>
+#define DAC_FILTER
+#else
+#define DAC_EQ_PEAK3 Filter::NoFilter
+#endif
+
+#ifdef EQ_HIGH_SHELF_FREQUENCY
+#define DAC_EQ_HIGH_SHELF Filter::HighShelf<EQ_HIGH_SHELF_FREQUENCY, EQ_HIGH_SHELF_GAIN, AUDIO_RATE>
+#define DAC_FILTER
+#else
+#define DAC_EQ_HIGH_SHELF Filter::NoFilter
+#endif
+
+#ifdef DAC_FILTER
+typedef Filter::BiquadQ31<Filter::Cascade<
+  DAC_HIGH_PASS,
+  DAC_EQ_LOW_SHELF,
+  DAC_EQ_PEAK1,
+  DAC_EQ_PEAK2,
+  DAC_EQ_PEAK3,
+  DAC_EQ_HIGH_SHELF>> DACFilter;
+#endif
+
 class LS_DAC : CommandParser {
 public:
   void Setup() {
@@ -366,7 +440,7 @@ public:
 #if defined(ENABLE_SPDIF_OUT) || defined(ENABLE_I2S_OUT)
     memset(dac_dma_buffer2, 0, sizeof(dac_dma_buffer2));
 #endif
-#ifdef FILTER_CUTOFF_FREQUENCY
+#ifdef DAC_FILTER
     filter_.clear();
 #endif
 
@@ -525,10 +599,12 @@ public:
   bool Parse(const char* cmd, const char* arg) override {
 #ifndef DISABLE_DIAGNOSTIC_COMMANDS
 
-#ifdef FILTER_CUTOFF_FREQUENCY
+#ifdef DAC_FILTER
     if (!strcmp(cmd, "filterdata")) {
-      for (size_t i = 0; i < NELEM(filter_.data_); i++) {
-	STDOUT << "filter[" << i << "] = " << filter_.data_[i][0] << ", " << filter_.data_[i][1] << "\n";
+      for (size_t i = 0; i < NELEM(filter_.state_); i++) {
+	STDOUT << "filter[" << i << "] =";
+	for (size_t j = 0; j < NELEM(filter_.state_[i]); j++) STDOUT << " " << filter_.state_[i][j];
+	STDOUT << "\n";
       }
       return true;
     }
@@ -592,7 +668,9 @@ private:
   static void isr(void* arg, unsigned long int event)
 #endif
   {
+    SCOPED_PROFILE_FRAME("audio_dma");
     ScopedCycleCounter cc(audio_dma_interrupt_cycles);
+    TRACE_SCOPE(AUDIO, AUDIO_ISR, 0);
     int16_t *dest;
     uint32_t saddr = current_position();
 #ifdef ENABLE_SPDIF_OUT
@@ -632,7 +710,7 @@ private:
 #define LINE_OUT_VOLUME 2000
 #endif      
     
-#if defined(ENABLE_SPDIF_OUT) || defined(ENABLE_I2S_OUT) || defined(FILTER_CUTOFF_FREQUENCY)
+#if defined(ENABLE_SPDIF_OUT) || defined(ENABLE_I2S_OUT) || defined(DAC_FILTER)
 #define DAC_GET_FLOATS
 #endif
 
@@ -660,15 +738,20 @@ private:
     }
 #endif  // GET_FLOATS
 
-#ifdef FILTER_CUTOFF_FREQUENCY
-    // Run the filter
-    static_assert(AUDIO_BUFFER_SIZE % 4 == 0);
-    for (int i = 0; i < AUDIO_BUFFER_SIZE; i+=4) {
-      filter_.Run4(data + i);
+#ifdef DAC_FILTER
+    // Run the filter in fixed point, on samples with 4 fractional bits.
+    // The mixer output isn't clamped, so leave plenty of headroom.
+    int32_t filtered[AUDIO_BUFFER_SIZE];
+    float filter_volume = dynamic_mixer.get_volume() * 16.0f;
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+      filtered[i] = clampi32(data[i] * filter_volume, -(1 << 27), (1 << 27) - 1);
     }
+    filter_.Run(filtered, AUDIO_BUFFER_SIZE);
 #endif    
     for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
-#ifdef DAC_GET_FLOATS
+#if defined(DAC_FILTER)
+      int16_t sample = clamptoi16(filtered[i] >> 4);
+#elif defined(DAC_GET_FLOATS)
       int16_t sample = clamptoi16(data[i] * dynamic_mixer.get_volume());
 #else   // GET_FLOATS
       int16_t sample = data[i];
@@ -710,12 +793,8 @@ private:
 #if defined(ENABLE_I2S_OUT) || defined(ENABLE_SPDIF_OUT)
   static DMAChannel dma2;
 #endif
-#ifdef FILTER_CUTOFF_FREQUENCY
-  static Filter::Biquad<
-    Filter::Bilinear<
-    Filter::BLT<
-      Filter::ConvertToHighPass<
-	Filter::ButterWorthProtoType<FILTER_ORDER>, FILTER_CUTOFF_FREQUENCY, AUDIO_RATE>>>> filter_;
+#ifdef DAC_FILTER
+  static DACFilter filter_;
 #endif  
 };
 
@@ -736,12 +815,8 @@ DMAMEM __attribute__((aligned(32))) uint32_t LS_DAC::dac_dma_buffer2[AUDIO_BUFFE
 #ifdef ENABLE_I2S_OUT
 DMAMEM __attribute__((aligned(32))) uint16_t LS_DAC::dac_dma_buffer2[AUDIO_BUFFER_SIZE*2*CHANNELS];
 #endif
-#ifdef FILTER_CUTOFF_FREQUENCY
-Filter::Biquad<
-  Filter::Bilinear<
-  Filter::BLT<
-    Filter::ConvertToHighPass<
-      Filter::ButterWorthProtoType<FILTER_ORDER>, FILTER_CUTOFF_FREQUENCY, AUDIO_RATE>>>> LS_DAC::filter_;
+#ifdef DAC_FILTER
+DACFilter LS_DAC::filter_;
 #endif  
 
 LS_DAC dac;
@@ -4,6 +4,14 @@
 #include <driver/i2s.h>
 #include "esp32-hal.h"
 
+// The speaker EQ in dac.h only runs in the fixed-point filter, which
+// this DAC doesn't use.
+#if defined(EQ_LOW_SHELF_FREQUENCY) || defined(EQ_PEAK1_FREQUENCY) || \
+    defined(EQ_PEAK2_FREQUENCY) || defined(EQ_PEAK3_FREQUENCY) || \
+    defined(EQ_HIGH_SHELF_FREQUENCY)
+#error The speaker EQ (EQ_*_FREQUENCY) is not supported on ESP32.
+#endif
+
 void ls_dac_isr(void);
 
 class LS_DAC : CommandParser {
@@ -158,6 +166,7 @@ ProffieOSAudioStream * volatile LS_DAC::stream_ = nullptr;
 LS_DAC dac;
 
 void ls_dac_isr(void) {
+  SCOPED_PROFILE_FRAME("audio_dma");
   ScopedCycleCounter cc(audio_dma_interrupt_cycles);
   dac.isr();
 }
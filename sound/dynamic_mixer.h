@@ -3,10 +3,39 @@
 
 #include <algorithm>
 #include "../common/atomic.h"
+#include "limiter.h"
+
+// Must be power of 2
+#ifndef AUDIO_UNDERFLOW_HISTORY
+#define AUDIO_UNDERFLOW_HISTORY 8
+#endif
+
+// Snapshot of what was going on when a mixer input ran dry.
+struct AudioUnderflowEvent {
+  uint32_t millis;
+  // How long since the starved input last filled its buffer.
+  uint32_t since_fill_micros;
+  uint32_t sd_read_micros;
+  const char* looper;
+  uint8_t input;
+};
+
+// Called from the audio interrupt before each block is mixed, so that
+// volumes can be updated at a fixed rate, no matter how fast the main
+// loop runs. Must be quick, and must not allocate or touch anything
+// that the main loop may be in the middle of changing.
+class AudioBlockListener {
+public:
+  virtual void AudioBlock(int samples) = 0;
+};
 
 // Audio compressor, takes N input channels, sums them and divides the
 // result by the square root of the average volume.
-template<int N> class AudioDynamicMixer : public ProffieOSAudioStream, Looper {
+// If ENABLE_AUDIO_LIMITER is defined, the sum is instead multiplied by
+// volume / 1024 and only the peaks that would clip are turned down,
+// see limiter.h. This is cheaper, but fonts that rely on the compressor
+// to even out levels may need different volume settings.
+template<int N> class AudioDynamicMixer : public ProffieOSAudioStream, Looper, CommandParser {
 public:
   AudioDynamicMixer() : underflow_count_(0) {
     for (int i = 0; i < N; i++) {
@@ -56,6 +85,47 @@ public:
   int last_square_ = 0;
 #endif
   
+  // Called from the audio interrupt.
+  void RecordUnderflow(int input) {
+    uint32_t pos = underflow_count_.get();
+    AudioUnderflowEvent& e = underflows_[pos & (AUDIO_UNDERFLOW_HISTORY - 1)];
+    e.millis = millis();
+    uint32_t last_fill = streams_[input]->last_fill_micros();
+    e.since_fill_micros = last_fill ? micros() - last_fill : 0;
+    e.sd_read_micros = last_sd_read_micros;
+    e.looper = Looper::current_name();
+    e.input = input;
+    underflow_count_ += 1;
+    cpu_governor_note_audio_underflow();
+  }
+
+  void PrintUnderflow(const AudioUnderflowEvent& e) {
+    STDOUT << "Underflow @ " << e.millis
+           << "ms input=" << (int)e.input
+           << " since_fill=" << e.since_fill_micros
+           << "us last_sd_read=" << e.sd_read_micros
+           << "us looper=" << e.looper << "\n";
+  }
+
+  bool Parse(const char* cmd, const char* arg) override {
+#ifndef DISABLE_DIAGNOSTIC_COMMANDS
+    if (!strcmp(cmd, "underflows")) {
+      AudioUnderflowEvent copy[AUDIO_UNDERFLOW_HISTORY];
+      noInterrupts();
+      uint32_t count = underflow_count_.get();
+      memcpy(copy, underflows_, sizeof(copy));
+      interrupts();
+      STDOUT << "Audio underflows: " << count << "\n";
+      uint32_t n = std::min<uint32_t>(count, AUDIO_UNDERFLOW_HISTORY);
+      for (uint32_t i = count - n; i != count; i++) {
+        PrintUnderflow(copy[i & (AUDIO_UNDERFLOW_HISTORY - 1)]);
+      }
+      return true;
+    }
+#endif
+    return false;
+  }
+
   int read(int16_t* data, int elements) override {
     SCOPED_PROFILER();
     int32_t sum[AUDIO_BUFFER_SIZE];
@@ -64,18 +134,35 @@ public:
     num_samples_ += elements;
     while (elements) {
       int to_do = std::min(elements, (int)NELEM(sum));
+      AudioBlockListener* listener = block_listener_;
+      if (listener) listener->AudioBlock(to_do);
       for (int i = 0; i < to_do; i++) sum[i] = 0;
       for (int i = 0; i < N; i++) {
 	if (!streams_[i]) continue;
         int e = streams_[i]->read(data, to_do);
 	if (e < to_do && !streams_[i]->eof()) {
-	  underflow_count_ += 1;
+	  RecordUnderflow(i);
 	}
         for (int j = 0; j < e; j++) {
           sum[j] += data[j];
         }
       }
 
+#ifdef ENABLE_AUDIO_LIMITER
+      int32_t gains[AUDIO_BUFFER_SIZE];
+      for (int i = 0; i < to_do; i++) {
+        v = sum[i];
+	vol_ += abs(v);
+	vol_ -= (vol_ + 255) >> 8;
+        peak_sum_ = std::max<int32_t>(abs(v), peak_sum_);
+      }
+      limiter_.Run(sum, gains, to_do, volume_ << 6, 32767);
+      for (int i = 0; i < to_do; i++) {
+        v2 = ((int64_t)sum[i] * gains[i]) >> 16;
+        data[i] = clamptoi16(v2);
+        peak_ = std::max<int32_t>(abs(v2), peak_);
+      }
+#else
       for (int i = 0; i < to_do; i++) {
         v = sum[i];
 //        vol_ = ((vol_ + abs(v)) * 255) >> 8;
@@ -87,6 +174,7 @@ public:
         peak_sum_ = std::max<int32_t>(abs(v), peak_sum_);
         peak_ = std::max<int32_t>(abs(v2), peak_);
       }
+#endif
       data += to_do;
       elements -= to_do;
     }
@@ -107,18 +195,34 @@ public:
     num_samples_ += elements;
     while (elements) {
       int to_do = std::min(elements, (int)NELEM(sum));
+      AudioBlockListener* listener = block_listener_;
+      if (listener) listener->AudioBlock(to_do);
       for (int i = 0; i < to_do; i++) sum[i] = 0;
       for (int i = 0; i < N; i++) {
 	if (!streams_[i]) continue;
         int e = streams_[i]->read(tmp, to_do);
 	if (e < to_do && !streams_[i]->eof()) {
-	  underflow_count_ += 1;
+	  RecordUnderflow(i);
 	}
         for (int j = 0; j < e; j++) {
           sum[j] += tmp[j];
         }
       }
 
+#ifdef ENABLE_AUDIO_LIMITER
+      // The caller multiplies by the volume, so the limit goes down
+      // as the volume goes up instead.
+      int32_t gains[AUDIO_BUFFER_SIZE];
+      for (int i = 0; i < to_do; i++) {
+        v = sum[i];
+	vol_ += abs(v);
+	vol_ -= (vol_ + 255) >> 8;
+      }
+      limiter_.Run(sum, gains, to_do, 1 << 16, (32767 << 10) / std::max<int32_t>(volume_, 1));
+      for (int i = 0; i < to_do; i++) {
+	data[i] = (float)sum[i] * gains[i] * (1.0f / (1 << 26));
+      }
+#else
       for (int i = 0; i < to_do; i++) {
         v = sum[i];
         // vol_ = ((vol_ + abs(v)) * 255) >> 8;
@@ -126,6 +230,7 @@ public:
 	vol_ -= (vol_ + 255) >> 8;
 	data[i] = v / (sqrtf(vol_) + 100.0f);
       }
+#endif
       data += to_do;
       elements -= to_do;
     }
@@ -143,6 +248,10 @@ public:
 	uint32_t new_underflows = underflows - last_underflow_count_;
 	STDOUT.print("Audio underflows: ");
 	STDOUT.println(new_underflows);
+	noInterrupts();
+	AudioUnderflowEvent last = underflows_[(underflows - 1) & (AUDIO_UNDERFLOW_HISTORY - 1)];
+	interrupts();
+	PrintUnderflow(last);
 	last_underflow_count_ = underflows;
 	last_printout_ = millis();
       }
@@ -181,9 +290,11 @@ public:
   }
 
   void set_volume(int32_t volume) { volume_ = volume; }
+  void set_block_listener(AudioBlockListener* listener) { block_listener_ = listener; }
   int32_t get_volume() const { return volume_; }
 
   ProffieOSAudioStream* streams_[N];
+  AudioBlockListener* volatile block_listener_ = nullptr;
   uint32_t vol_ = 0;
   int32_t last_sample_ = 0;
   int32_t last_sum_ = 0;
@@ -191,13 +302,18 @@ public:
   int32_t peak_ = 0;
   int32_t num_samples_ = 0;
   int32_t volume_ = BOOT_VOLUME;
+#ifdef ENABLE_AUDIO_LIMITER
+  AudioLimiter limiter_;
+#endif
   POAtomic<uint32_t> underflow_count_;
+  AudioUnderflowEvent underflows_[AUDIO_UNDERFLOW_HISTORY];
   uint32_t last_underflow_count_ = 0;
   uint32_t last_printout_ = 0;
 //  int32_t sum_;
 //  ClickAvoiderLin volume_;
 };
 
-AudioDynamicMixer<NUM_WAV_PLAYERS + 2> dynamic_mixer;
+// Wav players, beeper, talkie and the tails of stolen voices.
+AudioDynamicMixer<NUM_WAV_PLAYERS + 3> dynamic_mixer;
 
 #endif
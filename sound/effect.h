@@ -138,6 +138,9 @@ class Effect {
     file_type_ = file_type;
     next_ = all_effects;
     all_effects = this;
+#ifdef KILL_OLD_PLAYERS
+    priority_ = DefaultPriority();
+#endif
     reset();
   }
 
@@ -151,6 +154,7 @@ class Effect {
     file_pattern_ = FilePattern::UNKNOWN;
     ext_ = UNKNOWN;
     selected_ = -1;
+    prerolled_file_ = -1;
     num_files_ = 0;
     directory_ = nullptr;
     volume_ = 100;
@@ -404,10 +408,19 @@ class Effect {
     } else if (SaberBase::sound_number != -1 &&
 	       (file_type_ == FileType::SOUND || paired_)) {
       n = std::min<int>(SaberBase::sound_number, num_files - 1);
+    } else if (prerolled_file_ != -1) {
+      n = std::min<int>(prerolled_file_, num_files - 1);
     } else {
       n = RANDOMIZE(num_files, last_);
     }
-    int subid = random_subid(n);
+    int subid;
+    if (n == prerolled_file_) {
+      // Already picked by PrerollFile().
+      subid = prerolled_subid_;
+    } else {
+      subid = random_subid(n);
+    }
+    prerolled_file_ = -1;
 
 #ifdef NO_REPEAT_RANDOM
     last_ = n;
@@ -416,6 +429,20 @@ class Effect {
     return FileID(this, n, subid);
   }
 
+  // Picks the file that the next call to RandomFile() will return,
+  // so that it can be read ahead of time. Selected and forced files
+  // (selected_, SaberBase::sound_number) are left out, RandomFile()
+  // still uses those first.
+  FileID PrerollFile() {
+    int num_files = files_found();
+    if (!num_files) return FileID();
+    if (prerolled_file_ == -1) {
+      prerolled_file_ = RANDOMIZE(num_files, last_);
+      prerolled_subid_ = random_subid(prerolled_file_);
+    }
+    return FileID(this, prerolled_file_, prerolled_subid_);
+  }
+
   bool Play(char *filename) {
     FileID f = RandomFile();
     if (f == FileID()) return false;
@@ -492,6 +519,36 @@ class Effect {
 #ifdef KILL_OLD_PLAYERS
   void SetKillable(bool i) { killable_ = i; }
   bool GetKillable() const { return killable_; }
+
+  // When we run out of wav players, sounds can take over players that
+  // play something with lower priority, see voice_allocator.h.
+  enum Priority {
+    PRIORITY_SWING = 1,
+    PRIORITY_BLAST = 2,
+    PRIORITY_CLASH = 3,
+    PRIORITY_HUM = 4,
+  };
+  void SetPriority(uint8_t p) { priority_ = p; }
+  uint8_t GetPriority() const { return priority_; }
+  uint8_t DefaultPriority() const {
+    static const char* const hum[] = {
+      "hum", "humm", "swingl", "swingh", "lswing", "hswing",
+      "lockup", "lock", "drag", "melt", "lb", "armhum", "auto",
+      "preon", "pstoff", "poweron", "poweronf", "poweroff", "pwroff",
+      "in", "out", "fastout", "boot", "font", "bladein", "bladeout",
+      "lowbatt",
+    };
+    static const char* const blast[] = {
+      "blaster", "blst", "blast", "bgnauto", "endauto",
+    };
+    static const char* const swing[] = {
+      "swing", "swng", "slsh", "spin",
+    };
+    for (const char* n : hum) if (!strcmp(name_, n)) return PRIORITY_HUM;
+    for (const char* n : blast) if (!strcmp(name_, n)) return PRIORITY_BLAST;
+    for (const char* n : swing) if (!strcmp(name_, n)) return PRIORITY_SWING;
+    return PRIORITY_CLASH;
+  }
 #endif
 
   const char* GetName() const { return name_; }
@@ -548,8 +605,10 @@ class Effect {
       }
       for (; iter; ++iter) {
 	PVLOG_VERBOSE << " Directory entry: '" << iter.name() << "'\n";
-	if (iter.name()[0] == '.') continue;
 	strcpy(fend, iter.name());
+	PathHelper full_name(font_path_ptr, fname);
+	SDNameCacheAdd(full_name);
+	if (iter.name()[0] == '.') continue;
 	if (iter.isdir()) {
 	  if (ShouldScan(iter.name())) {
 	    LSFS::Iterator i2(iter);
@@ -559,6 +618,10 @@ class Effect {
 	  ScanAll(font_path_ptr, fname);
 	}
       }
+      // Every entry in this directory is in the name cache now.
+      *fend = 0;
+      PathHelper dir_name(font_path_ptr, fname);
+      SDNameCacheAddDirectory(dir_name);
     }
 
   public:
@@ -602,6 +665,7 @@ class Effect {
 
   static void ScanCurrentDirectory() {
     LOCK_SD(true);
+    SDNameCacheClear();
     current_alternative = 0;
     num_alternatives = 0;
     for (Effect* e = all_effects; e; e = e->next_) {
@@ -661,6 +725,8 @@ private:
 #ifdef KILL_OLD_PLAYERS
   // If true, this effect can be cut short.
   bool killable_ : 1;
+
+  uint8_t priority_;
 #endif
 
   // Found in alt directory?
@@ -674,6 +740,10 @@ private:
   // If not -1, return this file.
   int16_t selected_;
 
+  // If not -1, the next random file, picked by PrerollFile().
+  int16_t prerolled_file_;
+  uint8_t prerolled_subid_;
+
   // All files must end with this extension.
   Extension ext_;
 
@@ -1,6 +1,7 @@
 #ifndef SOUND_FILTER_H
 #define SOUND_FILTER_H
 #include <complex>
+#include <type_traits>
 
 namespace Filter {
 
@@ -105,6 +106,89 @@ struct Bilinear {
 };
 
 
+// Equalizer bands, from the Audio EQ Cookbook by Robert Bristow-Johnson.
+// Each is a single biquad with a0 = 1, in the same form as Bilinear.
+// Frequencies are in Hz, gains in dB and Q is multiplied by 100.
+// Shelves use a slope of 1, which is as steep as they go without a bump.
+template<int frequency, int gain_db, int sampling_frequency>
+struct EQBand {
+  static const size_t biquads = 1;
+  static constexpr double gain = 1.0;
+  static constexpr double A() { return pow(10.0, gain_db / 40.0); }
+  static constexpr double w0() { return 2 * M_PI * frequency / sampling_frequency; }
+  static constexpr double cosw0() { return cos(w0()); }
+  static constexpr double shelf_alpha() { return sin(w0()) / 2 * sqrt(2.0); }
+  static constexpr double a0(size_t k) { return 1.0; }
+};
+
+template<int frequency, int gain_db, int q100, int sampling_frequency>
+struct PeakingEQ : public EQBand<frequency, gain_db, sampling_frequency> {
+  typedef EQBand<frequency, gain_db, sampling_frequency> B;
+  static constexpr double alpha() { return sin(B::w0()) / (2 * q100 / 100.0); }
+  static constexpr double norm() { return 1 + alpha() / B::A(); }
+  static constexpr double b0(size_t k) { return (1 + alpha() * B::A()) / norm(); }
+  static constexpr double b1(size_t k) { return -2 * B::cosw0() / norm(); }
+  static constexpr double b2(size_t k) { return (1 - alpha() * B::A()) / norm(); }
+  static constexpr double a1(size_t k) { return -2 * B::cosw0() / norm(); }
+  static constexpr double a2(size_t k) { return (1 - alpha() / B::A()) / norm(); }
+};
+
+template<int frequency, int gain_db, int sampling_frequency>
+struct LowShelf : public EQBand<frequency, gain_db, sampling_frequency> {
+  typedef EQBand<frequency, gain_db, sampling_frequency> B;
+  static constexpr double A() { return B::A(); }
+  static constexpr double c() { return B::cosw0(); }
+  static constexpr double s() { return 2 * sqrt(A()) * B::shelf_alpha(); }
+  static constexpr double norm() { return (A() + 1) + (A() - 1) * c() + s(); }
+  static constexpr double b0(size_t k) { return A() * ((A() + 1) - (A() - 1) * c() + s()) / norm(); }
+  static constexpr double b1(size_t k) { return 2 * A() * ((A() - 1) - (A() + 1) * c()) / norm(); }
+  static constexpr double b2(size_t k) { return A() * ((A() + 1) - (A() - 1) * c() - s()) / norm(); }
+  static constexpr double a1(size_t k) { return -2 * ((A() - 1) + (A() + 1) * c()) / norm(); }
+  static constexpr double a2(size_t k) { return ((A() + 1) + (A() - 1) * c() - s()) / norm(); }
+};
+
+template<int frequency, int gain_db, int sampling_frequency>
+struct HighShelf : public EQBand<frequency, gain_db, sampling_frequency> {
+  typedef EQBand<frequency, gain_db, sampling_frequency> B;
+  static constexpr double A() { return B::A(); }
+  static constexpr double c() { return B::cosw0(); }
+  static constexpr double s() { return 2 * sqrt(A()) * B::shelf_alpha(); }
+  static constexpr double norm() { return (A() + 1) - (A() - 1) * c() + s(); }
+  static constexpr double b0(size_t k) { return A() * ((A() + 1) + (A() - 1) * c() + s()) / norm(); }
+  static constexpr double b1(size_t k) { return -2 * A() * ((A() - 1) + (A() + 1) * c()) / norm(); }
+  static constexpr double b2(size_t k) { return A() * ((A() + 1) + (A() - 1) * c() - s()) / norm(); }
+  static constexpr double a1(size_t k) { return 2 * ((A() - 1) - (A() + 1) * c()) / norm(); }
+  static constexpr double a2(size_t k) { return ((A() + 1) - (A() - 1) * c() - s()) / norm(); }
+};
+
+// Placeholder for bands that are not used.
+struct NoFilter {
+  static const size_t biquads = 0;
+  static constexpr double gain = 1.0;
+  static constexpr double b0(size_t k) { return 1.0; }
+  static constexpr double b1(size_t k) { return 0.0; }
+  static constexpr double b2(size_t k) { return 0.0; }
+  static constexpr double a0(size_t k) { return 1.0; }
+  static constexpr double a1(size_t k) { return 0.0; }
+  static constexpr double a2(size_t k) { return 0.0; }
+};
+
+// Runs several filters one after the other, as one set of biquads.
+template<class... FILTERS> struct Cascade;
+template<class T> struct Cascade<T> : public T {};
+template<class T, class... REST>
+struct Cascade<T, REST...> {
+  typedef Cascade<REST...> R;
+  static const size_t biquads = T::biquads + R::biquads;
+  static constexpr double gain = T::gain * R::gain;
+  static constexpr double b0(size_t k) { return k < T::biquads ? T::b0(k) : R::b0(k - T::biquads); }
+  static constexpr double b1(size_t k) { return k < T::biquads ? T::b1(k) : R::b1(k - T::biquads); }
+  static constexpr double b2(size_t k) { return k < T::biquads ? T::b2(k) : R::b2(k - T::biquads); }
+  static constexpr double a0(size_t k) { return k < T::biquads ? T::a0(k) : R::a0(k - T::biquads); }
+  static constexpr double a1(size_t k) { return k < T::biquads ? T::a1(k) : R::a1(k - T::biquads); }
+  static constexpr double a2(size_t k) { return k < T::biquads ? T::a2(k) : R::a2(k - T::biquads); }
+};
+
 #if 1
 #define FILTER_TYPE float
 
@@ -185,6 +269,7 @@ struct BQ {
 template<class T>
 class Biquad {
  public:
+  static_assert(T::biquads == (FILTER_ORDER + 1) / 2, "Biquad only runs FILTER_ORDER biquads");
   FILTER_TYPE data_[T::biquads + 1][2];
   Biquad() { clear(); }
   void clear() {
@@ -277,6 +362,100 @@ class Biquad {
   }
 };
 
+// Fixed-point version of Biquad, used by the DAC.
+// Coefficients are stored with 30 fractional bits, or fewer if that's
+// needed to fit coefficients of 2 or more, and each biquad is computed
+// in direct form I with a 64-bit accumulator, which compiles into
+// SMULL/SMLAL instructions on Cortex-M. Each biquad is scaled by its
+// share of the overall gain, so that the signal stays at about the same
+// level all the way through. Samples should leave a few bits of headroom
+// for overshoot and boosts.
+//
+// With poles this close to 1, the recursive part of each biquad
+// amplifies rounding errors at low frequencies by several thousand
+// times, so the bits that are shifted out are fed back into the next
+// samples (second order error feedback), which cancels that out.
+template<class T, size_t k>
+struct BQ31 {
+  static constexpr double scale() { return 1.0 / pow(T::gain, 1.0 / T::biquads); }
+  static constexpr double max(double a, double b) { return a > b ? a : b; }
+  static constexpr double largest() {
+    return max(max(max(fabs(T::b0(k) * scale()), fabs(T::b1(k) * scale())),
+		   max(fabs(T::b2(k) * scale()), fabs(T::a1(k)))),
+	       fabs(T::a2(k)));
+  }
+  static constexpr int shift(int bits = 30) {
+    return (bits == 24 || largest() < (double)(1 << (30 - bits)) * 2.0) ? bits : shift(bits - 1);
+  }
+  static constexpr int SHIFT = shift();
+  static constexpr int32_t Q(double x) {
+    return (int32_t)(x * (1 << SHIFT) + (x < 0 ? -0.5 : 0.5));
+  }
+  static constexpr int32_t b0 = Q(T::b0(k) * scale());
+  static constexpr int32_t b1 = Q(T::b1(k) * scale());
+  static constexpr int32_t b2 = Q(T::b2(k) * scale());
+  static constexpr int32_t a1 = Q(-T::a1(k));
+  static constexpr int32_t a2 = Q(-T::a2(k));
+};
+
+template<class T>
+class BiquadQ31 {
+public:
+  // x[n-1], x[n-2], y[n-1], y[n-2] and the last two rounding errors
+  // for each biquad.
+  int32_t state_[T::biquads][6];
+  BiquadQ31() { clear(); }
+  void clear() {
+    for (size_t i = 0; i < T::biquads; i++) {
+      for (size_t j = 0; j < 6; j++) state_[i][j] = 0;
+    }
+  }
+
+  // Filters |n| samples in place, one biquad at a time.
+  void Run(int32_t* inout, int n) {
+    RunBiquad<0>(inout, n);
+  }
+
+private:
+  template<size_t k>
+  typename std::enable_if<k == T::biquads>::type RunBiquad(int32_t* inout, int n) {}
+
+  template<size_t k>
+  typename std::enable_if<k < T::biquads>::type RunBiquad(int32_t* inout, int n) {
+    typedef BQ31<T, k> C;
+    int32_t x1 = state_[k][0];
+    int32_t x2 = state_[k][1];
+    int32_t y1 = state_[k][2];
+    int32_t y2 = state_[k][3];
+    int32_t e1 = state_[k][4];
+    int32_t e2 = state_[k][5];
+    for (int i = 0; i < n; i++) {
+      int32_t x0 = inout[i];
+      int64_t acc = 2 * (int64_t)e1 - e2;
+      acc += (int64_t)x0 * C::b0;
+      acc += (int64_t)x1 * C::b1;
+      acc += (int64_t)x2 * C::b2;
+      acc += (int64_t)y1 * C::a1;
+      acc += (int64_t)y2 * C::a2;
+      int32_t y0 = (int32_t)(acc >> C::SHIFT);
+      e2 = e1;
+      e1 = (int32_t)(acc & ((1 << C::SHIFT) - 1));
+      inout[i] = y0;
+      x2 = x1;
+      x1 = x0;
+      y2 = y1;
+      y1 = y0;
+    }
+    state_[k][0] = x1;
+    state_[k][1] = x2;
+    state_[k][2] = y1;
+    state_[k][3] = y2;
+    state_[k][4] = e1;
+    state_[k][5] = e2;
+    RunBiquad<k + 1>(inout, n);
+  }
+};
+
 }  // namespace Filter
 
 #endif
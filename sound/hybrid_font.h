@@ -88,6 +88,20 @@ public:
       strcpy(x, "volume");
       VolumeVariable var2(e);
       op->run(name, &var2);
+
+#ifdef KILL_OLD_PLAYERS
+      struct PriorityVariable : public VariableBase {
+	Effect* e_;
+	PriorityVariable(Effect* e) : e_(e) {}
+	void set(float value) override { e_->SetPriority(value); }
+	float get() override { return e_->GetPriority(); }
+	void setDefault() override { e_->SetPriority(e_->DefaultPriority());  }
+      };
+
+      strcpy(x, "priority");
+      PriorityVariable var3(e);
+      op->run(name, &var3);
+#endif
     }
   }
   // Igniter compat
@@ -327,10 +341,25 @@ public:
   void Play(Effect* monophonic, Effect* polyphonic) {
     if (polyphonic->files_found()) {
       PlayPolyphonic(polyphonic);
+      sd_prefetcher.Want(polyphonic);
     } else if (SFX_humm) {
       PlayPolyphonic(monophonic);
+      sd_prefetcher.Want(monophonic);
     } else {
       PlayMonophonic(monophonic, &SFX_hum);
+      sd_prefetcher.Want(monophonic);
+    }
+  }
+
+  // Ask for the next clash, blast and swing to be opened ahead of time.
+  void PrefetchEffects() {
+    sd_prefetcher.Want(SFX_clsh ? &SFX_clsh : &SFX_clash);
+    sd_prefetcher.Want(SFX_blst ? &SFX_blst : &SFX_blaster);
+    if (guess_monophonic_) {
+      sd_prefetcher.Want(&SFX_swing);
+      if (monophonic_hum_) sd_prefetcher.Want(&SFX_hum);
+    } else {
+      sd_prefetcher.Want(SFX_swng ? &SFX_swng : &SFX_swing);
     }
   }
 
@@ -380,6 +409,7 @@ public:
 	      effect->SelectFloat(s);
             }
             swing_player_ = PlayPolyphonic(effect);
+            sd_prefetcher.Want(effect);
             swinging_ = true;
           } else {
 #ifdef ENABLE_SPINS
@@ -395,6 +425,7 @@ public:
       } else if (swing_speed > swingThreshold) {
         if (!swinging_) {
           PlayMonophonic(&SFX_swing, &SFX_hum);
+          sd_prefetcher.Want(&SFX_swing);
           swinging_ = true;
         }
 #ifdef ENABLE_SPINS
@@ -446,6 +477,15 @@ public:
   Effect* getOut() { return SFX_out ? &SFX_out : &SFX_poweron; }
   Effect* getHum() { return SFX_humm ? &SFX_humm : &SFX_hum; }
 
+  // SetHumVolume() keeps asking for a hum player until it gets one.
+  // Only take over another sound's player once per hum start, after
+  // that just wait for a free one.
+  RefPtr<BufferedWavPlayer> GetHumPlayer() {
+    if (hum_steal_tried_) return GetFreeWavPlayer();
+    hum_steal_tried_ = true;
+    return GetOrFreeWavPlayer(getHum());
+  }
+
   void SB_Preon() {
     if (SFX_preon) {
       SFX_preon.SetFollowing(getOut());
@@ -491,8 +531,9 @@ public:
       state_ = STATE_HUM_ON;
     } else {
       state_ = STATE_OUT;
+      hum_steal_tried_ = false;
       if (!hum_player_) {
-      	hum_player_ = GetFreeWavPlayer();
+      	hum_player_ = GetHumPlayer();
       	if (hum_player_) {
       	  hum_player_->set_volume_now(0);
 	  hum_player_->PlayOnce(getNext(GetWavPlayerPlaying(getOut()), SFX_humm ? &SFX_humm : &SFX_hum));
@@ -527,6 +568,7 @@ public:
         STDOUT << "humstart: " << font_config.humStart << "\n";
       }
     }
+    PrefetchEffects();
   }
 
   void SB_Off(OffType off_type, EffectLocation location) override {
@@ -620,6 +662,7 @@ public:
 	    SaberBase::sound_number = -1;
 	  }
 	  RestartHum();
+	  PrefetchEffects();
 	}
 	PlayCommon(&SFX_altchng);
 	break;
@@ -772,7 +815,7 @@ public:
   void SetHumVolume(float vol) override {
     if (!monophonic_hum_) {
       if (active_state() && !hum_player_) {
-        hum_player_ = GetFreeWavPlayer();
+        hum_player_ = GetHumPlayer();
         if (hum_player_) {
           hum_player_->set_volume_now(0);
           hum_player_->PlayOnce(SFX_humm ? &SFX_humm : &SFX_hum);
@@ -863,6 +906,7 @@ public:
   uint32_t last_micros_;
   uint32_t last_swing_micros_;
   uint32_t hum_start_;
+  bool hum_steal_tried_ = false;
   float hum_fade_in_;
   float hum_fade_out_;
 #ifdef ENABLE_SPINS
@@ -0,0 +1,86 @@
+#ifndef SOUND_LIMITER_H
+#define SOUND_LIMITER_H
+
+#include <algorithm>
+
+// Look-ahead peak limiter, used by AudioDynamicMixer when
+// ENABLE_AUDIO_LIMITER is defined.
+//
+// Samples are delayed by two blocks. The gain is computed once per block
+// from the peaks of the next two blocks and linearly interpolated in
+// between, so both ends of every ramp are low enough for the loudest
+// sample in the block, and no sample can go over the limit. When the
+// peaks go away, the gain goes back up to the maximum with a time
+// constant of 2^AUDIO_LIMITER_RELEASE blocks.
+
+// Must be power of 2
+#ifndef AUDIO_LIMITER_BLOCK
+#define AUDIO_LIMITER_BLOCK 16
+#endif
+
+#ifndef AUDIO_LIMITER_RELEASE
+#define AUDIO_LIMITER_RELEASE 6
+#endif
+
+class AudioLimiter {
+public:
+  AudioLimiter() { clear(); }
+
+  void clear() {
+    for (int i = 0; i < AUDIO_LIMITER_BLOCK * 2; i++) delay_[i] = 0;
+    pos_ = 0;
+    peak_ = 0;
+    last_peak_ = 0;
+    gain_ = 0;
+    target_ = 0;
+    step_ = 0;
+  }
+
+  // Replaces |samples| with the delayed samples, and fills |gains| with
+  // the gain to use for each of them, with 16 fractional bits.
+  // |max_gain| is the gain used when nothing needs limiting, and
+  // (samples[i] * gains[i]) >> 16 will never be more than |limit|.
+  void Run(int32_t* samples, int32_t* gains, int n, int32_t max_gain, int32_t limit) {
+    for (int i = 0; i < n; i++) {
+      int32_t x = samples[i];
+      samples[i] = delay_[pos_];
+      delay_[pos_] = x;
+      peak_ = std::max<int32_t>(peak_, abs(x));
+      gain_ += step_;
+      gains[i] = gain_;
+      pos_++;
+      if (!(pos_ & (AUDIO_LIMITER_BLOCK - 1))) {
+	pos_ &= AUDIO_LIMITER_BLOCK * 2 - 1;
+	NextBlock(max_gain, limit);
+      }
+    }
+  }
+
+  int32_t gain() const { return gain_; }
+
+private:
+  void NextBlock(int32_t max_gain, int32_t limit) {
+    gain_ = target_;
+    int32_t peak = std::max(peak_, last_peak_);
+    last_peak_ = peak_;
+    peak_ = 0;
+    int32_t target = gain_ + std::max<int32_t>(1, (max_gain - gain_) >> AUDIO_LIMITER_RELEASE);
+    target = std::min(target, max_gain);
+    if ((int64_t)peak * target > ((int64_t)limit << 16)) {
+      target = ((int64_t)limit << 16) / peak;
+    }
+    // Rounds down, so the ramp never goes above the line.
+    step_ = (target - gain_) >> __builtin_ctz(AUDIO_LIMITER_BLOCK);
+    target_ = target;
+  }
+
+  int32_t delay_[AUDIO_LIMITER_BLOCK * 2];
+  int pos_;
+  int32_t peak_;
+  int32_t last_peak_;
+  int32_t gain_;
+  int32_t target_;
+  int32_t step_;
+};
+
+#endif
@@ -0,0 +1,393 @@
+// Checks AudioDynamicMixer and times it. Built twice by the Makefile,
+// once with the compressor and once with ENABLE_AUDIO_LIMITER, so the
+// two can be compared. Also checks how quickly SmoothSwing volumes
+// follow motion, when computed in the main loop and from the mixer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#define PROFFIE_TEST
+#define AUDIO_RATE 44100
+#define AUDIO_BUFFER_SIZE 44
+#define NUM_WAV_PLAYERS 4
+#define BOOT_VOLUME 1024
+#define SCOPED_PROFILER() do {} while(0)
+#define NELEM(X) (sizeof(X)/sizeof((X)[0]))
+
+#define CHECK(X) do {						\
+    if (!(X)) {							\
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #X);	\
+      exit(1);							\
+    }								\
+  } while (0)
+
+uint32_t micros() { return 0; }
+uint32_t millis() { return 0; }
+void noInterrupts() {}
+void interrupts() {}
+void cpu_governor_note_audio_underflow() {}
+int32_t clampi32(int32_t x, int32_t a, int32_t b) {
+  if (x < a) return a;
+  if (x > b) return b;
+  return x;
+}
+int16_t clamptoi16(int32_t x) {
+  return clampi32(x, -32768, 32767);
+}
+float clamp(float x, float a, float b) {
+  if (x < a) return a;
+  if (x > b) return b;
+  return x;
+}
+
+class Looper {
+public:
+  virtual void Loop() = 0;
+  virtual const char* name() = 0;
+  static const char* current_name() { return "test"; }
+};
+
+class CommandParser {
+public:
+  virtual bool Parse(const char* cmd, const char* arg) = 0;
+};
+
+struct Monitoring {
+  enum { MonitorSamples };
+  bool ShouldPrint(int what) { return false; }
+} monitor;
+
+struct FakeStdout {
+  template<class T> FakeStdout& operator<<(T x) { return *this; }
+  template<class T> void print(T x) {}
+  template<class T> void println(T x) {}
+} STDOUT;
+
+#include "audiostream.h"
+#include "dynamic_mixer.h"
+#include "click_avoider_lin.h"
+#include "volume_overlay.h"
+#include "smooth_swing_gains.h"
+
+class SineStream : public ProffieOSAudioStream {
+public:
+  SineStream(float freq, float amplitude) : freq_(freq), amplitude_(amplitude) {}
+  int read(int16_t* data, int elements) override {
+    for (int i = 0; i < elements; i++) {
+      data[i] = amplitude_ * sinf(pos_++ * freq_ * 2 * M_PI / AUDIO_RATE);
+    }
+    return elements;
+  }
+  float freq_;
+  float amplitude_;
+  int pos_ = 0;
+};
+
+// Returns the peak output over |blocks| blocks.
+int32_t Peak(AudioDynamicMixer<NUM_WAV_PLAYERS>* mixer, int blocks) {
+  int32_t peak = 0;
+  for (int b = 0; b < blocks; b++) {
+    int16_t data[AUDIO_BUFFER_SIZE];
+    mixer->read(data, AUDIO_BUFFER_SIZE);
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) peak = std::max<int32_t>(peak, abs(data[i]));
+  }
+  return peak;
+}
+
+void TestLimiter() {
+  // Bursts of noise at random levels, with a limit of 10000.
+  AudioLimiter limiter;
+  srand(1);
+  int32_t max_out = 0;
+  int64_t total_gain = 0;
+  int samples = 0;
+  for (int b = 0; b < 2000; b++) {
+    int32_t level = (b % 50) < 25 ? 500 : rand() % 100000;
+    int32_t s[AUDIO_BUFFER_SIZE];
+    int32_t g[AUDIO_BUFFER_SIZE];
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) s[i] = rand() % (2 * level + 1) - level;
+    limiter.Run(s, g, AUDIO_BUFFER_SIZE, 2 << 16, 10000);
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+      max_out = std::max<int32_t>(max_out, abs((int64_t)s[i] * g[i] >> 16));
+      total_gain += g[i];
+      samples++;
+    }
+  }
+  fprintf(stderr, "limiter: max output = %d, average gain = %.3f\n",
+	  max_out, total_gain / 65536.0 / samples);
+  CHECK(max_out <= 10000);
+
+  // Quiet signals get the full gain, once the gain has come up.
+  for (int b = 0; b < 300; b++) {
+    int32_t s[AUDIO_BUFFER_SIZE];
+    int32_t g[AUDIO_BUFFER_SIZE];
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) s[i] = 1000;
+    limiter.Run(s, g, AUDIO_BUFFER_SIZE, 2 << 16, 10000);
+  }
+  CHECK(limiter.gain() == 2 << 16);
+}
+
+void TestMixer() {
+  AudioDynamicMixer<NUM_WAV_PLAYERS> mixer;
+  SineStream quiet(440, 1000);
+  mixer.streams_[0] = &quiet;
+  Peak(&mixer, 100);
+  int32_t quiet_peak = Peak(&mixer, 100);
+  // Four loud streams at once, like a clash on top of swings.
+  SineStream loud1(220, 30000), loud2(330, 30000), loud3(550, 30000);
+  mixer.streams_[1] = &loud1;
+  mixer.streams_[2] = &loud2;
+  mixer.streams_[3] = &loud3;
+  int32_t loud_peak = Peak(&mixer, 100);
+  fprintf(stderr, "mixer: quiet peak = %d, loud peak = %d\n", quiet_peak, loud_peak);
+  CHECK(loud_peak > quiet_peak);
+#ifdef ENABLE_AUDIO_LIMITER
+  // Volume 1024 is unity gain.
+  CHECK(abs(quiet_peak - 1000) < 5);
+  CHECK(loud_peak <= 32767);
+#endif
+}
+
+// SmoothSwing defaults, from smooth_swing_config.h.
+struct TestSwingConfig {
+  float SwingSensitivity = 450.0f;
+  float MaximumHumDucking = 75.0f;
+  float SwingSharpness = 1.75f;
+  float SwingStrengthThreshold = 20.0f;
+  float Transition1Degrees = 45.0f;
+  float Transition2Degrees = 160.0f;
+  float MaxSwingVolume = 3.0f;
+};
+
+class LevelStream : public ProffieOSAudioStream {
+public:
+  int read(int16_t* data, int elements) override {
+    for (int i = 0; i < elements; i++) data[i] = 1000;
+    return elements;
+  }
+};
+typedef VolumeOverlay<LevelStream> TestSwingPlayer;
+
+// The volume handling of SmoothSwingV2, with the two ways of running it.
+class SwingSim : public AudioBlockListener {
+public:
+  SwingSim(bool block_rate) : block_rate_(block_rate) {
+    gains_.SetTransitions(30.0, config_.Transition1Degrees, config_.Transition2Degrees);
+    players_[0].set_volume_now(0.0f);
+    players_[1].set_volume_now(0.0f);
+  }
+  // Main loop, like SB_Motion().
+  void Motion(float speed, float seconds) {
+    if (block_rate_) {
+      speed_ = speed;
+    } else {
+      Run(speed, seconds, 0);
+    }
+  }
+  void AudioBlock(int samples) override {
+    if (block_rate_) Run(speed_, samples * (1.0f / AUDIO_RATE), samples);
+  }
+  float volume(int player) { return players_[player].volume(); }
+
+  TestSwingPlayer players_[2];
+
+private:
+  void Run(float speed, float seconds, int samples) {
+    if (!on_ && speed < config_.SwingStrengthThreshold) return;
+    if (speed < config_.SwingStrengthThreshold * 0.9) {
+      on_ = false;
+      SetVolume(0, 0.0, samples);
+      SetVolume(1, 0.0, samples);
+      return;
+    }
+    on_ = true;
+    gains_.Update(speed, seconds, config_);
+    SetVolume(gains_.a(), gains_.mixhum * gains_.mixab, samples);
+    SetVolume(!gains_.a(), gains_.mixhum * (1.0 - gains_.mixab), samples);
+  }
+  void SetVolume(int player, float volume, int samples) {
+    if (samples) {
+      players_[player].set_volume_over(volume, samples);
+    } else {
+      players_[player].set_volume(volume);
+    }
+  }
+
+  bool block_rate_;
+  bool on_ = false;
+  float speed_ = 0.0;
+  TestSwingConfig config_;
+  SmoothSwingGains gains_;
+};
+
+// A swing, in degrees per second, one value per millisecond like
+// CallMotion() delivers them: still, a fast swing, and still again.
+float SwingMotion(int ms) {
+  if (ms < 50) return 0.0;
+  if (ms < 110) return 400.0 * powf(sinf((ms - 50) * M_PI / 120), 2);
+  if (ms < 250) return 400.0;
+  if (ms < 310) return 400.0 * powf(cosf((ms - 250) * M_PI / 120), 2);
+  return 0.0;
+}
+
+struct SwingResult {
+  // From the motion reaching the swing threshold, and from the main loop
+  // seeing it, to the first change in volume. In samples.
+  int latency;
+  int latency_after_motion;
+  // Largest change in volume of either swing sound from one block to
+  // the next, while the swing speed is constant. This is the crossfade.
+  float max_step;
+};
+
+// Runs the main loop every |loop_ms| milliseconds, starting at |phase_ms|.
+SwingResult RunSwing(bool block_rate, float loop_ms, float phase_ms) {
+  TestSwingConfig config;
+  AudioDynamicMixer<NUM_WAV_PLAYERS> mixer;
+  SwingSim sim(block_rate);
+  mixer.streams_[0] = &sim.players_[0];
+  mixer.streams_[1] = &sim.players_[1];
+  mixer.set_block_listener(&sim);
+
+  int threshold_ms = 0;
+  while (SwingMotion(threshold_ms) < config.SwingStrengthThreshold) threshold_ms++;
+  int threshold_sample = threshold_ms * AUDIO_RATE / 1000;
+  int seen_sample = -1;
+  int changed_sample = -1;
+
+  float next_loop = phase_ms;
+  float last_loop = 0.0;
+  float last_volume[2] = { 0.0, 0.0 };
+  SwingResult result = {};
+  for (int sample = 0; sample < AUDIO_RATE * 4 / 10; sample += AUDIO_BUFFER_SIZE) {
+    float now = sample * 1000.0f / AUDIO_RATE;
+    while (next_loop <= now) {
+      float speed = SwingMotion(next_loop);
+      if (seen_sample < 0 && speed >= config.SwingStrengthThreshold) {
+	seen_sample = next_loop * AUDIO_RATE / 1000;
+      }
+      sim.Motion(speed, (next_loop - last_loop) / 1000.0);
+      last_loop = next_loop;
+      next_loop += loop_ms;
+    }
+    int16_t data[AUDIO_BUFFER_SIZE];
+    mixer.read(data, AUDIO_BUFFER_SIZE);
+    for (int p = 0; p < 2; p++) {
+      float volume = sim.volume(p);
+      if (changed_sample < 0 && volume > 0.0) changed_sample = sample;
+      if (now > 130 && now < 250) {
+	result.max_step = std::max(result.max_step, fabsf(volume - last_volume[p]));
+      }
+      last_volume[p] = volume;
+    }
+  }
+  CHECK(seen_sample >= 0);
+  CHECK(changed_sample >= 0);
+  result.latency = changed_sample - threshold_sample;
+  result.latency_after_motion = changed_sample - seen_sample;
+  return result;
+}
+
+void TestSwingLatency() {
+  float block_steps[3];
+  float loop_steps[3];
+  const float loop_ms[3] = { 1.0, 5.0, 20.0 };
+  for (int l = 0; l < 3; l++) {
+    block_steps[l] = loop_steps[l] = 0.0;
+    int min_latency[2] = { 1 << 30, 1 << 30 };
+    int max_latency[2] = { 0, 0 };
+    for (float phase = 0.0; phase < loop_ms[l]; phase += loop_ms[l] / 8) {
+      for (int block_rate = 0; block_rate < 2; block_rate++) {
+	SwingResult r = RunSwing(block_rate, loop_ms[l], phase);
+	min_latency[block_rate] = std::min(min_latency[block_rate], r.latency);
+	max_latency[block_rate] = std::max(max_latency[block_rate], r.latency);
+	if (block_rate) {
+	  block_steps[l] = std::max(block_steps[l], r.max_step);
+	  // Volumes change in the first block after SB_Motion sees the swing.
+	  CHECK(r.latency_after_motion <= AUDIO_BUFFER_SIZE * 2);
+	} else {
+	  loop_steps[l] = std::max(loop_steps[l], r.max_step);
+	}
+      }
+    }
+    fprintf(stderr, "swing, loop every %4.1f ms: latency %.2f-%.2f ms, largest step %.3f;"
+	    " block rate: latency %.2f-%.2f ms, largest step %.3f\n",
+	    loop_ms[l],
+	    min_latency[0] * 1000.0 / AUDIO_RATE, max_latency[0] * 1000.0 / AUDIO_RATE, loop_steps[l],
+	    min_latency[1] * 1000.0 / AUDIO_RATE, max_latency[1] * 1000.0 / AUDIO_RATE, block_steps[l]);
+  }
+  // With a slow main loop, computing the volumes in the main loop makes
+  // the crossfade move in big steps, but not when computed once per block.
+  CHECK(block_steps[2] < loop_steps[2] / 2);
+  CHECK(block_steps[2] < block_steps[0] * 2);
+}
+
+void Benchmark() {
+  AudioDynamicMixer<NUM_WAV_PLAYERS> mixer;
+  SineStream a(220, 10000), b(330, 10000), c(440, 10000), d(550, 10000);
+  mixer.streams_[0] = &a;
+  mixer.streams_[1] = &b;
+  mixer.streams_[2] = &c;
+  mixer.streams_[3] = &d;
+  // Pre-render the streams, so only the mixer is timed.
+  const int blocks = 1000;
+  static int16_t input[NUM_WAV_PLAYERS][blocks * AUDIO_BUFFER_SIZE];
+  for (int i = 0; i < NUM_WAV_PLAYERS; i++) {
+    mixer.streams_[i]->read(input[i], blocks * AUDIO_BUFFER_SIZE);
+  }
+  class Replay : public ProffieOSAudioStream {
+  public:
+    int read(int16_t* data, int elements) override {
+      memcpy(data, data_ + pos_, elements * sizeof(int16_t));
+      pos_ = (pos_ + elements) % (blocks * AUDIO_BUFFER_SIZE);
+      return elements;
+    }
+    int16_t* data_;
+    int pos_ = 0;
+  } replay[NUM_WAV_PLAYERS];
+  for (int i = 0; i < NUM_WAV_PLAYERS; i++) {
+    replay[i].data_ = input[i];
+    mixer.streams_[i] = replay + i;
+  }
+
+  int16_t data[AUDIO_BUFFER_SIZE];
+  float fdata[AUDIO_BUFFER_SIZE];
+  int32_t check = 0;
+  const int runs = 20000;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < runs; r++) {
+    mixer.read(data, AUDIO_BUFFER_SIZE);
+    check += data[r % AUDIO_BUFFER_SIZE];
+  }
+  std::chrono::duration<double, std::nano> int_time = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < runs; r++) {
+    mixer.read(fdata, AUDIO_BUFFER_SIZE);
+    check += fdata[r % AUDIO_BUFFER_SIZE];
+  }
+  std::chrono::duration<double, std::nano> float_time = std::chrono::steady_clock::now() - start;
+
+#ifdef ENABLE_AUDIO_LIMITER
+  const char* mode = "limiter";
+#else
+  const char* mode = "compressor";
+#endif
+  // Print something that depends on the results, so the loops stay.
+  fprintf(stderr, "%s: int16: %.2f ns/sample, float: %.2f ns/sample (%d)\n",
+	  mode,
+	  int_time.count() / runs / AUDIO_BUFFER_SIZE,
+	  float_time.count() / runs / AUDIO_BUFFER_SIZE,
+	  check);
+}
+
+int main() {
+  TestLimiter();
+  TestMixer();
+  TestSwingLatency();
+  Benchmark();
+}
@@ -4,6 +4,7 @@
 #include "../common/file_reader.h"
 #include "../common/state_machine.h"
 #include "audiostream.h"
+#include "prefetcher.h"
 
 // Simple upsampler code, doubles the number of samples with
 // 2-lobe lanczos upsampling.
@@ -199,7 +200,11 @@ private:
 
   int ReadFile(int n) {
     SCOPED_PROFILER();
-    return file_.Read(buffer + 8, n);
+    TRACE_SCOPE(SD, SD_READ, n);
+    uint32_t start = micros();
+    int ret = file_.Read(buffer + 8, n);
+    last_sd_read_micros = micros() - start;
+    return ret;
   }
 
   void loop() {
@@ -217,6 +222,10 @@ private:
         // Minor optimization: If we're reading the same file
         // as before, then seek to 0 instead of open/close file.
         file_.Rewind();
+        // Most likely a looping hum, keep the start of it in the block cache.
+        file_.SetLooping(true);
+      } else if (sd_prefetcher.Take(new_file_id_, &file_)) {
+        old_file_id_ = new_file_id_;
       } else {
 	if (!file_.OpenFast(filename_)) {
 	  default_output->print("File ");
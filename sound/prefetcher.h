@@ -0,0 +1,167 @@
+#ifndef SOUND_PREFETCHER_H
+#define SOUND_PREFETCHER_H
+
+// Read-ahead for sound effects.
+//
+// While the saber is on, the next sounds are quite predictable: another
+// clash, blast or swing from the current font, or the hum that follows.
+// The font tells the prefetcher which effects are likely to come next with
+// Want(), which picks the next file of the effect ahead of time (see
+// Effect::PrerollFile()). When the SD card is otherwise idle, the
+// prefetcher opens those files and, if the SD block cache is enabled,
+// reads the first SD_PREFETCH_BLOCKS blocks into it, even for files that
+// are too large for the cache otherwise. When PlayWav starts one of the
+// files, it takes over the open file instead of opening it again, and
+// reads those blocks from the cache, so the sound can start without
+// waiting for the directory lookup and first read.
+//
+// All SD access happens from FillBuffer(), which only runs when all
+// other audio streams have full buffers.
+
+#if defined(ENABLE_SD_PREFETCH) && !defined(ENABLE_SD)
+#undef ENABLE_SD_PREFETCH
+#endif
+
+#ifdef ENABLE_SD_PREFETCH
+
+#include "../common/circular_buffer.h"
+#include "audio_stream_work.h"
+
+// Number of files that can be kept open ahead of time.
+#ifndef SD_PREFETCH_FILES
+#define SD_PREFETCH_FILES 4
+#endif
+
+// Number of 512-byte blocks to read into the SD block cache for each file.
+#ifndef SD_PREFETCH_BLOCKS
+#define SD_PREFETCH_BLOCKS 2
+#endif
+
+class Prefetcher : public AudioStreamWork {
+public:
+  // Called from the main loop.
+  void Want(Effect::FileID id) {
+    if (!id || !wanted_.space_available()) return;
+    wanted_.next() = id;
+    wanted_.push();
+    scheduleFillBuffer();
+  }
+  void Want(Effect* effect) {
+    if (*effect) Want(effect->PrerollFile());
+  }
+
+  // Called from PlayWav, in the same context as FillBuffer().
+  // If |id| has been prefetched, the open file is moved to |file|.
+  bool Take(const Effect::FileID& id, FileReader* file) {
+    for (Slot& slot : slots_) {
+      if (slot.ready && slot.id == id) {
+        file->Take(&slot.file);
+        file->Rewind();
+        slot.ready = false;
+        slot.id = Effect::FileID();
+        open_files_--;
+        hits_++;
+        return true;
+      }
+    }
+    misses_++;
+    return false;
+  }
+
+  void ResetStats() { hits_ = misses_ = 0; }
+  uint32_t hits() const { return hits_; }
+  uint32_t misses() const { return misses_; }
+  int ready_files() const {
+    int ret = 0;
+    for (const Slot& slot : slots_) if (slot.ready) ret++;
+    return ret;
+  }
+
+protected:
+  // Only asks for time when there is something to do, and then only
+  // a little, so the wav players are always served first.
+  size_t space_available() override {
+    if (!SaberBase::IsOn()) return open_files_ ? 1 : 0;
+    return wanted_.empty() ? 0 : 1;
+  }
+
+  bool FillBuffer() override {
+    if (!SaberBase::IsOn()) {
+      while (!wanted_.empty()) wanted_.pop();
+      CloseFiles();
+      return false;
+    }
+    if (wanted_.empty()) return false;
+    Effect::FileID id = wanted_.pop();
+    for (Slot& slot : slots_) {
+      if (slot.id == id) return true;
+    }
+    // Use a free slot if there is one, otherwise take turns.
+    Slot* slot = nullptr;
+    for (Slot& s : slots_) {
+      if (!s.ready) {
+        slot = &s;
+        break;
+      }
+    }
+    if (!slot) {
+      slot = slots_ + next_slot_;
+      next_slot_ = (next_slot_ + 1) % NELEM(slots_);
+    }
+    Close(slot);
+    char filename[128];
+    id.GetName(filename);
+    if (!slot->file.OpenFast(filename)) return true;
+    open_files_++;
+#ifdef ENABLE_SD_BLOCK_CACHE
+    slot->file.CacheHead(SD_PREFETCH_BLOCKS);
+    uint8_t tmp[SDBlockCache::BLOCK_SIZE];
+    for (int i = 0; i < SD_PREFETCH_BLOCKS; i++) {
+      if (slot->file.Read(tmp, sizeof(tmp)) != sizeof(tmp)) break;
+    }
+#endif
+    slot->id = id;
+    slot->ready = true;
+    return true;
+  }
+
+  void CloseFiles() override {
+    for (Slot& slot : slots_) Close(&slot);
+  }
+
+private:
+  struct Slot {
+    FileReader file;
+    Effect::FileID id;
+    bool ready = false;
+  };
+
+  void Close(Slot* slot) {
+    if (slot->file.IsOpen()) open_files_--;
+    slot->file.Close();
+    slot->id = Effect::FileID();
+    slot->ready = false;
+  }
+
+  Slot slots_[SD_PREFETCH_FILES];
+  CircularBuffer<Effect::FileID, 8> wanted_;
+  size_t next_slot_ = 0;
+  int open_files_ = 0;
+  uint32_t hits_ = 0;
+  uint32_t misses_ = 0;
+};
+
+#else  // ENABLE_SD_PREFETCH
+
+class Prefetcher {
+public:
+  void Want(Effect::FileID id) {}
+  void Want(Effect* effect) {}
+  bool Take(const Effect::FileID& id, FileReader* file) { return false; }
+};
+
+#endif  // ENABLE_SD_PREFETCH
+
+Prefetcher sd_prefetcher;
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef SOUND_SMOOTH_SWING_GAINS_H
+#define SOUND_SMOOTH_SWING_GAINS_H
+
+// The part of SmoothSwing V2 that turns rotation into volumes for the
+// two swing sounds and the hum. It doesn't know about players or
+// fonts, so it can run from the audio interrupt when
+// ENABLE_BLOCK_RATE_SMOOTHSWING is defined.
+class SmoothSwingGains {
+public:
+  struct Transition {
+    float begin() const { return midpoint - width / 2; }
+    float end() const { return midpoint + width / 2; }
+    float midpoint = 0.0;
+    float width = 0.0;
+  };
+
+  // Swing sound A fades out during its transition, while B fades in.
+  // When A's transition is done, A and B trade places, so a() tells
+  // which of the two sounds is currently A.
+  Transition& A() { return transitions_[a_]; }
+  Transition& B() { return transitions_[!a_]; }
+  int a() const { return a_; }
+  void Swap() { a_ = !a_; }
+
+  // The second transition starts 180 degrees after the first one.
+  void SetTransitions(float offset, float width1, float width2) {
+    A().midpoint = offset;
+    A().width = width1;
+    B().midpoint = offset + 180.0;
+    B().width = width2;
+  }
+
+  // |speed| is in degrees per second.
+  template<class CONFIG>
+  void Update(float speed, float seconds, const CONFIG& config) {
+    swing_strength = std::min<float>(1.0, speed / config.SwingSensitivity);
+    A().midpoint -= speed * seconds;
+    // If the current transition is done, switch A & B,
+    // and set the next transition to be 180 degrees from the one
+    // that is done.
+    while (A().end() < 0.0) {
+      B().midpoint = A().midpoint + 180.0;
+      Swap();
+    }
+    mixab = 0.0;
+    if (A().begin() < 0.0)
+      mixab = clamp(- A().begin() / A().width, 0.0, 1.0);
+
+    mixhum = powf(swing_strength, config.SwingSharpness);
+    hum_volume = 1.0 - mixhum * config.MaximumHumDucking / 100.0;
+    mixhum *= config.MaxSwingVolume;
+  }
+
+  float swing_strength = 0.0;
+  // How much of the swing volume goes to A, the rest goes to B.
+  float mixab = 0.0;
+  // Swing volume.
+  float mixhum = 0.0;
+  float hum_volume = 1.0;
+
+private:
+  Transition transitions_[2];
+  int a_ = 0;
+};
+
+#endif
@@ -1,11 +1,24 @@
 #ifndef SOUND_SMOOTH_SWING_V2_H
 #define SOUND_SMOOTH_SWING_V2_H
 
+#include "smooth_swing_gains.h"
+
 // SmoothSwing V2, based on Thexter's excellent work.
 // For more details, see:
 // http://therebelarmory.com/thread/9138/smoothswing-v2-algorithm-description
 //
-class SmoothSwingV2 : public SaberBasePassThrough {
+// Normally the swing volumes are computed in the main loop, whenever
+// there is new motion data. With ENABLE_BLOCK_RATE_SMOOTHSWING defined,
+// the main loop just stores the latest swing speed, and the volumes are
+// computed once per audio block from the mixer and ramped across the
+// block. The speed still only changes as often as the main loop runs,
+// but the crossfade moves by audio time, so it stays smooth when the
+// main loop is busy, and new speeds are heard within one block.
+class SmoothSwingV2 : public SaberBasePassThrough
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+                    , public AudioBlockListener
+#endif
+{
 public:
   SmoothSwingV2() : SaberBasePassThrough() {}
 
@@ -19,6 +32,9 @@ public:
       H = &SFX_hswing;
     }
     SetDelegate(base_font);
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+    dynamic_mixer.set_block_listener(this);
+#endif
     if (L->files_found() != H->files_found()) {
       STDOUT.println("Warning, swingl and swingh should have the same number of files.");
     }
@@ -46,15 +62,12 @@ public:
   }
 
   void Deactivate() {
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+    dynamic_mixer.set_block_listener(nullptr);
+#endif
     SetDelegate(NULL);
-    A.Free();
-    B.Free();
-  }
-
-  void Swap() {
-    Data C = A;
-    A = B;
-    B = C;
+    A().Free();
+    B().Free();
   }
 
   // Should only be done when the volume is near zero.
@@ -65,20 +78,27 @@ public:
     if (!humplayer) return;
     float start = (font_config.ProffieOSSmoothSwingHumstart == 0) ? m / 1000.0 : humplayer->pos();
     // No point in picking a new random so soon after picking one.
-    if (A.player && m - last_random_ < 1000) return;
+    if (A().player && m - last_random_ < 1000) return;
     last_random_ = m;
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+    // Keep the audio interrupt away until we're done.
+    ready_ = false;
+#endif
     int swing = random(L->files_found());
-    A.Stop();
-    B.Stop();
+    A().Stop();
+    B().Stop();
     L->Select(swing);
     H->Select(swing);
-    A.Play(L, start);
-    B.Play(H, start);
-    if (random(2)) Swap();
+    A().Play(L, start);
+    B().Play(H, start);
+    if (random(2)) gains_.Swap();
     float t1_offset = random(1000) / 1000.0 * 50 + 10;
-    A.SetTransition(t1_offset, smooth_swing_config.Transition1Degrees);
-    B.SetTransition(t1_offset + 180.0,
+    gains_.SetTransitions(t1_offset,
+      smooth_swing_config.Transition1Degrees,
       smooth_swing_config.Transition2Degrees);
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+    ready_ = true;
+#endif
   }
 
   void SB_On(EffectLocation location) override {
@@ -89,8 +109,12 @@ public:
   }
   void SB_Off(OffType off_type, EffectLocation location) override {
     on_ = false;
-    A.Off();
-    B.Off();
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+    // AudioBlock() does nothing while off, don't leave the hum ducked.
+    hum_volume_ = 1.0;
+#endif
+    A().Off();
+    B().Off();
     delegate_->SB_Off(off_type, location);
   }
 
@@ -100,12 +124,102 @@ public:
     OUT, // Waiting for sound to fade out
   };
 
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+  void SB_Motion(const Vec3& raw_gyro, bool clear) override {
+    if (clear) {
+      gyro_filter_.filter(raw_gyro);
+      gyro_filter_.filter(raw_gyro);
+    }
+    Vec3 gyro = gyro_filter_.filter(raw_gyro);
+    // degrees per second
+    float speed = sqrtf(gyro.z * gyro.z + gyro.y * gyro.y);
+    speed_ = speed;
+    if (monitor.ShouldPrint(Monitoring::MonitorSwings)) {
+      STDOUT.print("speed: ");
+      STDOUT.print(speed);
+      STDOUT.print("  hum_volume: ");
+      STDOUT.println(hum_volume_);
+    }
+
+    // AudioBlock() turns swings on and off, this just does the
+    // things that can't be done from an interrupt.
+    switch (state_) {
+      case SwingState::OFF:
+	if (!A().player || !B().player) {
+	  PickRandomSwing();
+	}
+	break;
+
+      case SwingState::ON:
+        // trigger accent swing
+        if (accent_swings_present && (A().isPlaying() || B().isPlaying())) {
+          delegate_->StartSwing(gyro, smooth_swing_config.AccentSwingSpeedThreshold,
+          smooth_swing_config.AccentSlashAccelerationThreshold);
+        }
+        if (on_ && speed >= smooth_swing_config.SwingStrengthThreshold * 0.9) {
+          // Accent swings duck the smooth swings.
+          float swing_strength =
+            std::min<float>(1.0, speed / smooth_swing_config.SwingSensitivity);
+          duck_ = delegate_->SetSwingVolume(swing_strength, 1.0);
+        }
+        break;
+
+      case SwingState::OUT:
+        // The mixer may not have finished the ramp yet.
+        if (!A().isOff() || !B().isOff()) {
+          if (monitor.ShouldPrint(Monitoring::MonitorSwings)) {
+            STDOUT.println("Waiting for volume = 0");
+          }
+          break;
+        }
+        PickRandomSwing();
+        state_ = SwingState::OFF;
+    }
+    // Must always set hum volume, or fade-out doesn't work.
+    delegate_->SetHumVolume(hum_volume_);
+  }
+
+  // Called from the audio interrupt, before each block is mixed.
+  void AudioBlock(int samples) override {
+    if (!ready_ || !on_) return;
+    float speed = speed_;
+    switch (state_) {
+      case SwingState::OFF:
+        if (speed < smooth_swing_config.SwingStrengthThreshold) return;
+        state_ = SwingState::ON;
+
+      case SwingState::ON:
+        if (speed >= smooth_swing_config.SwingStrengthThreshold * 0.9) {
+          gains_.Update(speed, samples * (1.0f / AUDIO_RATE), smooth_swing_config);
+          float mixhum = gains_.mixhum * duck_;
+          A().set_volume_over(mixhum * gains_.mixab, samples);
+          B().set_volume_over(mixhum * (1.0 - gains_.mixab), samples);
+          hum_volume_ = gains_.hum_volume;
+          return;
+        }
+        A().set_volume_over(0.0, samples);
+        B().set_volume_over(0.0, samples);
+        hum_volume_ = 1.0;
+        state_ = SwingState::OUT;
+
+      case SwingState::OUT:
+        // Waiting for SB_Motion to pick a new swing.
+        return;
+    }
+  }
+#else
   void SB_Motion(const Vec3& raw_gyro, bool clear) override {
     if (clear) {
       gyro_filter_.filter(raw_gyro);
       gyro_filter_.filter(raw_gyro);
     }
     Vec3 gyro = gyro_filter_.filter(raw_gyro);
+    if (cpu_governor_level() >= GOVERNOR_SLOW_SMOOTHSWING &&
+        state_ != SwingState::OUT && (++skipped_updates_ & 1)) {
+      // Rotation is based on time since last update, so skipping
+      // every other update just makes the volume changes coarser.
+      return;
+    }
     // degrees per second
     // May not need to smooth gyro since volume is smoothed.
     float speed = sqrtf(gyro.z * gyro.z + gyro.y * gyro.y);
@@ -117,7 +231,7 @@ public:
 
     switch (state_) {
       case SwingState::OFF:
-	if (!A.player || !B.player) {
+	if (!A().player || !B().player) {
 	  PickRandomSwing();
 	}
         if (speed < smooth_swing_config.SwingStrengthThreshold) {
@@ -133,32 +247,16 @@ public:
 
       case SwingState::ON:
         // trigger accent swing
-        if (accent_swings_present && (A.isPlaying() || B.isPlaying())) {
+        if (accent_swings_present && (A().isPlaying() || B().isPlaying())) {
           delegate_->StartSwing(gyro, smooth_swing_config.AccentSwingSpeedThreshold,
           smooth_swing_config.AccentSlashAccelerationThreshold);
         }
         if (speed >= smooth_swing_config.SwingStrengthThreshold * 0.9) {
-          float swing_strength =
-            std::min<float>(1.0, speed / smooth_swing_config.SwingSensitivity);
-          A.rotate(-speed * delta / 1000000.0);
-          // If the current transition is done, switch A & B,
-          // and set the next transition to be 180 degrees from the one
-          // that is done.
-          while (A.end() < 0.0) {
-            B.midpoint = A.midpoint + 180.0;
-	    Swap();
-          }
-          float mixab = 0.0;
-          if (A.begin() < 0.0)
-            mixab = clamp(- A.begin() / A.width, 0.0, 1.0);
-
-          float mixhum =
-            powf(swing_strength, smooth_swing_config.SwingSharpness);
-
-          hum_volume =
-            1.0 - mixhum * smooth_swing_config.MaximumHumDucking / 100.0;
-
-          mixhum *= smooth_swing_config.MaxSwingVolume;
+          gains_.Update(speed, delta / 1000000.0, smooth_swing_config);
+          float swing_strength = gains_.swing_strength;
+          float mixab = gains_.mixab;
+          float mixhum = gains_.mixhum;
+          hum_volume = gains_.hum_volume;
 
           if (monitor.ShouldPrint(Monitoring::MonitorSwings)) {
             STDOUT.print("speed: ");
@@ -166,11 +264,11 @@ public:
             STDOUT.print(" R: ");
             STDOUT.print(-speed * delta / 1000000.0);
             STDOUT.print(" MP: ");
-            STDOUT.print(A.midpoint);
+            STDOUT.print(gains_.A().midpoint);
             STDOUT.print(" B: ");
-            STDOUT.print(A.begin());
+            STDOUT.print(gains_.A().begin());
             STDOUT.print(" E: ");
-            STDOUT.print(A.end());
+            STDOUT.print(gains_.A().end());
             STDOUT.print("  mixhum: ");
             STDOUT.print(mixhum);
             STDOUT.print("  mixab: ");
@@ -181,17 +279,17 @@ public:
           if (on_) {
             // We need to stop setting the volume when off, or playback may never stop.
             mixhum = delegate_->SetSwingVolume(swing_strength, mixhum);
-            A.set_volume(mixhum * mixab);
-            B.set_volume(mixhum * (1.0 - mixab));
+            A().set_volume(mixhum * mixab);
+            B().set_volume(mixhum * (1.0 - mixab));
           }
           break;
         }
-        A.set_volume(0);
-        B.set_volume(0);
+        A().set_volume(0);
+        B().set_volume(0);
         state_ = SwingState::OUT;
 
       case SwingState::OUT:
-        if (!A.isOff() || !B.isOff()) {
+        if (!A().isOff() || !B().isOff()) {
           if (monitor.ShouldPrint(Monitoring::MonitorSwings)) {
             Serial.println("Waiting for volume = 0");
           }
@@ -202,12 +300,16 @@ public:
     // Must always set hum volume, or fade-out doesn't work.
     delegate_->SetHumVolume(hum_volume);
   }
+#endif
 
 private:
   struct Data {
     void set_volume(float v) {
       if (player) player->set_volume(v);
     }
+    void set_volume_over(float v, int samples) {
+      if (player) player->set_volume_over(v, samples);
+    }
     void Play(Effect* effect, float start = 0.0) {
       if (!player) {
 	player = GetFreeWavPlayer();
@@ -238,21 +340,13 @@ private:
       if (!player) return true;
       return player->isOff();
     }
-    void SetTransition(float mp, float w) {
-      midpoint = mp;
-      width = w;
-    }
-    float begin() const { return midpoint - width / 2; }
-    float end() const { return midpoint + width / 2; }
-    void rotate(float degrees) {
-      midpoint += degrees;
-    }
     RefPtr<BufferedWavPlayer> player;
-    float midpoint = 0.0;
-    float width = 0.0;
   };
-  Data A;
-  Data B;
+  // The players for the two swing sounds, gains_ decides which is A.
+  Data players_[2];
+  Data& A() { return players_[gains_.a()]; }
+  Data& B() { return players_[!gains_.a()]; }
+  SmoothSwingGains gains_;
 
   uint32_t last_random_ = 0;
   bool on_ = false;;
@@ -260,7 +354,17 @@ private:
   bool accent_slashes_present = false;
   BoxFilter<Vec3, 3> gyro_filter_;
   uint32_t last_micros_;
+  uint8_t skipped_updates_ = 0;
+#ifdef ENABLE_BLOCK_RATE_SMOOTHSWING
+  // Shared with the audio interrupt.
+  volatile SwingState state_ = SwingState::OFF;
+  volatile bool ready_ = false;
+  volatile float speed_ = 0.0;
+  volatile float duck_ = 1.0;
+  volatile float hum_volume_ = 1.0;
+#else
   SwingState state_ = SwingState::OFF;;
+#endif
   Effect *L, *H;
 };
 
@@ -50,40 +50,65 @@ RefPtr<BufferedWavPlayer> GetWavPlayerPlaying(const Effect* effect) {
 }
 
 #ifdef KILL_OLD_PLAYERS
-RefPtr<BufferedWavPlayer> GetOrFreeWavPlayer(Effect* e)  {
-  if (!e->GetFollowing() && !e->GetKillable() && GetWavPlayerPlaying(e)) {
-    STDERR << "MAKING " << e->GetName() << " killable.\n";
-    e->SetKillable(true);
+#include "voice_allocator.h"
+
+VoiceTail voice_tail;
+
+class VoiceAllocator : public CommandParser {
+public:
+  RefPtr<BufferedWavPlayer> Get(Effect* e) {
+    // Hum and other looped sounds are never made killable, they are
+    // expected to keep playing.
+    if (!e->GetFollowing() && !e->GetKillable() &&
+        e->GetPriority() < Effect::PRIORITY_HUM && GetWavPlayerPlaying(e)) {
+      STDERR << "MAKING " << e->GetName() << " killable.\n";
+      e->SetKillable(true);
+    }
+    RefPtr<BufferedWavPlayer> ret = GetFreeWavPlayer();
+    if (ret) return ret;
+
+    BufferedWavPlayer* p = PickVoiceToSteal(wav_players, NELEM(wav_players), e);
+    if (!p) {
+      denials_++;
+      return RefPtr<BufferedWavPlayer>();
+    }
+    STDERR << "KILLING PLAYER " << WhatUnit(p) << "\n";
+    steals_++;
+    int16_t tail[VOICE_STEAL_FADE_SAMPLES];
+    int n = p->TakeTail(tail, NELEM(tail));
+    voice_tail.Add(tail, n);
+    p->Stop();
+    p->reset_volume();
+    return RefPtr<BufferedWavPlayer>(p);
   }
-  RefPtr<BufferedWavPlayer> ret = GetFreeWavPlayer();
-  if (ret) return ret;
 
-  BufferedWavPlayer* p = nullptr;
-  float best_remaining = 1000.0;
-  for (size_t unit = 0; unit < NELEM(wav_players); unit++) {
-    if (wav_players[unit].isPlaying() &&
-	wav_players[unit].refs() == 0 &&
-	wav_players[unit].current_file_id().GetEffect() &&
-	wav_players[unit].current_file_id().GetEffect()->GetKillable()) {
-      float remaining = wav_players[unit].length() - wav_players[unit].pos();
-      if (remaining < best_remaining) {
-	best_remaining = remaining;
-	p = wav_players + unit;
+  bool Parse(const char* cmd, const char* arg) override {
+#ifndef DISABLE_DIAGNOSTIC_COMMANDS
+    if (!strcmp(cmd, "voices")) {
+      STDOUT << "Voice steals: " << steals_ << " denials: " << denials_ << "\n";
+      for (size_t unit = 0; unit < NELEM(wav_players); unit++) {
+	const Effect* e = wav_players[unit].current_file_id().GetEffect();
+	STDOUT << "Unit " << unit << ": "
+	       << (wav_players[unit].isPlaying() ? "On " : "Off ")
+	       << (e ? e->GetName() : "-")
+	       << " priority=" << (e ? (int)e->GetPriority() : 0)
+	       << " refs=" << wav_players[unit].refs() << "\n";
       }
+      return true;
     }
-  }
-  if (p) {
-    STDERR << "KILLING PLAYER " << WhatUnit(p) << "\n";
-    p->set_fade_time(0.001);
-    p->FadeAndStop();
-    while (p->isPlaying()) {
-#if VERSION_MAJOR >= 4
-      armv7m_core_yield();
 #endif
-    }
-    return RefPtr<BufferedWavPlayer>(p);
+    return false;
   }
-  return RefPtr<BufferedWavPlayer>();
+
+private:
+  uint32_t steals_ = 0;
+  uint32_t denials_ = 0;
+};
+
+VoiceAllocator voice_allocator;
+
+RefPtr<BufferedWavPlayer> GetOrFreeWavPlayer(Effect* e)  {
+  return voice_allocator.Get(e);
 }
 #else
 RefPtr<BufferedWavPlayer> GetOrFreeWavPlayer(Effect* e)  {
@@ -118,6 +143,9 @@ void SetupStandardAudioLow() {
 #ifndef DISABLE_TALKIE  
   dynamic_mixer.streams_[NELEM(wav_players)+1] = &talkie;
 #endif
+#ifdef KILL_OLD_PLAYERS
+  dynamic_mixer.streams_[NELEM(wav_players)+2] = &voice_tail;
+#endif
 }
 
 void SetupStandardAudio() {
@@ -627,31 +627,36 @@ const int32_t lanc2_11[] = {
 class Frame {
 public:
   bool voiced() const { return period != 0; }
-  void lerp(const Frame &A, const Frame &B,
-      int count, int maxcount) {
+  int32_t energy;
+  int32_t period;
+  int32_t k[10];
+  bool inited = false;
+};
+
+// The parameters for a sample |b| / 16384 of the way from the old frame
+// to the new frame are base + ((delta * b) >> 14), which is the same as
+// (old * (16384 - b) + new * b) >> 14. base and delta only change when
+// a new frame is read.
+class FrameInterpolation {
+public:
+  void Setup(const Frame& A, const Frame& B) {
     if (!A.inited) {
-      inited = false;
-      energy = period = 0;
-      for (int i = 0; i < 10; i++) k[i] = 0;
+      base.energy = base.period = delta.energy = delta.period = 0;
+      for (int i = 0; i < 10; i++) base.k[i] = delta.k[i] = 0;
       return;
     }
+    base = A;
     if (A.voiced() != B.voiced() || !B.inited) {
-      *this = A;
+      delta.energy = delta.period = 0;
+      for (int i = 0; i < 10; i++) delta.k[i] = 0;
     } else {
-      int b = count * 16384 / maxcount;
-      int a = 16384 - b;
-      inited = inited;
-      energy = (A.energy * a + B.energy * b) >> 14;
-      period = (A.period * a + B.period * b) >> 14;
-      for (int i = 0; i < 10; i++) {
-	k[i] = (A.k[i] * a + B.k[i] * b) >> 14;
-      }
+      delta.energy = B.energy - A.energy;
+      delta.period = B.period - A.period;
+      for (int i = 0; i < 10; i++) delta.k[i] = B.k[i] - A.k[i];
     }
   }
-  int32_t energy;
-  int32_t period;
-  int32_t k[10];
-  bool inited = false;
+  Frame base;
+  Frame delta;
 };
 
 class Talkie : public ProffieOSAudioStream
@@ -670,6 +675,7 @@ public:
 
   Talkie() {
     for (int i = 0; i < 10; i++) x[i] = 0;
+    interp_.Setup(old_frame, new_frame);
   }
 
   bool Empty() { return num_words == 0; }
@@ -843,65 +849,89 @@ public:
     }
   }
   
-  int16_t Get8kHz() {
-    if (count_++ >= rate_) {
-      ReadFrame();
-      count_ = 0;
-    }
-
-    Frame f;
-    f.lerp(old_frame, new_frame, count_, rate_);
-
-    
-    int32_t u[11];
-
-    if (f.period) {
-      // Voiced source
-      if (periodCounter < f.period) {
-        periodCounter++;
-      } else {
-        periodCounter = 0;
+  // Renders |n| samples at 8kHz. Frames are only decoded at frame
+  // boundaries, and the filter state is kept in local variables for
+  // the whole block.
+  void Render8kHz(int16_t* out, int n) {
+    int32_t x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3], x4 = x[4];
+    int32_t x5 = x[5], x6 = x[6], x7 = x[7], x8 = x[8], x9 = x[9];
+    for (int i = 0; i < n; i++) {
+      if (count_++ >= rate_) {
+	ReadFrame();
+	count_ = 0;
+	interp_.Setup(old_frame, new_frame);
       }
-      if (periodCounter < MAX_CHIRP_SIZE) {
-        u[10] = ((coeffs_->chirptable[periodCounter]) * f.energy) >> 3;
+      const Frame& A = interp_.base;
+      const Frame& D = interp_.delta;
+      int32_t b = count_ * 16384 / rate_;
+#define INTERPOLATE(X) (A.X + ((D.X * b) >> 14))
+      int32_t period = INTERPOLATE(period);
+      int32_t energy = INTERPOLATE(energy);
+
+      int32_t u;
+      if (period) {
+	// Voiced source
+	if (periodCounter < period) {
+	  periodCounter++;
+	} else {
+	  periodCounter = 0;
+	}
+	if (periodCounter < MAX_CHIRP_SIZE) {
+	  u = (coeffs_->chirptable[periodCounter] * energy) >> 3;
+	} else {
+	  u = 0;
+	}
       } else {
-        u[10] = 0;
+	// Unvoiced source
+	synthRand = (synthRand >> 1) ^ ((synthRand & 1) ? 0xB800 : 0);
+	u = ((synthRand & 1) ? energy : -energy) << 3;
       }
-    } else {
-      // Unvoiced source
-      static uint16_t synthRand = 1;
-      synthRand = (synthRand >> 1) ^ ((synthRand & 1) ? 0xB800 : 0);
-      u[10] = ((synthRand & 1) ? f.energy : -f.energy) << 3;
-    }
+
+      int32_t k0 = INTERPOLATE(k[0]), k1 = INTERPOLATE(k[1]);
+      int32_t k2 = INTERPOLATE(k[2]), k3 = INTERPOLATE(k[3]);
+      int32_t k4 = INTERPOLATE(k[4]), k5 = INTERPOLATE(k[5]);
+      int32_t k6 = INTERPOLATE(k[6]), k7 = INTERPOLATE(k[7]);
+      int32_t k8 = INTERPOLATE(k[8]), k9 = INTERPOLATE(k[9]);
+#undef INTERPOLATE
 
 #define matrix_multiply(X, Y) (((X)*(Y)) >> 9)
-    u[9] = u[10] - matrix_multiply(f.k[9], x[9]);
-    u[8] = u[9] - matrix_multiply(f.k[8], x[8]);
-    u[7] = u[8] - matrix_multiply(f.k[7], x[7]);
-    u[6] = u[7] - matrix_multiply(f.k[6], x[6]);
-    u[5] = u[6] - matrix_multiply(f.k[5], x[5]);
-    u[4] = u[5] - matrix_multiply(f.k[4], x[4]);
-    u[3] = u[4] - matrix_multiply(f.k[3], x[3]);
-    u[2] = u[3] - matrix_multiply(f.k[2], x[2]);
-    u[1] = u[2] - matrix_multiply(f.k[1], x[1]);
-    u[0] = u[1] - matrix_multiply(f.k[0], x[0]);
-
-    // Output clamp
-    if (u[0] > 511) u[0] = 511;
-    if (u[0] < -512) u[0] = -512;
-
-    x[9] = x[8] + matrix_multiply(f.k[8], u[8]);
-    x[8] = x[7] + matrix_multiply(f.k[7], u[7]);
-    x[7] = x[6] + matrix_multiply(f.k[6], u[6]);
-    x[6] = x[5] + matrix_multiply(f.k[5], u[5]);
-    x[5] = x[4] + matrix_multiply(f.k[4], u[4]);
-    x[4] = x[3] + matrix_multiply(f.k[3], u[3]);
-    x[3] = x[2] + matrix_multiply(f.k[2], u[2]);
-    x[2] = x[1] + matrix_multiply(f.k[1], u[1]);
-    x[1] = x[0] + matrix_multiply(f.k[0], u[0]);
-    x[0] = u[0];
-
-    return u[0] << 5;
+      int32_t u9 = u - matrix_multiply(k9, x9);
+      int32_t u8 = u9 - matrix_multiply(k8, x8);
+      int32_t u7 = u8 - matrix_multiply(k7, x7);
+      int32_t u6 = u7 - matrix_multiply(k6, x6);
+      int32_t u5 = u6 - matrix_multiply(k5, x5);
+      int32_t u4 = u5 - matrix_multiply(k4, x4);
+      int32_t u3 = u4 - matrix_multiply(k3, x3);
+      int32_t u2 = u3 - matrix_multiply(k2, x2);
+      int32_t u1 = u2 - matrix_multiply(k1, x1);
+      int32_t u0 = u1 - matrix_multiply(k0, x0);
+
+      // Output clamp
+      if (u0 > 511) u0 = 511;
+      if (u0 < -512) u0 = -512;
+
+      x9 = x8 + matrix_multiply(k8, u8);
+      x8 = x7 + matrix_multiply(k7, u7);
+      x7 = x6 + matrix_multiply(k6, u6);
+      x6 = x5 + matrix_multiply(k5, u5);
+      x5 = x4 + matrix_multiply(k4, u4);
+      x4 = x3 + matrix_multiply(k3, u3);
+      x3 = x2 + matrix_multiply(k2, u2);
+      x2 = x1 + matrix_multiply(k1, u1);
+      x1 = x0 + matrix_multiply(k0, u0);
+      x0 = u0;
+#undef matrix_multiply
+
+      out[i] = u0 << 5;
+    }
+    x[0] = x0; x[1] = x1; x[2] = x2; x[3] = x3; x[4] = x4;
+    x[5] = x5; x[6] = x6; x[7] = x7; x[8] = x8; x[9] = x9;
+  }
+
+  int16_t Get8kHz() {
+    int16_t ret;
+    Render8kHz(&ret, 1);
+    return ret;
   }
 
 #if 1
@@ -947,10 +977,43 @@ public:
   
   int read(int16_t* data, int elements) override {
     if (eof()) return 0;
+#if 1
+    int ret = elements;
+    while (elements) {
+      // Render all the 8kHz samples needed for up to 128 output samples
+      // first, then upsample them.
+      int n = std::min(elements, 128);
+      int16_t samples[(10 + 2 * 128) / 11];
+      Render8kHz(samples, (l_pos_ + 2 * n) / 11);
+      const int16_t* next = samples;
+      int32_t a = A, b = B, c = C, d = D;
+      uint32_t l = l_pos_;
+      for (int i = 0; i < n; i++) {
+	int32_t sum =
+	  a * lanc2_11[l] +
+	  b * lanc2_11[l + 11] +
+	  c * lanc2_11[l + 22] +
+	  d * lanc2_11[l + 33];
+	l += 2;
+	if (l >= 11) {
+	  l -= 11;
+	  d = c; c = b; b = a;
+	  a = *(next++);
+	}
+	data[i] = clamptoi16(sum >> 14);
+      }
+      A = a; B = b; C = c; D = d;
+      l_pos_ = l;
+      data += n;
+      elements -= n;
+    }
+    return ret;
+#else
     for (int i = 0; i < elements; i++) {
       data[i] = Get44kHz();
     }
     return elements;
+#endif
   }
   bool isPlaying() const {
     return !eof();
@@ -1041,10 +1104,12 @@ private:
 
   const tms5100_coeffs* coeffs_;
   Frame new_frame, old_frame;
+  FrameInterpolation interp_;
+  uint16_t synthRand = 1;
 
   uint8_t count_ = 0;
   uint8_t pos_ = 0;
-  uint8_t periodCounter;
+  uint8_t periodCounter = 0;
   int32_t x[10];
 };
 
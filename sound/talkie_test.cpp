@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <iostream>
+#include <chrono>
+#include <algorithm>
 
 // junk needed to make this hack work.
 #define digitalWrite(X, Y) ((void)0)
@@ -47,7 +49,93 @@ std::string mkchunk(std::string chnk,
   return ret;
 }
 
+#define CHECK(X) do {						\
+    if (!(X)) {							\
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #X);	\
+      exit(1);							\
+    }								\
+  } while (0)
+
+// Boot and error messages, with voiced, unvoiced, repeat and stop frames.
+void SayTestPhrase(Talkie* talkie) {
+  talkie->Say(talkie_error_in_15, 15);
+  talkie->Say(talkie_font_directory_15, 15);
+  talkie->SayNumber(1234567);
+  talkie->Say(talkie_low_battery_15, 15);
+}
+
+std::vector<int16_t> RenderBlocks(int block_size) {
+  Talkie talkie;
+  SayTestPhrase(&talkie);
+  std::vector<int16_t> ret;
+  int16_t block[256];
+  while (true) {
+    int n = talkie.read(block, block_size);
+    if (!n) break;
+    ret.insert(ret.end(), block, block + n);
+  }
+  return ret;
+}
+
+std::vector<int16_t> RenderSamples() {
+  Talkie talkie;
+  SayTestPhrase(&talkie);
+  std::vector<int16_t> ret;
+  while (talkie.isPlaying()) ret.push_back(talkie.Get44kHz());
+  return ret;
+}
+
+uint32_t Hash(const std::vector<int16_t>& samples) {
+  uint32_t h = 2166136261u;
+  for (int16_t s : samples) {
+    h = (h ^ (uint16_t)s) * 16777619u;
+  }
+  return h;
+}
+
+// read() can return a few samples more than Get44kHz(), since it
+// doesn't check for the end in the middle of a block.
+bool SameStart(const std::vector<int16_t>& a, const std::vector<int16_t>& b) {
+  size_t n = std::min(a.size(), b.size());
+  return a.size() > 300000 && b.size() > 300000 &&
+    std::equal(a.begin(), a.begin() + n, b.begin());
+}
+
+template<class F>
+double NanosPerSample(F f) {
+  double best = 1e9;
+  for (int i = 0; i < 5; i++) {
+    auto start = std::chrono::steady_clock::now();
+    size_t samples = f().size();
+    std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - start;
+    best = std::min(best, t.count() / samples);
+  }
+  return best;
+}
+
+void Test() {
+  std::vector<int16_t> blocks = RenderBlocks(44);
+  fprintf(stderr, "%d samples, hash = %08x\n", (int)blocks.size(), Hash(blocks));
+  // Output of the renderer that did one sample at a time, before
+  // read() rendered whole blocks.
+  CHECK(blocks.size() == 339020);
+  CHECK(Hash(blocks) == 0xfd913666);
+
+  CHECK(SameStart(blocks, RenderSamples()));
+  CHECK(SameStart(blocks, RenderBlocks(1)));
+  CHECK(SameStart(blocks, RenderBlocks(7)));
+  CHECK(SameStart(blocks, RenderBlocks(256)));
+
+  fprintf(stderr, "blocks: %.2f ns/sample, one sample at a time: %.2f ns/sample\n",
+	  NanosPerSample([]() { return RenderBlocks(44); }),
+	  NanosPerSample([]() { return RenderSamples(); }));
+}
+
 int main(int argc, char** argv) {
+  if (argc == 2 && !strcmp(argv[1], "test")) {
+    Test();
+    return 0;
+  }
   std::string tmp;
   Talkie talkie;
 
@@ -10,6 +10,7 @@
 #include <memory.h>
 
 #include <iostream>
+#include <chrono>
 
 #include <fcntl.h>
 
@@ -20,6 +21,9 @@
 #define NO_REPEAT_RANDOM
 #define AUDIO_RATE 44100
 #define SCOPED_PROFILER() do {} while(0)
+#define KILL_OLD_PLAYERS
+#define noInterrupts() do {} while(0)
+#define interrupts() do {} while(0)
 void MountSDCard() {}
 
 #define CHECK(X) do {						\
@@ -91,6 +95,7 @@ float Fmod(float a, float b) {
 class Looper {
 public:
   static void DoHFLoop() {}
+  static void CheckFrozen() {}
 };
 
 char* itoa( int value, char *string, int radix )
@@ -139,10 +144,12 @@ enum EFFECTS {
 class SaberBase {
 public:
   static int sound_number;
+  static float sound_length;
   static void DoEffect(int x, float y) {}
 };
 
 int SaberBase::sound_number = -1;
+float SaberBase::sound_length = 0.0;
 
 #include "effect.h"
 
@@ -298,6 +305,24 @@ void test_effects() {
   SFX_hum.Select(2);
   SFX_hum.RandomFile().GetName(name);
   CHECK_GLOB("testfont/hum/002/###.wav", name);
+
+  // A prerolled file is what RandomFile() returns next.
+  SFX_hum.Select(-1);
+  for (int i = 0; i < 10; i++) {
+    Effect::FileID next = SFX_hum.PrerollFile();
+    CHECK(next == SFX_hum.PrerollFile());
+    CHECK(next == SFX_hum.RandomFile());
+  }
+  // A selected file is still played, but isn't what gets prerolled.
+  int not_selected = 0;
+  for (int i = 0; i < 20; i++) {
+    SFX_hum.Select(1);
+    Effect::FileID next = SFX_hum.PrerollFile();
+    CHECK_EQ(1, SFX_hum.RandomFile().GetFileNum());
+    if (next.GetFileNum() != 1) not_selected++;
+  }
+  SFX_hum.Select(-1);
+  CHECK(not_selected > 0);
 }
 
 #include "playwav.h"
@@ -313,10 +338,9 @@ std::string mkchunk(std::string chnk,
   return ret;
 }
 
-void mktestsample(int hz, const char* filename) {
+void mktestsample(int hz, const char* filename, int num_samples = 1024, int16_t sample = 0) {
   std::string samples;
-  int16_t sample = 0;
-  for (int i = 0; i < 1024; i++) {
+  for (int i = 0; i < num_samples; i++) {
     samples += STRIFY(sample);
   }
   struct Fmt {
@@ -373,9 +397,196 @@ void test_playwav() {
   CHECK_EQ(1023, readallsamples(&wav));
 }
 
+#include "voice_allocator.h"
+
+struct FakePlayer {
+  bool playing = false;
+  int refs_ = 0;
+  Effect* effect = nullptr;
+  float remaining = 1.0;
+
+  bool isPlaying() const { return playing; }
+  int refs() const { return refs_; }
+  Effect::FileID current_file_id() const { return Effect::FileID(effect, 0, 0); }
+  float length() const { return 10.0; }
+  float pos() const { return 10.0 - remaining; }
+
+  void Play(Effect* e, float r) {
+    playing = true;
+    effect = e;
+    remaining = r;
+  }
+};
+
+void test_voice_stealing() {
+  CHECK_EQ(Effect::PRIORITY_HUM, SFX_hum.GetPriority());
+  CHECK_EQ(Effect::PRIORITY_HUM, SFX_lockup.GetPriority());
+  CHECK_EQ(Effect::PRIORITY_CLASH, SFX_clash.GetPriority());
+  CHECK_EQ(Effect::PRIORITY_BLAST, SFX_blst.GetPriority());
+  CHECK_EQ(Effect::PRIORITY_SWING, SFX_swng.GetPriority());
+
+  FakePlayer players[4];
+  players[0].Play(&SFX_hum, 5.0);
+  players[0].refs_ = 1;
+  players[1].Play(&SFX_clash, 0.5);
+  players[2].Play(&SFX_swng, 0.8);
+  players[3].Play(&SFX_blst, 0.2);
+
+  // Nothing can take over the hum, not even another hum.
+  players[1].Play(&SFX_lockup, 0.5);
+  CHECK(PickVoiceToSteal(players, 4, &SFX_hum) == players + 2);
+  players[1].Play(&SFX_clash, 0.5);
+
+  // Lowest priority goes first, even if it has more time left.
+  CHECK(PickVoiceToSteal(players, 4, &SFX_clash) == players + 2);
+  players[2].Play(&SFX_swng, 0.0);
+  players[2].playing = false;
+  CHECK(PickVoiceToSteal(players, 4, &SFX_clash) == players + 3);
+
+  // Swings can only take over killable swings.
+  CHECK(PickVoiceToSteal(players, 4, &SFX_swng) == nullptr);
+  players[2].Play(&SFX_swng, 0.8);
+  CHECK(PickVoiceToSteal(players, 4, &SFX_swng) == nullptr);
+  SFX_swng.SetKillable(true);
+  CHECK(PickVoiceToSteal(players, 4, &SFX_swng) == players + 2);
+
+  // Same priority: the one that ends soonest.
+  players[3].Play(&SFX_clsh, 0.2);
+  SFX_clash.SetKillable(true);
+  SFX_clsh.SetKillable(true);
+  CHECK(PickVoiceToSteal(players, 4, &SFX_clash) == players + 2);
+  players[2].Play(&SFX_clash, 0.1);
+  CHECK(PickVoiceToSteal(players, 4, &SFX_clash) == players + 2);
+  players[2].Play(&SFX_clash, 0.3);
+  CHECK(PickVoiceToSteal(players, 4, &SFX_clash) == players + 3);
+
+  // Priorities can be changed from the font config.
+  SFX_clsh.SetPriority(Effect::PRIORITY_HUM);
+  CHECK(PickVoiceToSteal(players, 4, &SFX_clash) == players + 2);
+  SFX_clsh.SetPriority(SFX_clsh.DefaultPriority());
+  SFX_clash.SetKillable(false);
+  SFX_clsh.SetKillable(false);
+  SFX_swng.SetKillable(false);
+}
+
+void test_voice_tail() {
+  VoiceTail tail;
+  int16_t samples[VOICE_STEAL_FADE_SAMPLES];
+  int16_t out[VOICE_STEAL_FADE_SAMPLES];
+  CHECK(tail.eof());
+  CHECK_EQ(0, tail.read(out, 10));
+
+  for (size_t i = 0; i < NELEM(samples); i++) samples[i] = 10000;
+  tail.Add(samples, NELEM(samples));
+  CHECK(!tail.eof());
+  CHECK_EQ(10, tail.read(out, 10));
+  // Fades out from where the player was.
+  CHECK_EQ(10000, out[0]);
+  CHECK(out[9] < out[0]);
+
+  // A second steal is mixed with what is left of the first one.
+  tail.Add(samples, 10);
+  CHECK_EQ((int)NELEM(samples) - 10, tail.read(out, NELEM(out)));
+  CHECK(out[0] > 10000);
+  CHECK(out[NELEM(samples) - 11] < 1000);
+  CHECK(tail.eof());
+}
+
+// Stubs for BufferedWavPlayer.
+#define SCOPED_PROFILE_FRAME(X) do {} while(0)
+// audio_stream_work.h defines the real LOCK_SD().
+#undef LOCK_SD
+struct ScopedCycleCounter { ScopedCycleCounter(uint64_t&) {} };
+uint64_t wav_interrupt_cycles;
+void EnableAmplifier() {}
+void delay(int ms);
+void yield() {}
+
+#include "../common/atomic.h"
+#include "click_avoider_lin.h"
+#include "buffered_audio_stream.h"
+#include "buffered_wav_player.h"
+
+size_t WhatUnit(BufferedWavPlayer* player) { return 0; }
+
+BufferedWavPlayer* stall_test_player;
+int stall_test_samples;
+
+// Waiting in the main loop lets the audio interrupt read from the player.
+void delay(int ms) {
+  micros_ += ms * 1000;
+  for (int i = 0; i < ms * AUDIO_RATE / 1000; i += 44) {
+    int16_t samples[44];
+    stall_test_samples += stall_test_player->read(samples, 44);
+  }
+}
+
+// How long the main loop is stuck in Stop() and PlayOnce(), both in
+// simulated time (waiting for the audio interrupt) and in real time.
+void test_wav_player_stall() {
+  mktestdir();
+  mktestsample(44100, "testfont/clash01.wav", 44100, 1000);
+  mktestsample(44100, "testfont/clash02.wav", 22050, 1000);
+  Effect::ScanCurrentDirectory();
+  static BufferedWavPlayer player;
+  stall_test_player = &player;
+
+  uint32_t worst_play = 0, worst_stop = 0;
+  double worst_play_real = 0, worst_stop_real = 0;
+  for (int i = 0; i < 10; i++) {
+    uint32_t start = micros_;
+    auto real_start = std::chrono::steady_clock::now();
+    player.PlayOnce(&SFX_clash);
+    std::chrono::duration<double, std::micro> real = std::chrono::steady_clock::now() - real_start;
+    worst_play = std::max(worst_play, micros_ - start);
+    worst_play_real = std::max(worst_play_real, real.count());
+    // length() is for the new file as soon as PlayOnce() returns.
+    CHECK_EQ(strstr(player.Filename(), "clash02") ? 0.5f : 1.0f, player.length());
+
+    stall_test_samples = 0;
+    delay(20);
+    CHECK(player.isPlaying());
+    CHECK(stall_test_samples > 800);
+
+    start = micros_;
+    real_start = std::chrono::steady_clock::now();
+    player.Stop();
+    real = std::chrono::steady_clock::now() - real_start;
+    worst_stop = std::max(worst_stop, micros_ - start);
+    worst_stop_real = std::max(worst_stop_real, real.count());
+    // Still fading out.
+    CHECK(player.isPlaying());
+    // Changing the volume doesn't keep it from stopping.
+    player.set_volume_now(1.0f);
+
+    delay(20);
+    CHECK(!player.isPlaying());
+    CHECK(player.Available());
+  }
+  // With the SD card locked, PlayOnce() doesn't wait for the header.
+  LOCK_SD(true);
+  player.PlayOnce(&SFX_clash);
+  LOCK_SD(false);
+  stall_test_samples = 0;
+  delay(20);
+  CHECK(player.isPlaying());
+  CHECK(stall_test_samples > 800);
+  player.Stop();
+  delay(20);
+  CHECK(!player.isPlaying());
+
+  fprintf(stderr, "Main loop stall: PlayOnce %u us waiting (%.0f us real), Stop %u us waiting (%.0f us real)\n",
+	  worst_play, worst_play_real, worst_stop, worst_stop_real);
+  CHECK_EQ(0u, worst_play);
+  CHECK_EQ(0u, worst_stop);
+}
+
 int main() {
   test_effects();
   test_playwav();
+  test_voice_stealing();
+  test_voice_tail();
+  test_wav_player_stall();
 }
 
 #define PROFFIEOS_DEFINE_FUNCTION_STAGE
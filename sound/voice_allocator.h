@@ -0,0 +1,79 @@
+#ifndef SOUND_VOICE_ALLOCATOR_H
+#define SOUND_VOICE_ALLOCATOR_H
+
+#include "audiostream.h"
+
+// Decides which wav player to take over when all of them are busy.
+//
+// Every effect has a priority, which can be changed with
+// ProffieOS.SFX.<name>.priority in the font config. A new sound can take
+// over a player that plays something with a lower priority, or something
+// with the same priority that has been made killable. (Effects become
+// killable when they are started again while still playing.) Players
+// that someone holds on to, like the hum, are never taken. Of the
+// players that can be taken, the lowest priority and then the one with
+// the least time left is picked.
+template<class PLAYER>
+PLAYER* PickVoiceToSteal(PLAYER* players, size_t num_players, const Effect* effect) {
+  PLAYER* best = nullptr;
+  int best_priority = 0;
+  float best_remaining = 0.0;
+  for (size_t unit = 0; unit < num_players; unit++) {
+    PLAYER* p = players + unit;
+    if (!p->isPlaying() || p->refs() != 0) continue;
+    const Effect* e = p->current_file_id().GetEffect();
+    if (!e) continue;
+    int priority = e->GetPriority();
+    if (priority > effect->GetPriority()) continue;
+    if (priority == effect->GetPriority() && !e->GetKillable()) continue;
+    float remaining = p->length() - p->pos();
+    if (!best || priority < best_priority ||
+	(priority == best_priority && remaining < best_remaining)) {
+      best = p;
+      best_priority = priority;
+      best_remaining = remaining;
+    }
+  }
+  return best;
+}
+
+// How long a stolen voice takes to fade out.
+#ifndef VOICE_STEAL_FADE_SAMPLES
+#define VOICE_STEAL_FADE_SAMPLES (AUDIO_RATE / 1000)
+#endif
+
+// Plays the last bit of stolen voices, faded out. The sound that was
+// playing is moved here, so the player can start the new sound right
+// away, instead of waiting for the fade to finish.
+class VoiceTail : public ProffieOSAudioStream {
+public:
+  int read(int16_t* data, int elements) override {
+    int n = std::min(elements, end_ - pos_);
+    memcpy(data, buffer_ + pos_, n * sizeof(data[0]));
+    pos_ += n;
+    return n;
+  }
+  bool eof() const override { return pos_ >= end_; }
+
+  // |samples| should already have the volume of the player applied.
+  void Add(const int16_t* samples, int n) {
+    noInterrupts();
+    // Move what is left of earlier tails to the front.
+    int left = end_ - pos_;
+    memmove(buffer_, buffer_ + pos_, left * sizeof(buffer_[0]));
+    for (int i = left; i < n; i++) buffer_[i] = 0;
+    for (int i = 0; i < n; i++) {
+      buffer_[i] = clamptoi16(buffer_[i] + samples[i] * (n - i) / n);
+    }
+    pos_ = 0;
+    end_ = std::max(left, n);
+    interrupts();
+  }
+
+private:
+  int16_t buffer_[VOICE_STEAL_FADE_SAMPLES];
+  volatile int pos_ = 0;
+  volatile int end_ = 0;
+};
+
+#endif
@@ -69,6 +69,14 @@ public:
   void set_speed(int speed) {
     volume_.set_speed(speed);
   }
+  // Reaches |vol| after |samples| samples, for volumes that are
+  // updated once per audio block.
+  void set_volume_over(float vol, int samples) {
+    int target = kDefaultVolume * vol;
+    int diff = abs(target - (int)volume_.value());
+    volume_.set_speed(std::max<int>(1, (diff + samples - 1) / samples));
+    volume_.set_target(target);
+  }
   void set_fade_time(float t) {
     set_speed(std::max<int>(1, (int)(kMaxVolume / t / AUDIO_RATE)));
   }
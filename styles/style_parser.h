@@ -119,10 +119,19 @@ NamedStyle named_styles[] = {
 class StyleParser : public CommandParser {
 public:
 
+  // Names are compared by hash first, so only the matching
+  // entry needs a string compare.
   NamedStyle* FindStyle(const char *name) {
     if (!name) return nullptr;
+    if (!style_hashes_valid_) {
+      for (size_t i = 0; i < NELEM(named_styles); i++) {
+	style_hashes_[i] = HashWord(named_styles[i].name);
+      }
+      style_hashes_valid_ = true;
+    }
+    uint32_t hash = HashWord(name);
     for (size_t i = 0; i < NELEM(named_styles); i++) {
-      if (FirstWord(name, named_styles[i].name)) {
+      if (style_hashes_[i] == hash && FirstWord(name, named_styles[i].name)) {
 	return named_styles + i;
       }
     }
@@ -138,28 +147,69 @@ public:
     return style->style_allocator->make();
   }
 
+  // Which arguments a style uses only depends on the style, and for
+  // "builtin X Y", on which preset and blade it refers to. Finding out
+  // means constructing the style, so the answer is remembered here.
+  struct ArgumentUsage {
+    NamedStyle* style = nullptr;
+    const void* config;
+    int preset;
+    int blade;
+    int max_arg;
+    uint64_t used;  // bit N is set if argument N is used
+  };
+
+  ArgumentUsage* GetArgumentUsage(const char* str) {
+    NamedStyle* style = FindStyle(str);
+    if (!style) return nullptr;
+    int preset = 0, blade = 0;
+    if (style->style_allocator == &builtin_preset_allocator) {
+      ArgParser ap(SkipWord(str));
+      preset = strtol(ap.GetArg(1, "", "0"), nullptr, 0);
+      blade = strtol(ap.GetArg(2, "", "1"), nullptr, 0);
+    }
+    const void* config = current_config;
+    for (ArgumentUsage& u : argument_usage_) {
+      if (u.style == style && u.config == config &&
+	  u.preset == preset && u.blade == blade) {
+	return &u;
+      }
+    }
+    ArgumentUsage* u = argument_usage_ + next_argument_usage_;
+    next_argument_usage_ = (next_argument_usage_ + 1) % NELEM(argument_usage_);
+    GetMaxArgParser ap(SkipWord(str));
+    CurrentArgParser = &ap;
+    delete style->style_allocator->make();
+    u->style = style;
+    u->config = config;
+    u->preset = preset;
+    u->blade = blade;
+    u->max_arg = ap.max_arg();
+    u->used = ap.used();
+    return u;
+  }
+
   // Returns true if the listed style refereces the specified argument.
   bool UsesArgument(const char* str, int argument) {
-    NamedStyle* style = FindStyle(str);
-    if (!style) return false;
+    ArgumentUsage* u = GetArgumentUsage(str);
+    if (!u) return false;
     if (argument == 0) return true;
+    if (argument > u->max_arg) return false;
+    if (argument < 64) return (u->used >> argument) & 1;
     char unused_output[32];
     GetArgParser ap(SkipWord(str), argument, unused_output);
     CurrentArgParser = &ap;
-    delete style->style_allocator->make();
+    delete u->style->style_allocator->make();
     return ap.next();
   }
 
   // Returns true if the listed style refereces the specified argument.
   int MaxUsedArgument(const char* str) {
-    NamedStyle* style = FindStyle(str);
-    if (!style) return false;
-    GetMaxArgParser ap(SkipWord(str));
-    CurrentArgParser = &ap;
-    delete style->style_allocator->make();
+    ArgumentUsage* u = GetArgumentUsage(str);
+    if (!u) return false;
     // Ignore the two "builtin" arguments
-    if (FirstWord(str, "builtin") && ap.max_arg() <= 2) return 0;
-    return ap.max_arg();
+    if (FirstWord(str, "builtin") && u->max_arg <= 2) return 0;
+    return u->max_arg;
   }
 
   // Get the Nth argument of a style string.
@@ -197,25 +247,59 @@ public:
   // Replace the Nth argument of a style string with a new value and return
   // the new style string. Missing arguments will be replaced with default
   // values.
+  // Arguments that are present in |str| are copied as they are, the
+  // style is only constructed (once) when some of them need default values.
   LSPtr<char> SetArgument(const char* str, int argument, const char* new_value) {
-    char ret[512];  // maximum length for now
-    char* tmp = ret;
-    int output_args = std::max<int>(CountWords(str), argument + 1);
+    int words = CountWords(str);
+    int output_args = std::max<int>(words, argument + 1);
+    NamedStyle* style = FindStyle(str);
+    bool need_defaults = false;
+    const char* word = SkipSpace(str);
     for (int i = 0; i < output_args; i++) {
-      if (i) strcat(tmp++, " ");
-      if (i == argument) {
-	strcat(tmp, new_value);
-	tmp += strlen(tmp);
-      } else {
-	if (!GetArgument(str, i, tmp)) {
-	  strcat(tmp, "~");
+      if (i != argument && (!*word || *word == '~')) need_defaults = true;
+      word = SkipSpace(SkipWord(word));
+    }
+    GetArgsParser ap(SkipWord(str), need_defaults ? output_args : 0);
+    if (style && need_defaults) {
+      CurrentArgParser = &ap;
+      delete style->style_allocator->make();
+    }
+
+    // Called twice, first to count the length, then to fill in |ret|.
+    auto build = [&](char* ret) {
+      int len = 0;
+      const char* word = SkipSpace(str);
+      for (int i = 0; i < output_args; i++) {
+	const char* word_end = SkipWord(word);
+	const char* value = word;
+	const char* end = word_end;
+	if (i == argument) {
+	  value = new_value;
+	} else if (!style) {
+	  value = "~";
+	} else if (*word && *word != '~') {
+	  // Present, use as is.
+	} else if (ap.value(i)) {
+	  value = ap.value(i);
+	} else if (!*word) {
+	  value = i < words ? "" : "~";
 	}
-//	fprintf(stderr, "OUTPUT: %s\n", tmp);
-	tmp += strlen(tmp);
+	if (value != word) end = value + strlen(value);
+	if (i) {
+	  if (ret) ret[len] = ' ';
+	  len++;
+	}
+	if (ret) memcpy(ret + len, value, end - value);
+	len += end - value;
+	word = SkipSpace(word_end);
       }
-    }
-    *tmp = 0;
-    return LSPtr<char>(mkstr(ret));
+      if (ret) ret[len] = 0;
+      return len;
+    };
+
+    char* ret = (char*)malloc(build(nullptr) + 1);
+    if (ret) build(ret);
+    return LSPtr<char>(ret);
   }
 
   // Returns the length of the style identifier.
@@ -398,6 +482,14 @@ public:
 
     return false;
   }
+
+private:
+  uint32_t style_hashes_[NELEM(named_styles)];
+  bool style_hashes_valid_ = false;
+
+  // One for each blade is usually enough for the edit menus.
+  ArgumentUsage argument_usage_[NUM_BLADES < 4 ? 4 : NUM_BLADES];
+  size_t next_argument_usage_ = 0;
 };
 
 StyleParser style_parser;
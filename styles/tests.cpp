@@ -6,6 +6,9 @@
 #include <cstdlib>
 #include <iostream>
 #include <string.h>
+#include <chrono>
+#include <numeric>
+#include <string>
 
 // cruft
 #define interrupts() do {} while(0)
@@ -168,6 +171,7 @@ Monitoring monitor;
 #include "gradient.h"
 #include "fire.h"
 #include "sparkle.h"
+#include "alpha.h"
 #include "../common/command_parser.h"
 #include "../common/preset.h"
 
@@ -190,9 +194,27 @@ public:
 Preset presets[] = {
   { "one", "t1",
     StylePtr<Gradient<TestRgbArg<1, Red>, TestRgbArg<2, Green>, TestRgbArg<3, Blue>>>("0,0,1 0,1,0 1,0,0"),
-    "uno" }
+    "uno" },
+  // Lots of arguments, similar to the configurable styles used in the wild.
+  { "two", "t2",
+    StylePtr<Layers<
+      Gradient<RgbArg<1, Red>, RgbArg<2, Green>, RgbArg<3, Blue>, RgbArg<4, Red>,
+               RgbArg<5, Green>, RgbArg<6, Blue>, RgbArg<7, Red>, RgbArg<8, Green>>,
+      AlphaL<Gradient<RgbArg<9, Red>, RgbArg<10, Green>, RgbArg<11, Blue>, RgbArg<12, Red>,
+                      RgbArg<13, Green>, RgbArg<14, Blue>, RgbArg<15, Red>, RgbArg<16, Green>>,
+             IntArg<17, 16384>>,
+      AlphaL<Gradient<RgbArg<18, Red>, RgbArg<19, Green>, RgbArg<20, Blue>, RgbArg<21, Red>,
+                      RgbArg<22, Green>, RgbArg<23, Blue>, RgbArg<24, Red>, RgbArg<25, Green>>,
+             IntArg<26, 8192>>,
+      AlphaL<Gradient<RgbArg<27, Red>, RgbArg<28, Green>, RgbArg<29, Blue>, RgbArg<30, Red>,
+                      RgbArg<31, Green>, RgbArg<32, Blue>, RgbArg<33, Red>, RgbArg<34, Green>>,
+             IntArg<35, 4096>>,
+      AlphaL<RgbArg<36, White>, IntArg<37, 0>>,
+      AlphaL<RgbArg<38, White>, IntArg<39, 0>>,
+      AlphaL<RgbArg<40, White>, IntArg<41, 0>>>>(),
+    "dos" }
 };
-CONFIG preset = { presets, 1 };
+CONFIG preset = { presets, 2 };
 CONFIG* current_config = &preset;
 
 
@@ -797,6 +819,15 @@ void testMaxUsedArgument(const char* from, int expected) {
 }
 
 
+void testUsesArgument(const char* from, int arg, bool expected) {
+  fprintf(stderr, "testUsesArgument(%s, %d)\n", from, arg);
+  bool uses = style_parser.UsesArgument(from, arg);
+  if (uses != expected) {
+    fprintf(stderr, "Expected %d got %d\n", expected, uses);
+    exit(1);
+  }
+}
+
 void test_argument_parsing() {
   testGetArg("standard", 0, "standard");
   testGetArg("standard", 1, "0,65535,65535");
@@ -883,6 +914,56 @@ void test_argument_parsing() {
   CHECK_COLOR(TestRgbArgColors[1], 0, 0, 1, 0);
   CHECK_COLOR(TestRgbArgColors[2], 0, 1, 0, 0);
   CHECK_COLOR(TestRgbArgColors[3], 7, 8, 9, 0);
+
+  testSetArg("standard", 3, "7", "standard 0,65535,65535 65535,65535,65535 7");
+  testSetArg("standard ~ 2,2,2", 2, "7,7,7", "standard 0,65535,65535 7,7,7");
+  testSetArg("standard 1,1,1  ~x 3", 1, "7,7,7", "standard 7,7,7 65535,65535,65535 3");
+  testSetArg("builtin 0 1", 4, "7,7,7", "builtin 0 1 0,0,1 7,7,7");
+  testSetArg("builtin 0 1 ~ 4,5,6", 5, "7,7,7", "builtin 0 1 0,0,1 4,5,6 7,7,7");
+  testSetArg("nosuchstyle 1", 2, "2", "~ ~ 2");
+  testSetArg("builtin 1 1", 43, "7",
+             "builtin 1 1 "
+             "65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 "
+             "65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 16384 "
+             "65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 8192 "
+             "65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 0,0,65535 65535,0,0 0,65535,0 4096 "
+             "65535,65535,65535 0 65535,65535,65535 0 65535,65535,65535 7");
+  testGetArg("builtin 1 1 ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ 99", 19, "99");
+  testGetArg("builtin 1 1 ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ 99", 28, "8192");
+  testMaxUsedArgument("builtin 1 1", 43);
+
+  testUsesArgument("standard", 0, true);
+  testUsesArgument("standard", 4, true);
+  testUsesArgument("standard", 5, false);
+  testUsesArgument("nosuchstyle", 0, false);
+  testUsesArgument("builtin 0 1", 5, true);
+  testUsesArgument("builtin 0 1", 6, false);
+  testUsesArgument("builtin 1 1 1,2,3", 43, true);
+  testUsesArgument("builtin 1 1", 44, false);
+
+  // The answer is remembered, so the style is not constructed again.
+  clear_test_colors();
+  testUsesArgument("builtin 0 1 1,2,3", 3, true);
+  testMaxUsedArgument("builtin 0 1 4,5,6", 5);
+  CHECK_COLOR(TestRgbArgColors[1], 0, 0, 0, 0);
+
+  // More words than ArgParser keeps track of.
+  std::string many;
+  for (int i = 1; i <= ARG_PARSER_MAX_ARGS * 2; i++) {
+    many += std::to_string(i) + "  ";
+  }
+  ArgParser ap(many.c_str());
+  ap.Shift(3);
+  for (int i = 1; i <= ARG_PARSER_MAX_ARGS * 2 - 3; i++) {
+    if (atoi(ap.GetArg(i, "", "")) != i + 3) {
+      fprintf(stderr, "ArgParser: wrong argument %d: %s\n", i, ap.GetArg(i, "", ""));
+      exit(1);
+    }
+  }
+  if (strcmp(ap.GetArg(ARG_PARSER_MAX_ARGS * 2 - 2, "", "x"), "x")) {
+    fprintf(stderr, "ArgParser: expected default after last argument\n");
+    exit(1);
+  }
 }
 
 void test_gradient() {
@@ -936,7 +1017,119 @@ void test_smoothstep() {
   }
 }
 
-int main() {
+// The argument parser as it used to be, scanning the string from the
+// start for every argument. Only used to compare against in benchmark().
+class ScanningArgParser : public ArgParserInterface {
+public:
+  ScanningArgParser(const char* data) : str_(data) {}
+  const char* GetArg(int arg_num, const char* name, const char* default_value) override {
+    const char* ret = str_;
+    int arg = 0;
+    while (true) {
+      while (*ret == ' ' || *ret == '\t') ret++;
+      if (!*ret) return default_value;
+      if (++arg == arg_num) {
+	if (*ret == '~') return default_value;
+	return ret;
+      }
+      while (*ret && *ret != ' ' && *ret != '\t') ret++;
+    }
+  }
+  void Shift(int words) override {
+    while (words-- > 0) str_ = SkipWord(str_);
+  }
+private:
+  const char* str_;
+};
+
+template<class PARSER>
+double time_construct(const std::vector<std::string>& styles, int rounds) {
+  NamedStyle* style = style_parser.FindStyle("builtin");
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (const std::string& str : styles) {
+      PARSER ap(SkipWord(str.c_str()));
+      CurrentArgParser = &ap;
+      delete style->style_allocator->make();
+    }
+  }
+  std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - start;
+  return t.count() / rounds / styles.size();
+}
+
+// Usage: tests bench [presets.ini]
+// Times parsing and constructing style strings with many arguments.
+// The arguments of the style= lines in the presets file are used with
+// the big test style (builtin 1 1), otherwise a made up string is used.
+struct NullPrint : public Print {
+  size_t write(uint8_t s) override { return 1; }
+};
+
+void benchmark(const char* filename) {
+  // Constructing styles prints their size, which would be quite noisy.
+  NullPrint null_print;
+  default_output = &null_print;
+  std::vector<std::string> styles;
+  if (filename) {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+      printf("Failed to open %s\n", filename);
+      exit(1);
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+      if (strncmp(line, "style=", 6)) continue;
+      line[strcspn(line, "\r\n")] = 0;
+      const char* str = line + 6;
+      styles.push_back(std::string("builtin 1 1") + (str + StyleParser::StyleIdentifierLength(str)));
+    }
+    fclose(f);
+  }
+  if (styles.empty()) {
+    std::string str = "builtin 1 1";
+    for (int i = 1; i <= 41; i++) {
+      if (i % 7 == 0) str += " ~";
+      else if (i % 9 == 8) str += " " + std::to_string(i * 100);
+      else str += " " + std::to_string(i) + ",128,65535";
+    }
+    styles.push_back(str);
+  }
+  int rounds = 20000 / styles.size() + 1;
+  double scanning = time_construct<ScanningArgParser>(styles, rounds);
+  double tokenized = time_construct<ArgParser>(styles, rounds);
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (const std::string& str : styles) {
+      style_parser.SetArgument(str.c_str(), 20, "1,2,3");
+    }
+  }
+  std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - start;
+  // SetArgument used to call GetArgument for every argument.
+  char tmp[1024];
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds / 10 + 1; r++) {
+    for (const std::string& str : styles) {
+      for (int i = 0; i < CountWords(str.c_str()); i++) {
+	style_parser.GetArgument(str.c_str(), i, tmp);
+      }
+    }
+  }
+  std::chrono::duration<double, std::micro> t2 = std::chrono::steady_clock::now() - start;
+  printf("%d style strings, %d words on average\n", (int)styles.size(),
+	 (int)(std::accumulate(styles.begin(), styles.end(), 0,
+			       [](int n, const std::string& s) { return n + CountWords(s.c_str()); }) /
+	       styles.size()));
+  printf("parse + construct, scanning parser:  %8.2f us\n", scanning);
+  printf("parse + construct, tokenized parser: %8.2f us\n", tokenized);
+  printf("SetArgument:                         %8.2f us\n", t.count() / rounds / styles.size());
+  printf("GetArgument for every argument:      %8.2f us\n", t2.count() / (rounds / 10 + 1) / styles.size());
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && !strcmp(argv[1], "bench")) {
+    benchmark(argc > 2 ? argv[2] : nullptr);
+    return 0;
+  }
   test_smoothstep();
   test_layers();
   test_mix();
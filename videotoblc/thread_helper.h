@@ -6,8 +6,10 @@
 
 #include "timing.h"
 
+#ifndef NUM_THREADS
 #define NUM_THREADS 36
 // #define NUM_THREADS 1
+#endif
 
 class Mutex {
 public:
@@ -35,26 +37,35 @@ public:
     return nullptr;
   }
 
+  // Use fewer than NUM_THREADS threads, 1 means run in the calling thread.
+  void set_threads(int threads) {
+    num_threads_ = threads < 1 ? 1 : threads > NUM_THREADS ? NUM_THREADS : threads;
+  }
+  int threads() const { return num_threads_; }
+
   void Run() {
 #if NUM_THREADS > 1
-    for (int i = 0; i < NUM_THREADS; i++) {
-      pthread_create(threads_ + i,
-		     NULL,
-		     &ThreaderBase::WorkerWrapper,
-		     this);
-    }
-    for (int i = 0; i < NUM_THREADS; i++) {
-      pthread_join(threads_[i], NULL);
+    if (num_threads_ > 1) {
+      for (int i = 0; i < num_threads_; i++) {
+	pthread_create(threads_ + i,
+		       NULL,
+		       &ThreaderBase::WorkerWrapper,
+		       this);
+      }
+      for (int i = 0; i < num_threads_; i++) {
+	pthread_join(threads_[i], NULL);
+      }
+      return;
     }
-#else
-    Worker();
 #endif
+    Worker();
   }
 
 protected:
   Mutex mutex_;
 
 private:
+  int num_threads_ = NUM_THREADS;
   pthread_t threads_[NUM_THREADS];
 };
 